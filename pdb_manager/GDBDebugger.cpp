@@ -1,177 +1,689 @@
 #include <PDBDebugger.hpp>
 #include <algorithm>
-#include <cstring>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
-#include <type_traits>
 #include <vector>
 
 namespace pdb {
 std::string GDBDebugger::term = "(gdb) ";
 
-std::vector<std::string> GDBDebugger::readInput() {
+template <typename Visitor>
+PDBRecords GDBDebugger::readRecords(Visitor &&visit) {
   // Fetch all lines from input until we get the terminating symbol
   auto result = fetchByLinesUntil(term);
+  parseRecords(result, visit);
+  return result;
+}
+
+template <typename Visitor>
+void GDBDebugger::parseRecords(const PDBRecords &block, Visitor &&visit) {
+  // Every record is parsed exactly once, state first, then the caller
+  mi::Record record;
+  for (auto line : block) {
+    parser.parse(line, record);
+    updateState(record);
+    visit(record);
+  }
+}
+
+/**
+ * Completion of an asynchronous command. step is given every block in turn,
+ * with reply set if the block holds a result record. Blocks without one only
+ * carry asynchronous records, such as *stopped after ^running. step settles
+ * the promise and returns true once the operation is over, an exception it
+ * throws fails the future
+ */
+template <typename T> class GDBDebugger::Completion : public PDBCompletion {
+public:
+  using Step = std::function<bool(const PDBRecords &block, bool reply,
+                                  boost::promise<T> &promise)>;
+
+  explicit Completion(Step step) : step(std::move(step)) {}
+
+  boost::future<T> getFuture() { return promise.get_future(); }
+
+  bool consume(const PDBRecords &block) override {
+    bool reply = std::any_of(block.begin(), block.end(), [](auto line) {
+      return !line.empty() && line[0] == '^';
+    });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (settled)
+      return true;
+
+    try {
+      settled = step(block, reply, promise);
+    } catch (...) {
+      promise.set_exception(boost::current_exception());
+      settled = true;
+    }
+    return settled;
+  }
 
-  // Update status and internal state
-  for (auto &i : result) {
-    // Check whether we started an application
-    if (i.find("^running") != std::string::npos)
-      isRunning = true;
+  void abandon() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (settled)
+      return;
 
-    if (i.find("*stopped") != std::string::npos) {
-      // Get exact current breakpoint file
-      auto fullNameStart = i.find("fullname=\"");
-      if (fullNameStart == std::string::npos)
-        throw std::runtime_error("Invalid debugger output");
+    promise.set_exception(boost::copy_exception(
+        std::runtime_error("Debugger has closed the connection")));
+    settled = true;
+  }
 
-      auto fullNameEnd =
-          std::find(i.begin() + fullNameStart + 11, i.end(), '\"');
-      if (fullNameEnd == i.end())
-        throw std::runtime_error("Invalid debugger output");
+private:
+  Step step;
+  boost::promise<T> promise;
 
-      std::string fullPath(i.begin() + fullNameStart + 11, fullNameEnd);
+  // Abandoning may race a block being consumed on the reactor
+  std::mutex mutex;
+  bool settled = false;
+};
 
-      // Get exact current breakpoint line number
-      auto lineStart = i.find("line=\"");
-      if (lineStart == std::string::npos)
-        throw std::runtime_error("Invalid debugger output");
+template <typename T, typename Step>
+boost::future<T> GDBDebugger::issue(const std::string &command, Step step) {
+  auto completion = std::make_unique<Completion<T>>(std::move(step));
+  auto future = completion->getFuture();
 
-      auto lineEnd = std::find(i.begin() + lineStart + 7, i.end(), '\"');
-      if (lineEnd == i.end())
-        throw std::runtime_error("Invalid debugger output");
+  try {
+    submitAsync(makeCommand(command), term, std::move(completion));
+  } catch (...) {
+    return boost::make_exceptional_future<T>(boost::current_exception());
+  }
+  return future;
+}
 
-      std::string lineNumberStr(i.begin() + lineStart + 7, lineEnd);
-      std::size_t lineNumber =
-          static_cast<std::size_t>(std::atoi(lineNumberStr.c_str()));
+void GDBDebugger::updateState(const mi::Record &record) {
+  std::lock_guard<std::mutex> lock(state_mutex);
 
-      // Validate source file position
-      currentFile = fullPath;
-      currentLine = lineNumber;
-    };
+  // Greeting of a stub, then of the debugger it has attached
+  if (record.isNotify("pdb-stub"))
+    attached = false;
+  if (record.isNotify("pdb-attached")) {
+    attached = true;
+    isRunning = true;
   }
 
-  return result;
+  // Check whether we started an application
+  if (record.isResult("running"))
+    isRunning = true;
+
+  if (!record.isExec("stopped"))
+    return;
+
+  // The inferior has finished, there is no position to track anymore
+  if (record["reason"].raw().substr(0, 6) == "exited") {
+    isRunning = false;
+    return;
+  }
+
+  // Get exact current breakpoint file and line number
+  auto frame = record["frame"];
+  auto fullname = frame["fullname"];
+  auto line = frame["line"];
+  if (!fullname || !line)
+    return;
+
+  currentFile = fullname.str();
+  currentLine = static_cast<std::size_t>(line.toInt());
+  currentFunction = frame["func"].str();
+}
+
+PDBRecords GDBDebugger::readInput() {
+  return readRecords([](const mi::Record &) {});
 }
 
-void GDBDebugger::checkInput(const std::vector<std::string> &str) const {
+void GDBDebugger::checkInput(const PDBRecords &str) const {
   for (auto &iter : str) {
+    // Diagnostics only come as stream records
+    if (iter.empty() || (iter[0] != '~' && iter[0] != '&'))
+      continue;
+
     if (iter.find("No debugging symbols found") != std::string::npos)
       throw std::runtime_error("No debugging symbols found");
   }
 }
 
-void GDBDebugger::endDebug() {
+/**
+ * Output is looked at on the reactor as it arrives, with a parser of its own,
+ * as readers parse blocks on their threads. The tap may outlive the debugger,
+ * so it keeps its state to itself. Lines are only parsed for the kinds someone
+ * is subscribed to, and for the exit of the inferior
+ */
+struct GDBDebugger::Tap {
+  static constexpr int no_exit = INT_MIN;
+
+  mi::Parser parser;
+  std::shared_ptr<PDBEventHub> hub;
+  std::size_t rank = 0;
+  std::atomic<int> exit_code{no_exit};
+  std::atomic<bool> attached{false}; // Stub has handed the rank over
+
+  void see(std::string_view line);
+};
+
+void GDBDebugger::Tap::see(std::string_view line) {
+  if (line.substr(0, 13) == "=pdb-attached")
+    attached.store(true);
+
+  unsigned kinds = hub ? hub->kinds() : 0;
+  if (kinds == 0 && line.substr(0, 8) != "*stopped")
+    return;
+
+  PDBEvent event;
+  event.rank = rank;
+  if (!makeEvent(parser, line, kinds | PDBEventKind::Exited, event))
+    return;
+
+  if (event.kind == PDBEventKind::Exited)
+    exit_code.store(event.exit_code);
+  if (kinds & static_cast<unsigned>(event.kind))
+    hub->publish(event);
+}
+
+void GDBDebugger::installTap() {
+  tap = std::make_shared<Tap>();
+  setOutputTap([tap = tap](std::string_view line) { tap->see(line); });
+}
+
+void GDBDebugger::setEventHub(std::shared_ptr<PDBEventHub> hub,
+                              std::size_t rank) {
+  tap->hub = std::move(hub);
+  tap->rank = rank;
+}
+
+std::optional<int> GDBDebugger::getExitCode() const {
+  int code = tap->exit_code.load();
+  if (code == Tap::no_exit)
+    return std::nullopt;
+  return code;
+}
+
+bool GDBDebugger::makeEvent(mi::Parser &parser, std::string_view line,
+                            unsigned kinds, PDBEvent &event) {
+  auto wants = [kinds](PDBEventKind kind) {
+    return (kinds & static_cast<unsigned>(kind)) != 0;
+  };
+
+  // Stops are exec records, breakpoints are results or notifications. Other
+  // lines are only output, they are skipped unparsed if it is not wanted
+  if (!wants(PDBEventKind::Output)) {
+    char first = line.empty() ? '\0' : line[0];
+    bool notify = first == '^' || first == '=';
+    if (first != '*' &&
+        !(notify && (wants(PDBEventKind::BreakpointCreated) ||
+                     wants(PDBEventKind::Stopped))))
+      return false;
+  }
+
+  // Output of the inferior is whatever is not MI, unless gdb relays it
+  mi::Record record;
+  if (!parser.parse(line, record)) {
+    if (!wants(PDBEventKind::Output))
+      return false;
+
+    event.kind = PDBEventKind::Output;
+    event.text = std::string(line);
+    return true;
+  }
+
+  switch (record.kind) {
+  case mi::RecordKind::TargetStream:
+    if (!wants(PDBEventKind::Output))
+      return false;
+
+    event.kind = PDBEventKind::Output;
+    event.text = mi::Parser::unescape(record.stream);
+    if (!event.text.empty() && event.text.back() == '\n')
+      event.text.pop_back();
+    return true;
+
+  case mi::RecordKind::ExecAsync:
+    if (record.isExec("running")) {
+      event.kind = PDBEventKind::Running;
+      return wants(PDBEventKind::Running);
+    }
+
+    if (record.isExec("stopped")) {
+      event.reason = record["reason"].str();
+
+      // gdb prints the exit code in octal, a signal leaves none
+      if (event.reason.substr(0, 6) == "exited") {
+        event.kind = PDBEventKind::Exited;
+        auto code = record["exit-code"].str();
+        event.exit_code =
+            event.reason == "exited-signalled"
+                ? -1
+                : static_cast<int>(std::strtol(code.c_str(), nullptr, 8));
+        return wants(PDBEventKind::Exited);
+      }
+
+      event.kind = PDBEventKind::Stopped;
+      if (!wants(PDBEventKind::Stopped))
+        return false;
+
+      auto frame = record["frame"];
+      event.position = std::make_pair(
+          static_cast<std::size_t>(frame["line"].toInt()),
+          frame["fullname"].str());
+      event.function = frame["func"].str();
+      return true;
+    }
+    return false;
+
+  case mi::RecordKind::Result:
+  case mi::RecordKind::NotifyAsync: {
+    // A lazily launched rank has faulted, its stub is attaching a debugger
+    if (record.isNotify("pdb-attached")) {
+      if (record["reason"].raw() != "signal-received" ||
+          !wants(PDBEventKind::Stopped))
+        return false;
+
+      event.kind = PDBEventKind::Stopped;
+      event.reason = "signal-received";
+      event.text = record["signal-name"].str();
+      return true;
+    }
+
+    // Both a reply to -break-insert and a breakpoint set from the console
+    if (!record.isResult("done") && !record.isNotify("breakpoint-created"))
+      return false;
+
+    auto bkpt = record["bkpt"];
+    if (!bkpt || !wants(PDBEventKind::BreakpointCreated))
+      return false;
+
+    event.kind = PDBEventKind::BreakpointCreated;
+    event.text = bkpt["number"].str();
+    event.position = std::make_pair(
+        static_cast<std::size_t>(bkpt["line"].toInt()), bkpt["fullname"].str());
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+bool GDBDebugger::isAttached() {
+  std::unique_lock<std::mutex> lock(state_mutex);
+  if (!attached && tap->attached.load()) {
+    lock.unlock();
+    checkInput(readInput());
+    lock.lock();
+  }
+  return attached;
+}
+
+void GDBDebugger::submitAttach() {
+  if (isAttached())
+    return;
+
+  submitCommand(makeCommand("attach"));
+  attaching = true;
+}
+
+void GDBDebugger::collectAttach() {
+  if (!attaching)
+    return;
+  attaching = false;
+
+  // A rank that faults meanwhile is attached without the request, which then
+  // reaches its debugger, and the error it answers with is skipped
+  for (bool answered = false; !answered;) {
+    parseRecords(fetchByLinesUntil(term), [&](const mi::Record &record) {
+      if (record.isNotify("pdb-attached")) {
+        answered = record["request"].raw() == "1";
+      } else if (record.kind == mi::RecordKind::Result) {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if (!attached)
+          throw std::logic_error("Error attaching debugger: " +
+                                 record["msg"].str());
+        answered = true;
+      }
+    });
+  }
+}
+
+void GDBDebugger::submitEnd() {
   std::string command = makeCommand("quit");
   submitCommand(command);
+}
 
+void GDBDebugger::collectEnd() {
   // Skip whatever gdb has left on stdout just to let it exit peacefully
   readInput();
+
+  std::lock_guard<std::mutex> lock(state_mutex);
   isRunning = false;
 }
 
-void GDBDebugger::startDebug(const std::string &args) {
+void GDBDebugger::submitStart(const std::string &args) {
   auto command = makeCommand("r " + args);
   submitCommand(command);
+}
 
-  auto result = readInput();
-  checkInput(result);
+void GDBDebugger::collectStart() {
+  if (interpretStartReply(fetchByLinesUntil(term)))
+    return;
 
-  for (auto &iter : result) {
-    if (iter[0] == '^') {
-      if (iter.find("error") != std::string::npos)
-        throw std::logic_error("Error starting debugging");
-    }
+  // To get to the breakpoint
+  interpretStartStop(fetchByLinesUntil(term));
+}
 
-    if (iter.find("^done") != std::string::npos)
-      return;
-  }
+bool GDBDebugger::interpretStartReply(const PDBRecords &block) {
+  bool done = false;
 
-  // To get to the breakpoint
-  result = readInput();
-  for (auto &iter : result) {
-    if (iter.find("error") != std::string::npos)
+  parseRecords(block, [&](const mi::Record &record) {
+    if (record.isResult("error"))
+      throw std::logic_error("Error starting debugging");
+    if (record.isResult("done"))
+      done = true;
+  });
+  checkInput(block);
+
+  return done;
+}
+
+bool GDBDebugger::interpretStartStop(const PDBRecords &block) {
+  bool stopped = false;
+
+  parseRecords(block, [&](const mi::Record &record) {
+    if (record.isResult("error"))
       throw std::runtime_error("Debugging error");
 
-    if (iter.find("*stopped") != std::string::npos &&
-        iter.find("breakpoint-hit") == std::string::npos)
-      throw std::runtime_error("Unable to start debugging");
-  }
+    if (record.isExec("stopped")) {
+      if (record["reason"].raw() != "breakpoint-hit")
+        throw std::runtime_error("Unable to start debugging");
+      stopped = true;
+    }
+  });
 
+  std::lock_guard<std::mutex> lock(state_mutex);
   isRunning = true;
+  return stopped;
+}
+
+boost::future<void> GDBDebugger::startAsync(const std::string &args) {
+  // ^running first, then the block holding *stopped
+  return issue<void>(
+      "r " + args, [this, running = false](const PDBRecords &block,
+                                           bool reply,
+                                           boost::promise<void> &promise) mutable {
+        if (!running && !reply) {
+          parseRecords(block, [](const mi::Record &) {});
+          return false;
+        }
+
+        if (!running) {
+          if (interpretStartReply(block)) {
+            promise.set_value();
+            return true;
+          }
+          running = true;
+          return false;
+        }
+
+        if (!interpretStartStop(block))
+          return false;
+        promise.set_value();
+        return true;
+      });
+}
+
+bool GDBDebugger::interpretStop(const PDBRecords &block) {
+  bool stopped = false;
+
+  parseRecords(block, [&](const mi::Record &record) {
+    if (record.isResult("error"))
+      throw std::logic_error("Cannot step (" + record["msg"].str() + ")");
+    if (record.isExec("stopped"))
+      stopped = true;
+  });
+
+  return stopped;
+}
+
+/**
+ * Not checked against isRunning, a step may be queued behind a start still in
+ * flight. Without a process gdb replies with an error instead
+ */
+boost::future<void> GDBDebugger::stepAsync() {
+  // ^running, then *stopped at the next line or on exit
+  return issue<void>(
+      "-exec-next", [this, running = false](const PDBRecords &block, bool reply,
+                                            boost::promise<void> &promise) mutable {
+        bool stopped = interpretStop(block);
+        running = running || reply;
+        if (!running || !stopped)
+          return false;
+
+        promise.set_value();
+        return true;
+      });
+}
+
+std::string GDBDebugger::interpretValue(const PDBRecords &block) {
+  std::string value, error;
+
+  parseRecords(block, [&](const mi::Record &record) {
+    if (record.isResult("error"))
+      error = record["msg"].str();
+    else if (record.isResult("done"))
+      value = record["value"].str();
+  });
+
+  if (!error.empty())
+    throw std::logic_error("Cannot evaluate expression (" + error + ")");
+
+  return value;
+}
+
+boost::future<std::string>
+GDBDebugger::evaluateAsync(const std::string &expression) {
+  // MI takes the expression as a C string
+  std::string quoted = "\"";
+  for (char c : expression) {
+    if (c == '"' || c == '\\')
+      quoted.push_back('\\');
+    quoted.push_back(c);
+  }
+  quoted.push_back('"');
+
+  return issue<std::string>(
+      "-data-evaluate-expression " + quoted,
+      [this](const PDBRecords &block, bool reply,
+             boost::promise<std::string> &promise) {
+        if (!reply) {
+          parseRecords(block, [](const mi::Record &) {});
+          return false;
+        }
+
+        promise.set_value(interpretValue(block));
+        return true;
+      });
+}
+
+void GDBDebugger::submitBreakpoint(PDBbr brpoint) {
+  reserveBreakpoint(brpoint);
+
+  std::string command = makeCommand("-break-insert " + brpoint.second + ":" +
+                                    std::to_string(brpoint.first));
+  try {
+    submitCommand(command);
+  } catch (...) {
+    releaseBreakpoint(brpoint, false);
+    throw;
+  }
 }
 
-void GDBDebugger::setBreakpoint(PDBbr brpoint) {
+void GDBDebugger::reserveBreakpoint(const PDBbr &brpoint) {
   if (brpoint.second.length() == 0)
     throw std::logic_error("Error setting breakpoint in unknown file");
 
+  std::lock_guard<std::mutex> lock(state_mutex);
+  std::string brLocation = brpoint.second + ":" + std::to_string(brpoint.first);
+  if (std::find(pending.begin(), pending.end(), brpoint) != pending.end())
+    throw std::logic_error("Breakpoint is already being set at: " +
+                           brLocation);
+
   // Check if breakpoint is already set
-  bool br_found = false;
+  for (auto &brs : breakpoints) {
+    if (brs.first != brpoint.second)
+      continue;
+
+    if (std::find(brs.second.begin(), brs.second.end(), brpoint.first) !=
+        brs.second.end())
+      throw std::logic_error("Breakpoint is already set at: " + brLocation);
+  }
+
+  pending.push_back(brpoint);
+}
+
+void GDBDebugger::releaseBreakpoint(const PDBbr &brpoint, bool created) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  auto reserved = std::find(pending.begin(), pending.end(), brpoint);
+  if (reserved != pending.end())
+    pending.erase(reserved);
+  if (!created)
+    return;
 
+  // Add a new breakpoint to the list
   for (auto &brs : breakpoints) {
     if (brs.first == brpoint.second) {
       brs.second.push_back(brpoint.first);
-      br_found = true;
+      return;
     }
   }
 
-  if (br_found) {
-    std::string brLocation =
-        brpoint.second + ":" + std::to_string(brpoint.first);
-    throw std::logic_error("Breakpoint is already set at: " + brLocation);
+  breakpoints.push_back(
+      std::make_pair(brpoint.second, std::vector<int>(1, brpoint.first)));
+}
+
+void GDBDebugger::collectBreakpoint(PDBbr brpoint) {
+  interpretBreakpoint(brpoint, fetchByLinesUntil(term));
+}
+
+boost::future<void> GDBDebugger::setBreakpointAsync(PDBbr brpoint) {
+  try {
+    reserveBreakpoint(brpoint);
+  } catch (...) {
+    return boost::make_exceptional_future<void>(boost::current_exception());
   }
 
-  std::string command =
-      makeCommand("b " + brpoint.second + ":" + std::to_string(brpoint.first));
-  submitCommand(command);
+  auto completion = std::make_unique<Completion<void>>(
+      [this, brpoint](const PDBRecords &block, bool reply,
+                      boost::promise<void> &promise) {
+        if (!reply) {
+          parseRecords(block, [](const mi::Record &) {});
+          return false;
+        }
+
+        interpretBreakpoint(brpoint, block);
+        promise.set_value();
+        return true;
+      });
+  auto future = completion->getFuture();
+
+  // Unlike issue, the reservation is dropped when the command is not written
+  try {
+    submitAsync(makeCommand("-break-insert " + brpoint.second + ":" +
+                            std::to_string(brpoint.first)),
+                term, std::move(completion));
+  } catch (...) {
+    releaseBreakpoint(brpoint, false);
+    return boost::make_exceptional_future<void>(boost::current_exception());
+  }
+  return future;
+}
 
-  auto result = readInput();
-  checkInput(result);
+void GDBDebugger::interpretBreakpoint(const PDBbr &brpoint,
+                                      const PDBRecords &block) {
+  std::string location = brpoint.second + ":" + std::to_string(brpoint.first);
+  std::string error;
+  bool created = false;
+  bool pending = false;
 
   /**
-   * At this moment, we may want to check output from "br" command
-   * to understand if breakpoint has been set. We have to check second
-   * string if it has substring "No source file" and the line right
-   * before "^done" on more detailed information if so exist
+   * -break-insert replies either with ^error,msg="No source file named ..."
+   * or with ^done,bkpt={...}. A breakpoint that could not be resolved in the
+   * executable has its address reported as <PENDING>
    */
-  if (strstr(result[1].c_str(), "No source file") != NULL) {
-    throw std::logic_error(
-        "Cannot set breakpoint at specified location: " + brpoint.second + ":" +
-        std::to_string(brpoint.first));
+  try {
+    parseRecords(block, [&](const mi::Record &record) {
+      if (record.isResult("error")) {
+        error = record["msg"].str();
+      } else if (record.isResult("done")) {
+        auto bkpt = record["bkpt"];
+        created = static_cast<bool>(bkpt);
+        pending = bkpt["addr"].raw() == "<PENDING>";
+      }
+    });
+    checkInput(block);
+  } catch (...) {
+    releaseBreakpoint(brpoint, false);
+    throw;
   }
+  releaseBreakpoint(brpoint, error.empty() && created && !pending);
 
-  // Find string that starts with "=breakpoint-created"
-  auto br_created = std::find(result.begin(), result.end(), "^done") - 1;
-
-  // Tokenize string
-  char *list = new char[br_created->length() + 1];
-  memcpy(list, br_created->c_str(), br_created->length());
-  list[br_created->length()] = 0;
-
-  char *token = strtok(list, ",");
-
-  do {
-    if (strstr(token, "addr") != NULL)
-      break;
-  } while ((token = strtok(NULL, ",")));
+  if (!error.empty()) {
+    throw std::logic_error("Cannot set breakpoint at specified location: " +
+                           location + " (" + error + ")");
+  }
 
   // Return an error if we failed to parse command
-  if (strstr(token, "addr") == NULL) {
-    throw std::logic_error("Failed parsing <br " + brpoint.second + ":" +
-                           std::to_string(brpoint.first) + ">");
-  }
+  if (!created)
+    throw std::logic_error("Failed parsing <br " + location + ">");
 
   // If breakpoint has status "PENDING", it means we cannot obtain its
   // information from executable
-  if (strstr(token, "<PENDING>") != NULL) {
-    throw std::logic_error("Breakpoint is already set at: " + brpoint.second +
-                           ":" + std::to_string(brpoint.first));
+  if (pending) {
+    throw std::logic_error("Cannot set breakpoint at specified location: " +
+                           location);
   }
+}
 
-  // Add a new breakpoint to the list
-  if (br_found != true) {
-    breakpoints.push_back(
-        std::make_pair(brpoint.second, std::vector<int>(1, brpoint.first)));
-  }
+void GDBDebugger::submitStack() {
+  if (!getCurrentStatus())
+    throw std::logic_error("The debugging is not started");
+
+  submitCommand(makeCommand("-stack-list-frames"));
+}
+
+std::vector<PDBFrame> GDBDebugger::collectStack() {
+  std::vector<PDBFrame> frames;
+  std::string error;
+
+  // ^done,stack=[frame={level="0",func="main",fullname="...",line="5"},...]
+  auto result = readRecords([&](const mi::Record &record) {
+    if (record.isResult("error")) {
+      error = record["msg"].str();
+      return;
+    }
+    if (!record.isResult("done"))
+      return;
+
+    for (auto frame : record["stack"]) {
+      PDBFrame entry;
+      entry.func = frame["func"].str();
+      entry.file = frame["fullname"] ? frame["fullname"].str()
+                                     : frame["file"].str();
+      entry.line = static_cast<std::size_t>(frame["line"].toInt());
+      if (entry.func.empty())
+        entry.func = frame["from"] ? frame["from"].str() : frame["addr"].str();
+      frames.push_back(std::move(entry));
+    }
+  });
+  checkInput(result);
+
+  if (!error.empty())
+    throw std::logic_error("Cannot list stack frames (" + error + ")");
+
+  return frames;
 }
 } // namespace pdb
@@ -0,0 +1,321 @@
+#include <GDBMIParser.hpp>
+#include <charconv>
+
+namespace pdb {
+namespace mi {
+std::string_view Value::raw() const {
+  if (nodes == nullptr)
+    return std::string_view();
+  return nodes[idx].text;
+}
+
+std::string Value::str() const { return Parser::unescape(raw()); }
+
+long long Value::toInt(long long fallback) const {
+  auto text = raw();
+  long long result;
+
+  auto end = text.data() + text.size();
+  auto [ptr, ec] = std::from_chars(text.data(), end, result);
+  if (ec != std::errc() || ptr != end || text.empty())
+    return fallback;
+  return result;
+}
+
+Value Value::operator[](std::string_view name) const {
+  if (nodes == nullptr || nodes[idx].kind == ValueKind::Const)
+    return Value();
+
+  for (auto i = nodes[idx].child; i != 0; i = nodes[i].next) {
+    if (nodes[i].name == name)
+      return Value(nodes, i);
+  }
+  return Value();
+}
+
+Value::iterator Value::begin() const {
+  if (nodes == nullptr || nodes[idx].kind == ValueKind::Const)
+    return end();
+  return iterator(nodes, nodes[idx].child);
+}
+
+bool Parser::parse(std::string_view line, Record &out) {
+  input = line;
+  pos = 0;
+  nodes.clear();
+  out = Record();
+
+  // Prompt terminating a block, gdb prints it with a trailing space
+  if (line == "(gdb) " || line == "(gdb)") {
+    out.kind = RecordKind::Prompt;
+    return true;
+  }
+
+  // Optional numeric token preceding the record
+  while (!atEnd() && peek() >= '0' && peek() <= '9')
+    pos++;
+  out.token = input.substr(0, pos);
+
+  if (atEnd())
+    return false;
+
+  RecordKind kind;
+  switch (input[pos++]) {
+  case '^':
+    kind = RecordKind::Result;
+    break;
+  case '*':
+    kind = RecordKind::ExecAsync;
+    break;
+  case '+':
+    kind = RecordKind::StatusAsync;
+    break;
+  case '=':
+    kind = RecordKind::NotifyAsync;
+    break;
+  case '~':
+    kind = RecordKind::ConsoleStream;
+    break;
+  case '@':
+    kind = RecordKind::TargetStream;
+    break;
+  case '&':
+    kind = RecordKind::LogStream;
+    break;
+  default:
+    return false;
+  }
+
+  if (kind == RecordKind::ConsoleStream || kind == RecordKind::TargetStream ||
+      kind == RecordKind::LogStream) {
+    if (!parseString(out.stream) || !atEnd())
+      return false;
+
+    out.kind = kind;
+    return true;
+  }
+
+  // Result or async class runs up to the first comma
+  auto start = pos;
+  while (!atEnd() && peek() != ',')
+    pos++;
+  out.klass = input.substr(start, pos - start);
+
+  auto root = addNode(ValueKind::Tuple, std::string_view());
+  if (!parseResults(root, 0))
+    return false;
+
+  nodes[root].text = input.substr(start);
+  out.results = Value(nodes.data(), root);
+  out.kind = kind;
+  return true;
+}
+
+std::uint32_t Parser::addNode(ValueKind kind, std::string_view name) {
+  nodes.push_back(Node{name, std::string_view(), kind, 0, 0});
+  return static_cast<std::uint32_t>(nodes.size() - 1);
+}
+
+void Parser::link(std::uint32_t parent, std::uint32_t &last,
+                  std::uint32_t idx) {
+  if (last == 0)
+    nodes[parent].child = idx;
+  else
+    nodes[last].next = idx;
+  last = idx;
+}
+
+/**
+ * Comma separated results up to close, or up to the end of the line if close
+ * is 0. At the top level of a record, the leading comma is part of the list.
+ */
+bool Parser::parseResults(std::uint32_t parent, char close) {
+  std::uint32_t last = 0;
+  bool first = true;
+
+  while (true) {
+    if (close == 0 && atEnd())
+      return true;
+    if (close != 0) {
+      if (atEnd())
+        return false;
+      if (peek() == close) {
+        pos++;
+        return true;
+      }
+    }
+
+    if (!first || close == 0) {
+      if (peek() != ',')
+        return false;
+      pos++;
+    }
+    first = false;
+
+    std::uint32_t idx;
+    if (!parseResult(idx))
+      return false;
+    link(parent, last, idx);
+  }
+}
+
+// List elements are either all values or all results
+bool Parser::parseValues(std::uint32_t parent, char close) {
+  std::uint32_t last = 0;
+  bool first = true;
+
+  while (true) {
+    if (atEnd())
+      return false;
+    if (peek() == close) {
+      pos++;
+      return true;
+    }
+
+    if (!first) {
+      if (peek() != ',')
+        return false;
+      pos++;
+      if (atEnd())
+        return false;
+    }
+    first = false;
+
+    std::uint32_t idx;
+    char c = peek();
+    bool ok = (c == '"' || c == '{' || c == '[')
+                  ? parseValue(idx, std::string_view())
+                  : parseResult(idx);
+    if (!ok)
+      return false;
+    link(parent, last, idx);
+  }
+}
+
+bool Parser::parseResult(std::uint32_t &idx) {
+  if (atEnd())
+    return false;
+
+  // gdb emits nameless tuples for breakpoints with multiple locations:
+  // bkpt={...},{...}
+  char c = peek();
+  if (c == '{' || c == '[' || c == '"')
+    return parseValue(idx, std::string_view());
+
+  auto start = pos;
+  while (!atEnd() && peek() != '=')
+    pos++;
+  if (atEnd())
+    return false;
+
+  auto name = input.substr(start, pos - start);
+  pos++;
+  return parseValue(idx, name);
+}
+
+bool Parser::parseValue(std::uint32_t &idx, std::string_view name) {
+  if (atEnd())
+    return false;
+
+  auto start = pos;
+  switch (peek()) {
+  case '"': {
+    idx = addNode(ValueKind::Const, name);
+    std::string_view text;
+    if (!parseString(text))
+      return false;
+    nodes[idx].text = text;
+    return true;
+  }
+  case '{':
+    idx = addNode(ValueKind::Tuple, name);
+    pos++;
+    if (!parseResults(idx, '}'))
+      return false;
+    break;
+  case '[':
+    idx = addNode(ValueKind::List, name);
+    pos++;
+    if (!parseValues(idx, ']'))
+      return false;
+    break;
+  default:
+    return false;
+  }
+
+  nodes[idx].text = input.substr(start + 1, pos - start - 2);
+  return true;
+}
+
+// Quoted c-string, text receives the contents between quotes as they are
+bool Parser::parseString(std::string_view &text) {
+  if (atEnd() || peek() != '"')
+    return false;
+
+  auto start = ++pos;
+  while (!atEnd()) {
+    char c = input[pos];
+    if (c == '\\') {
+      pos += 2;
+      continue;
+    }
+    if (c == '"') {
+      text = input.substr(start, pos - start);
+      pos++;
+      return true;
+    }
+    pos++;
+  }
+
+  return false;
+}
+
+std::string Parser::unescape(std::string_view text) {
+  std::string result;
+  result.reserve(text.size());
+
+  for (std::size_t i = 0; i < text.size(); i++) {
+    if (text[i] != '\\' || i + 1 == text.size()) {
+      result.push_back(text[i]);
+      continue;
+    }
+
+    char c = text[++i];
+    switch (c) {
+    case 'n':
+      result.push_back('\n');
+      break;
+    case 't':
+      result.push_back('\t');
+      break;
+    case 'r':
+      result.push_back('\r');
+      break;
+    case 'e':
+      result.push_back('\033');
+      break;
+    case '0':
+    case '1':
+    case '2':
+    case '3': {
+      // Octal escape, up to three digits
+      int value = 0, digits = 0;
+      while (digits < 3 && i < text.size() && text[i] >= '0' &&
+             text[i] <= '7') {
+        value = value * 8 + (text[i++] - '0');
+        digits++;
+      }
+      i--;
+      result.push_back(static_cast<char>(value));
+      break;
+    }
+    default:
+      result.push_back(c);
+      break;
+    }
+  }
+
+  return result;
+}
+} // namespace mi
+} // namespace pdb
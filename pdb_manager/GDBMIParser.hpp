@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pdb {
+namespace mi {
+/**
+ * GDB/MI output record kinds, see "GDB/MI Output Syntax" in the gdb manual.
+ * Prompt is the "(gdb) " line terminating a block of records.
+ */
+enum class RecordKind : std::uint8_t {
+  Result,        // ^done, ^running, ^error, ...
+  ExecAsync,     // *stopped, *running
+  StatusAsync,   // +download
+  NotifyAsync,   // =breakpoint-created, =thread-group-exited, ...
+  ConsoleStream, // ~"..."
+  TargetStream,  // @"..."
+  LogStream,     // &"..."
+  Prompt,        // (gdb)
+  Invalid        // Not an MI record, e.g. output of the inferior
+};
+
+enum class ValueKind : std::uint8_t { Const, Tuple, List };
+
+/**
+ * Parsed value as stored by the parser. Values form a tree laid out in a flat
+ * vector, children and siblings are linked by index. Index 0 is always the
+ * root tuple of a record, so 0 doubles as "no node".
+ */
+struct Node {
+  std::string_view name; // Variable name, empty for list elements
+  std::string_view text; // Escaped contents of a const, whole text otherwise
+  ValueKind kind;
+  std::uint32_t child; // First child
+  std::uint32_t next;  // Next sibling
+};
+
+/**
+ * Lightweight handle to a parsed value. Valid until the parser that produced
+ * it parses the next line.
+ */
+class Value {
+public:
+  class iterator {
+  public:
+    iterator(const Node *nodes, std::uint32_t idx) : nodes(nodes), idx(idx) {}
+
+    Value operator*() const { return Value(nodes, idx); }
+    iterator &operator++() {
+      idx = nodes[idx].next;
+      return *this;
+    }
+    bool operator!=(const iterator &other) const { return idx != other.idx; }
+
+  private:
+    const Node *nodes;
+    std::uint32_t idx;
+  };
+
+  Value() = default;
+  Value(const Node *nodes, std::uint32_t idx) : nodes(nodes), idx(idx) {}
+
+  explicit operator bool() const { return nodes != nullptr; }
+
+  ValueKind kind() const { return nodes[idx].kind; }
+  std::string_view name() const { return nodes[idx].name; }
+
+  /**
+   * @return Escaped contents of a const, or empty view if the value does not
+   * exist. For tuples and lists, the text between the brackets
+   */
+  std::string_view raw() const;
+
+  // Unescaped contents of a const, the only call that allocates
+  std::string str() const;
+
+  // Contents of a const parsed as a decimal number, fallback on error
+  long long toInt(long long fallback = 0) const;
+
+  // First child with the given name, invalid value if there is none
+  Value operator[](std::string_view name) const;
+
+  iterator begin() const;
+  iterator end() const { return iterator(nodes, 0); }
+
+private:
+  const Node *nodes = nullptr;
+  std::uint32_t idx = 0;
+};
+
+/**
+ * Single MI output record. For stream records, stream holds the escaped
+ * string, results is empty.
+ */
+struct Record {
+  RecordKind kind = RecordKind::Invalid;
+  std::string_view token;
+  std::string_view klass; // Result or async class, like "done" or "stopped"
+  std::string_view stream;
+  Value results;
+
+  Value operator[](std::string_view name) const { return results[name]; }
+
+  bool isResult(std::string_view cls) const {
+    return kind == RecordKind::Result && klass == cls;
+  }
+  bool isExec(std::string_view cls) const {
+    return kind == RecordKind::ExecAsync && klass == cls;
+  }
+  bool isNotify(std::string_view cls) const {
+    return kind == RecordKind::NotifyAsync && klass == cls;
+  }
+  bool isStream() const {
+    return kind == RecordKind::ConsoleStream ||
+           kind == RecordKind::TargetStream || kind == RecordKind::LogStream;
+  }
+};
+
+/**
+ * Single-pass GDB/MI parser. Records are parsed line by line as they arrive.
+ * Everything the parser returns is a view into the input line or into the
+ * node storage, which is reused between lines, so no allocation happens per
+ * field once the storage has grown to fit the largest record.
+ */
+class Parser {
+public:
+  /**
+   * @param line - one line of debugger output without trailing newline
+   * @param out - parsed record, valid until the next call to parse
+   * @return false if line is not a valid MI record, out.kind is Invalid then
+   */
+  bool parse(std::string_view line, Record &out);
+
+  // Undo C-style escaping of an MI c-string
+  static std::string unescape(std::string_view text);
+
+private:
+  std::vector<Node> nodes;
+  std::string_view input;
+  std::size_t pos = 0;
+
+  std::uint32_t addNode(ValueKind kind, std::string_view name);
+  bool parseResults(std::uint32_t parent, char close);
+  bool parseValues(std::uint32_t parent, char close);
+  bool parseResult(std::uint32_t &idx);
+  bool parseValue(std::uint32_t &idx, std::string_view name);
+  bool parseString(std::string_view &text);
+  void link(std::uint32_t parent, std::uint32_t &last, std::uint32_t idx);
+
+  bool atEnd() const { return pos >= input.size(); }
+  char peek() const { return input[pos]; }
+};
+} // namespace mi
+} // namespace pdb
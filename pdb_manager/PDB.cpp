@@ -1,17 +1,38 @@
 #include <PDB.hpp>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
+#include <fstream>
 #include <iostream>
 #include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+// Built with PDB_NATIVE_DEBUGGER, ranks are traced by pdb_agent, not gdb
+#ifdef PDB_NATIVE_DEBUGGER
+using Debugger = pdb::PDBDebug<pdb::NativeDebugger>;
+static const char *const debugger_path = "./pdb_agent";
+#else
 using Debugger = pdb::PDBDebug<pdb::GDBDebugger>;
+static const char *const debugger_path = "/usr/bin/gdb";
+#endif
 
-void brCommand(const std::vector<std::string> &command, Debugger &pdb_instance);
+void brCommand(const std::vector<std::string> &command,
+               const pdb::PDBProcSet &procs, Debugger &pdb_instance);
+std::size_t reportFailures(const Debugger::PDBStatus &status);
 void infoCommand(const std::vector<std::string> &command,
                  Debugger &pdb_instance);
+void defsetCommand(const std::vector<std::string> &command,
+                   Debugger &pdb_instance);
+void whereCommand(const pdb::PDBProcSet &procs, Debugger &pdb_instance);
+void stacksCommand(const std::vector<std::string> &command,
+                   const pdb::PDBProcSet &procs, Debugger &pdb_instance);
+void watchCommand(const std::vector<std::string> &command,
+                  Debugger &pdb_instance);
+void mpitraceCommand(const std::vector<std::string> &command,
+                     const pdb::PDBProcSet &procs, Debugger &pdb_instance);
 
 void PDBcommand(Debugger &pdb_instance) {
   std::string command;
@@ -34,23 +55,63 @@ void PDBcommand(Debugger &pdb_instance) {
       std::string temp;
       while (sstream >> temp)
         comm_parsed.push_back(temp);
+      if (comm_parsed.empty())
+        continue;
+
+      // Optional process set prefix, "[0-3] b file:line" or "[name] r"
+      auto procs = pdb_instance.getProcSet("all");
+      auto &prefix = comm_parsed[0];
+      if (prefix.front() == '[') {
+        if (prefix.size() < 3 || prefix.back() != ']')
+          throw std::logic_error("Invalid process set: " + prefix);
+
+        procs = pdb_instance.getProcSet(prefix.substr(1, prefix.size() - 2));
+        if (procs.empty())
+          throw std::logic_error("Empty process set: " + prefix);
+
+        comm_parsed.erase(comm_parsed.begin());
+        if (comm_parsed.empty())
+          throw std::logic_error("Missing command after " + prefix);
+      }
 
       if (comm_parsed[0] == "b") {
-        brCommand(comm_parsed, pdb_instance);
+        brCommand(comm_parsed, procs, pdb_instance);
       } else if (comm_parsed[0] == "info" && comm_parsed.size() > 1) {
         infoCommand(comm_parsed, pdb_instance);
+      } else if (comm_parsed[0] == "defset") {
+        defsetCommand(comm_parsed, pdb_instance);
+      } else if (comm_parsed[0] == "where") {
+        whereCommand(procs, pdb_instance);
+      } else if (comm_parsed[0] == "stacks") {
+        stacksCommand(comm_parsed, procs, pdb_instance);
+      } else if (comm_parsed[0] == "attach") {
+        auto status = pdb_instance.attach(procs);
+        if (reportFailures(status) < status.size())
+          whereCommand(procs, pdb_instance);
+      } else if (comm_parsed[0] == "watch") {
+        watchCommand(comm_parsed, pdb_instance);
+      } else if (comm_parsed[0] == "mpitrace") {
+        mpitraceCommand(comm_parsed, procs, pdb_instance);
+      } else if (comm_parsed[0] == "deadlock") {
+        auto deadlocks = pdb_instance.findDeadlocks();
+        if (deadlocks.empty())
+          std::cout << "No deadlock found" << std::endl;
+        for (auto &deadlock : deadlocks)
+          std::cout << "\033[91m" << deadlock.toString() << "\033[0m"
+                    << std::endl;
       } else if (command == "q") {
         break;
-      } else if (command == "r") {
+      } else if (comm_parsed[0] == "r") {
         std::string args;
         for (auto i = std::next(comm_parsed.begin()); i < comm_parsed.end();
              i++) {
           args += *i;
         }
-        pdb_instance.startDebug(args);
-        if (pdb_instance.isAllRunning()) {
+        reportFailures(pdb_instance.startDebug(procs, args));
+        if (pdb_instance.isAllRunning(procs)) {
           std::cout << "(pdb) Running..." << std::endl;
-          auto position = pdb_instance.getProcCurrentPosition(0);
+          whereCommand(procs, pdb_instance);
+          auto position = pdb_instance.getProcCurrentPosition(*procs.begin());
           current_line = std::to_string(position.first);
           current_path = position.second;
         }
@@ -68,7 +129,7 @@ void PDBcommand(Debugger &pdb_instance) {
 }
 
 void brCommand(const std::vector<std::string> &commands,
-               Debugger &pdb_instance) {
+               const pdb::PDBProcSet &procs, Debugger &pdb_instance) {
   if (commands.size() != 2) {
     throw std::logic_error("Invalid number of arguments: " +
                            std::to_string(commands.size()));
@@ -86,12 +147,40 @@ void brCommand(const std::vector<std::string> &commands,
     throw std::logic_error("Invalid line number: " + pos);
   }
 
-  Debugger::PDBbr br(static_cast<std::size_t>(filePos), fileName);
-  pdb_instance.setBreakpointsAll(br);
-  std::cout << "\033[92mBreakpoints set at: " << fileName << ":" << pos
+  Debugger::PDBbr br;
+  auto status = pdb_instance.setBreakpoints(
+      procs, Debugger::PDBbr(filePos, fileName), br);
+  if (reportFailures(status) == status.size())
+    return;
+
+  std::cout << "\033[92mBreakpoints set at: " << br.second << ":" << br.first
             << "\033[0m\n";
 }
 
+/**
+ * Print ranks that failed a broadcast operation. Fatal errors are rethrown as
+ * they are, logic errors are only reported.
+ * @return number of failed ranks
+ */
+std::size_t reportFailures(const Debugger::PDBStatus &status) {
+  std::size_t failed = 0;
+
+  for (auto &result : status) {
+    if (result.ok())
+      continue;
+
+    failed++;
+    try {
+      std::rethrow_exception(result.error);
+    } catch (std::logic_error &le) {
+      std::cout << "\033[91mrank " << result.rank << ": " << le.what()
+                << "\033[0m\n";
+    }
+  }
+
+  return failed;
+}
+
 void infoCommand(const std::vector<std::string> &command,
                  Debugger &pdb_instance) {
   if (command[1] == "sources") {
@@ -106,12 +195,241 @@ void infoCommand(const std::vector<std::string> &command,
     auto function = pdb_instance.getFunctionLocation(func_in_question);
     std::cout << "\033[92m" << function.second << "\033[0m" << ":";
     std::cout << "\033[92m" << function.first << "\033[0m" << std::endl;
+  } else if (command[1] == "sets") {
+    for (auto &[name, procs] : pdb_instance.getProcSets()) {
+      std::cout << "\033[92m" << name << "\033[0m: " << procs.toString()
+                << " (" << procs.count() << ")" << std::endl;
+    }
+  } else if (command[1] == "ranks") {
+    // Channel 3: MPI rank 5, pid 4242 @ node01
+    for (std::size_t channel = 0; channel < pdb_instance.size(); channel++) {
+      std::cout << "Channel " << channel << ": ";
+      if (auto info = pdb_instance.getChannelInfo(channel))
+        std::cout << "MPI rank \033[92m" << info->mpi_rank << "\033[0m, pid "
+                  << info->pid << " @ " << info->host << std::endl;
+      else
+        std::cout << "not published" << std::endl;
+    }
   }
 };
 
+/**
+ * Print where the ranks are, one entry per distinct position:
+ * ranks 0-1022 @ solver.cpp:88, rank 1023 @ comm.cpp:40
+ */
+void whereCommand(const pdb::PDBProcSet &procs, Debugger &pdb_instance) {
+  std::string line;
+
+  for (auto &position_class : pdb_instance.getPositionClasses(procs)) {
+    auto &[position, ranks] = position_class;
+    if (!line.empty())
+      line += ", ";
+
+    line += ranks.count() > 1 ? "ranks " : "rank ";
+    line += ranks.toString();
+
+    if (position.second.empty()) {
+      line += " not running";
+      continue;
+    }
+
+    auto name = position.second.substr(position.second.rfind('/') + 1);
+    line += " @ " + name + ":" + std::to_string(position.first);
+  }
+
+  std::cout << "\033[92m" << line << "\033[0m" << std::endl;
+}
+
+/**
+ * stacks [file.dot]
+ * Print merged call stacks of the ranks, or write them as a Graphviz graph
+ */
+void stacksCommand(const std::vector<std::string> &command,
+                   const pdb::PDBProcSet &procs, Debugger &pdb_instance) {
+  if (command.size() > 2) {
+    throw std::logic_error("Invalid number of arguments: " +
+                           std::to_string(command.size()));
+  }
+
+  pdb::PDBStackTree tree(pdb_instance.size());
+  auto status = pdb_instance.collectStacks(procs, tree);
+  if (reportFailures(status) == status.size())
+    return;
+
+  if (command.size() == 1) {
+    tree.print(std::cout);
+    return;
+  }
+
+  std::ofstream dot(command[1]);
+  if (!dot)
+    throw std::logic_error("Cannot open file: " + command[1]);
+  tree.exportDot(dot);
+  std::cout << "\033[92mStack tree written to: " << command[1] << "\033[0m\n";
+}
+
+/**
+ * mpitrace [count]
+ * Print the last MPI calls of the ranks, 8 by default, without stopping them:
+ * rank 1: MPI_Recv peer 0 tag 7 comm 0 64 B, running for 2.1 s
+ */
+void mpitraceCommand(const std::vector<std::string> &command,
+                     const pdb::PDBProcSet &procs, Debugger &pdb_instance) {
+  if (command.size() > 2) {
+    throw std::logic_error("Invalid number of arguments: " +
+                           std::to_string(command.size()));
+  }
+
+  std::size_t count = 8;
+  if (command.size() == 2) {
+    count = std::strtoul(command[1].c_str(), nullptr, 10);
+    if (count == 0)
+      throw std::logic_error("Invalid number of calls: " + command[1]);
+  }
+
+  auto now = pdb::PDBTraceRing::ticks();
+  double rate = pdb::PDBTraceRing::ticksPerMicrosecond();
+  auto duration = [rate](std::uint64_t from, std::uint64_t to) {
+    double us = to > from ? (to - from) / rate : 0.0;
+    char text[32];
+    if (us >= 1e6)
+      std::snprintf(text, sizeof(text), "%.1f s", us / 1e6);
+    else if (us >= 1e3)
+      std::snprintf(text, sizeof(text), "%.1f ms", us / 1e3);
+    else
+      std::snprintf(text, sizeof(text), "%.1f us", us);
+    return std::string(text);
+  };
+
+  for (auto rank : procs) {
+    auto records = pdb_instance.getMPITrace(rank, count);
+    if (records.empty()) {
+      std::cout << "rank " << rank << ": no MPI calls traced" << std::endl;
+      continue;
+    }
+
+    for (auto &record : records) {
+      std::cout << "rank " << rank << ": " << pdb::callName(record.call);
+      if (record.peer >= 0)
+        std::cout << " peer " << record.peer;
+      if (record.tag >= 0)
+        std::cout << " tag " << record.tag;
+      if (record.call == pdb::PDBMPICall::Sendrecv && record.source >= 0)
+        std::cout << " source " << record.source;
+      if (record.call == pdb::PDBMPICall::Sendrecv && record.source_tag >= 0)
+        std::cout << " source tag " << record.source_tag;
+      if (record.comm >= 0)
+        std::cout << " comm " << record.comm << " " << record.bytes << " B";
+
+      if (record.end == 0)
+        std::cout << ", \033[93mrunning for "
+                  << duration(record.begin, now) << "\033[0m";
+      else
+        std::cout << ", " << duration(record.begin, record.end) << ", "
+                  << duration(record.end, now) << " ago";
+      std::cout << std::endl;
+    }
+  }
+}
+
+// Subscription of the watch command, 0 while it is off
+static pdb::PDBEventHub::Id watch_id = 0;
+
+/**
+ * watch on|off
+ * Print output and exit of the ranks as it happens, between commands too.
+ * Ranks printing the same line or exiting with the same code within a short
+ * window are reported once: ranks 0-1023 exited with 0
+ */
+void watchCommand(const std::vector<std::string> &command,
+                  Debugger &pdb_instance) {
+  if (command.size() != 2 || (command[1] != "on" && command[1] != "off"))
+    throw std::logic_error("Usage: watch on|off");
+
+  if (command[1] == "off") {
+    if (watch_id != 0)
+      pdb_instance.unsubscribe(watch_id);
+    watch_id = 0;
+    return;
+  }
+
+  if (watch_id != 0)
+    return;
+
+  auto size = pdb_instance.size();
+  auto handler = [size](const pdb::PDBEventHub::Batch &batch) {
+    // Lines in order of their first appearance, with the ranks printing them
+    std::vector<std::pair<std::string, pdb::PDBProcSet>> lines;
+    for (auto &event : batch) {
+      std::string line;
+      if (event.kind == pdb::PDBEventKind::Output)
+        line = event.text;
+      else
+        line = "\033[93mexited with " + std::to_string(event.exit_code) +
+               "\033[0m";
+
+      auto iter = std::find_if(lines.begin(), lines.end(), [&](auto &entry) {
+        return entry.first == line;
+      });
+      if (iter == lines.end())
+        iter = lines.insert(lines.end(), {line, pdb::PDBProcSet(size)});
+      iter->second.insert(event.rank);
+    }
+
+    std::string text;
+    for (auto &[line, ranks] : lines) {
+      text += ranks.count() > 1 ? "ranks " : "rank ";
+      text += ranks.toString() + ": " + line + "\n";
+    }
+    std::cout << text << std::flush;
+  };
+
+  watch_id = pdb_instance.subscribe(pdb::PDBEventKind::Output |
+                                        pdb::PDBEventKind::Exited,
+                                    handler, std::chrono::milliseconds(50));
+}
+
+// defset <name> <ranks>, ranks as in "0-255,512" or another set name
+void defsetCommand(const std::vector<std::string> &command,
+                   Debugger &pdb_instance) {
+  if (command.size() != 3) {
+    throw std::logic_error("Invalid number of arguments: " +
+                           std::to_string(command.size()));
+  }
+
+  pdb_instance.defineProcSet(command[1], command[2]);
+  std::cout << "\033[92mSet " << command[1] << ": "
+            << pdb_instance.getProcSets().at(command[1]).toString()
+            << "\033[0m\n";
+}
+
 int main() {
   using namespace pdb;
-  auto debug = Debugger("mpirun -np 1", "/usr/bin/gdb", "./mpi_test.out");
+
+  // PDB_RELAY_FANOUT=<n> reaches the debuggers through a tree of relays
+  std::size_t fanout = 0;
+  if (const char *env = std::getenv("PDB_RELAY_FANOUT"))
+    fanout = std::strtoul(env, nullptr, 10);
+
+  // PDB_TRANSPORT=socket connects the debuggers over AF_UNIX sockets, =mux
+  // over one connection per node
+  auto transport = PDBTransport::FIFO;
+  if (const char *env = std::getenv("PDB_TRANSPORT")) {
+    if (std::strcmp(env, "socket") == 0)
+      transport = PDBTransport::Socket;
+    else if (std::strcmp(env, "mux") == 0)
+      transport = PDBTransport::Mux;
+  }
+
+  // PDB_LAUNCH=lazy runs the ranks natively, debuggers are attached on demand
+  auto mode = PDBLaunchMode::Eager;
+  if (const char *env = std::getenv("PDB_LAUNCH")) {
+    if (std::strcmp(env, "lazy") == 0)
+      mode = PDBLaunchMode::Lazy;
+  }
+
+  auto debug = Debugger("mpirun -np 1", debugger_path, "./mpi_test.out",
+                        fanout, transport, mode);
   PDBcommand(debug);
   return 0;
 }
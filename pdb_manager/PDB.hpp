@@ -1,16 +1,34 @@
 #pragma once
 
+#include <PDBChildWatch.hpp>
+#include <PDBDeadlock.hpp>
 #include <PDBDebugger.hpp>
+#include <PDBPositions.hpp>
+#include <PDBProcSet.hpp>
+#include <PDBRegistry.hpp>
+#include <PDBRelayLink.hpp>
+#include <PDBRendezvous.hpp>
+#include <PDBSocketListener.hpp>
+#include <PDBTrace.hpp>
 #include <PDB_DWARF_Handlers.hpp>
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <cstdio>
+#include <csignal>
 #include <cstring>
+#include <dirent.h>
 #include <fcntl.h>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <poll.h>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -19,27 +37,114 @@
 #include <vector>
 
 namespace pdb {
-#define PDB_PIPE_LENGTH 20
+/**
+ * How ranks are started
+ *   Eager - every rank under its debugger
+ *   Lazy  - every rank natively, under a light stub of PDB launch. A debugger
+ *           is only attached to the ranks asked for, see attach, and to ranks
+ *           that fault. The application starts right away, without "r"
+ */
+enum class PDBLaunchMode { Eager, Lazy };
+
+// How a rank has ended, as far as its debugger has reported
+struct PDBRankExit {
+  bool closed = false;          // Debugger has closed its channel
+  std::optional<int> exit_code; // Exit code of the inferior, -1 if signalled
+};
+
+/**
+ * Outcome of PDBDebug::join. The launcher status is decoded the way a shell
+ * does, ranks are reported in rank order
+ */
+struct PDBJoinStatus {
+  bool terminated = false; // Launcher has exited and is reaped
+  int exit_code = 0;       // Exit code of the launcher
+  int signal = 0;          // Signal that has killed the launcher, if any
+  std::vector<PDBRankResult<PDBRankExit>> ranks;
+};
 
 /**
  *  Main Debug instance which communicates with UI
  */
 template <typename DebuggerType> class PDBDebug {
 private:
-  int temporal_file; // File used to pass arguments through PDB runtime
-  std::string temporal_file_name; // Temporal pipe for arguments passing
-  std::string executable;         // User-supplied executable name
-  pid_t exec_pid;                 // Executable PID process
+  std::string channel_dir; // Directory holding channels of every rank
+  std::string executable;  // User-supplied executable name
+  pid_t exec_pid;          // Executable PID process
 
-  // Debugger instances associated with each debugging process
+  // Debugger instances associated with each debugging process, by channel
   std::vector<std::unique_ptr<PDBDebugger>> pdb_proc;
 
+  // Ranks as published by the PDB runtime, see getRankInfo
+  std::unique_ptr<PDBRegistry> registry;
+
+  // MPI call traces of the ranks by channel, mapped on first use
+  mutable std::vector<std::unique_ptr<PDBTraceRing>> traces;
+
+  // Blocking calls of the ranks by MPI rank, as of the last scan
+  std::unique_ptr<PDBWaitGraph> wait_graph;
+
+  // Update the wait-for graph with the last traced call of every rank
+  void scanBlockedCalls();
+
+  // User-defined process sets, by name
+  std::unordered_map<std::string, PDBProcSet> proc_sets;
+
+  // Root of the relay tree, if debuggers are reached through one
+  std::shared_ptr<PDBRelayLink> relay;
+
+  // Connections of node relays with the multiplexed transport
+  std::vector<std::shared_ptr<PDBRelayLink>> node_links;
+
+  // Accepts the ranks with a socket transport until all have connected
+  std::unique_ptr<PDBSocketListener> listener;
+
+  // Events published by every debugger, see subscribe
+  std::shared_ptr<PDBEventHub> events;
+
+  // Signal the launcher's process group until it exits, grace apart
+  bool terminateLauncher(PDBChildWatch &watch,
+                         std::chrono::milliseconds grace);
+
+  // Symbol index of the executable, built once on first use
+  mutable std::unique_ptr<DwarfIndex> dwarf_index;
+  const DwarfIndex &getDwarfIndex() const;
+
   // Parse the input string args into tokens separated by delim
   static std::vector<std::string> parseArgs(const std::string &args,
                                             const std::string &delim);
 
+  /**
+   * Scatter a command to every rank of the set, then gather the replies.
+   * submit(proc) only writes the command, collect(proc) blocks on the reply.
+   * All commands are in flight before the first reply is awaited, so the
+   * broadcast costs roughly one debugger round trip instead of one per rank.
+   *
+   * Ranks whose submit fails are not collected. Failures never interrupt the
+   * broadcast and are reported through the per-rank result instead. Unless
+   * any is asked for, ranks without an attached debugger fail right away.
+   */
+  template <typename Submit, typename Collect>
+  auto broadcast(const PDBProcSet &procs, Submit submit, Collect collect,
+                 bool any = false);
+
+  // Throws std::logic_error if the rank runs without a debugger
+  static void requireAttached(PDBDebugger &proc);
+
+  /**
+   * Asynchronous counterpart of broadcast. issue(proc) starts the operation
+   * on one rank and returns its future. Results are gathered by continuations
+   * run on the reactor as replies arrive, no thread waits for them.
+   */
+  template <typename Issue>
+  auto gather(const PDBProcSet &procs, Issue issue);
+
 public:
   using PDBbr = typename PDBDebugger::PDBbr;
+  using PDBStatus = std::vector<PDBRankResult<>>;
+  template <typename T = std::monostate>
+  using PDBFuture = boost::future<std::vector<PDBRankResult<T>>>;
+
   PDBDebug(const PDBDebug &) = delete;
   PDBDebug(PDBDebug &&) = default;
   ~PDBDebug();
@@ -49,12 +154,21 @@ public:
    * target-specific flags [example] : "mpirun -oversubscribe -np 4"
    * @param debugger - path to debugger
    * @param exec - user-supplied executable
+   * @param relay_fanout - if not 0, debuggers are reached through a tree of
+   * relay processes, each serving at most relay_fanout ranks or relays.
+   * Otherwise every debugger is connected to this process directly
+   * @param transport - channel between this process and each debugger, a relay
+   * tree only works with FIFOs
+   * @param mode - whether debuggers are started with the ranks or on demand
    *
    * PDBDebug<GDBDebugger>("mpirun -np 4 -oversubscribe", "/usr/bin/gdb",
    * "./mpi_test.out");
+   * PDBDebug<NativeDebugger>("mpirun -np 4", "./pdb_agent", "./mpi_test.out");
    */
   PDBDebug(const std::string &start_rountine, const std::string &debugger,
-           const std::string &exec);
+           const std::string &exec, std::size_t relay_fanout = 0,
+           PDBTransport transport = PDBTransport::FIFO,
+           PDBLaunchMode mode = PDBLaunchMode::Eager);
 
   /**
    *  @return On success, return vector of strings, each containing full path
@@ -71,29 +185,165 @@ public:
   std::pair<uint64_t, std::string>
   getFunctionLocation(const std::string &func_name) const;
 
-  void setBreakpointsAll(PDBbr brpoint);
+  /**
+   *  @param brpoint - requested breakpoint location, file may be given by
+   *  its trailing path components
+   *  @return Location the breakpoint is placed at, full path of a source file
+   *  and the first line at or after the requested one that has code
+   *
+   *  Throws std::logic_error if the location does not exist in executable,
+   *  with the reason the index gives
+   */
+  PDBbr resolveBreakpoint(const PDBbr &brpoint) const;
+
+  /**
+   *  @param spec - name of a process set, "all", or a rank list like
+   *  "0-255,512"
+   *  @return Ranks the specification refers to. Throws std::logic_error if
+   *  there is no such set or the rank list is invalid
+   */
+  PDBProcSet getProcSet(const std::string &spec) const;
+
+  /**
+   *  Define or redefine a named process set. Name must start with a letter,
+   *  spec is resolved the same way as in getProcSet
+   */
+  void defineProcSet(const std::string &name, const std::string &spec);
+
+  const std::unordered_map<std::string, PDBProcSet> &getProcSets() const {
+    return proc_sets;
+  }
+
+  /**
+   *  Set, start and end operations are broadcast to all ranks of a set at
+   *  once, to every rank if no set is given. Breakpoint location is resolved
+   *  once before it is sent to any rank, where it is placed is stored in
+   *  resolved, see resolveBreakpoint.
+   *  @return Vector with one entry per rank of the set, in rank order
+   */
+  PDBStatus setBreakpoints(const PDBProcSet &procs, PDBbr brpoint);
+  PDBStatus setBreakpoints(const PDBProcSet &procs, PDBbr brpoint,
+                           PDBbr &resolved);
+  PDBStatus setBreakpointsAll(PDBbr brpoint);
   void setBreakpoint(size_t proc, PDBbr brpoints);
 
-  void startDebug(const std::string &args);
-  void endDebug();
+  PDBStatus startDebug(const PDBProcSet &procs, const std::string &args);
+  PDBStatus startDebug(const std::string &args);
+  PDBStatus endDebug(const PDBProcSet &procs);
+  PDBStatus endDebug();
 
+  /**
+   *  Attach a debugger to every rank of the set that has none yet. Ranks
+   *  launched lazily cannot be used otherwise, nothing happens to the others
+   *  @return Vector with one entry per rank of the set, in rank order
+   */
+  PDBStatus attach(const PDBProcSet &procs);
+
+  bool isAllRunning(const PDBProcSet &procs) const;
   bool isAllRunning() const;
 
+  /**
+   *  Non-blocking versions of the broadcasts. Commands are written to every
+   *  rank of the set right away and the future is ready once the last rank
+   *  has replied, with one entry per rank in rank order. Any number of them
+   *  may be in flight, while they are, the ranks involved must not be used
+   *  through the blocking calls. An invalid breakpoint location still throws
+   *  std::logic_error before anything is sent.
+   */
+  PDBFuture<> setBreakpointsAsync(const PDBProcSet &procs, PDBbr brpoint);
+  PDBFuture<> startDebugAsync(const PDBProcSet &procs, const std::string &args);
+  PDBFuture<> stepAsync(const PDBProcSet &procs);
+
+  /**
+   *  pdb_agent evaluates no expressions, with NativeDebugger every entry
+   *  holds the std::logic_error it replies with
+   */
+  PDBFuture<std::string> evaluateAsync(const PDBProcSet &procs,
+                                       const std::string &expression);
+
+  /**
+   *  Receive events of every rank as their debuggers report them, whichever
+   *  call has caused them. Events of ranks reported close together are
+   *  delivered as one batch, a window holds each batch open for longer.
+   *  Handler runs on a reactor thread and must not call back into blocking
+   *  operations of this instance.
+   *  @param kinds - PDBEventKind values or-ed together
+   *  @return Identifier to unsubscribe with
+   */
+  PDBEventHub::Id subscribe(unsigned kinds, PDBEventHub::Handler handler,
+                            std::chrono::milliseconds window = {}) {
+    return events->subscribe(kinds, std::move(handler), window);
+  }
+  void unsubscribe(PDBEventHub::Id id) { events->unsubscribe(id); }
+
+  /**
+   *  Look a rank up by its MPI rank in the registry published by the PDB
+   *  runtime at MPI_Init. Ranks are indexed everywhere else by their channel,
+   *  which is only the MPI rank if the launcher has assigned it so. O(1), no
+   *  debugger is contacted
+   *  @return Nothing until the rank has passed MPI_Init with the runtime
+   *  preloaded
+   */
+  std::optional<PDBRankInfo> getRankInfo(int mpi_rank) const {
+    return registry->byRank(mpi_rank);
+  }
+  std::optional<PDBRankInfo> getChannelInfo(std::size_t channel) const {
+    return registry->byChannel(channel);
+  }
+
+  /**
+   *  Last MPI calls of a rank as traced by the PDB runtime. The trace is read
+   *  from shared memory while the rank runs, it is not stopped and no
+   *  debugger is contacted
+   *  @param last - number of calls to return at most
+   *  @return Calls oldest first, the last one may still be in progress. Empty
+   *  until the rank has passed MPI_Init with the runtime preloaded
+   */
+  std::vector<PDBTraceRecord> getMPITrace(std::size_t channel,
+                                          std::size_t last) const;
+
+  /**
+   *  Find ranks deadlocked in MPI calls from their traces, without stopping
+   *  them. The traces are scanned twice, settle apart, and only calls that
+   *  have not returned in between count. Scans update a wait-for graph kept
+   *  across calls, ranks whose call has not changed cost one trace read
+   *  @return Cycles of ranks waiting for each other, and a collective some
+   *  rank is never going to enter
+   */
+  std::vector<PDBDeadlock>
+  findDeadlocks(std::chrono::milliseconds settle =
+                    std::chrono::milliseconds(100));
+
   std::pair<std::size_t, std::string>
   getProcCurrentPosition(std::size_t proc_num);
 
   /**
-   * @param usec - miliseconds to wait to terminate all processes
-   *
-   * Must be called to properly terminate calling process. Return pair of
-   * values describing main process exit status. .first - holds 1 if child has
-   * terminated and 0 otherwise .second - holds exit code of a child
+   *  Group ranks of a set by their current position, in a single pass over
+   *  the ranks. No debugger is contacted, positions are the ones recorded at
+   *  the last stop.
+   *  @return Classes ordered by size, largest first, then by lowest rank
+   */
+  std::vector<PDBPositionClass>
+  getPositionClasses(const PDBProcSet &procs) const;
+  std::vector<PDBPositionClass> getPositionClasses() const;
+
+  /**
+   *  Gather call stacks of a set of ranks in parallel and merge them into
+   *  tree, one rank at a time as the replies are collected
+   *  @return Vector with one entry per rank of the set, in rank order
+   */
+  PDBStatus collectStacks(const PDBProcSet &procs, PDBStackTree &tree);
+
+  /**
+   * @param grace - time given to each step of the shutdown
    *
-   * Because this function uses wait() in a non-blocking mode, it can be used
-   * by high-level routines to wait until process termination or just kill it by
-   * calling destructor
+   * Must be called to properly terminate calling process. Every debugger is
+   * told to quit at once, then the launcher is given grace to exit before it
+   * and its process group get SIGTERM, then SIGKILL, grace apart. Returns as
+   * soon as the launcher has exited, whichever step has done it. A rank whose
+   * quit could not be sent has error set
    */
-  std::pair<int, int> join(useconds_t usec = 1000000);
+  PDBJoinStatus join(std::chrono::milliseconds grace = std::chrono::seconds(1));
 
   /**
    * Return number of active processes
@@ -104,7 +354,10 @@ public:
 template <typename DebuggerType>
 PDBDebug<DebuggerType>::PDBDebug(const std::string &start_rountine,
                                  const std::string &debugger,
-                                 const std::string &exec) {
+                                 const std::string &exec,
+                                 std::size_t relay_fanout,
+                                 PDBTransport transport,
+                                 PDBLaunchMode mode) {
   executable = exec;
 
   // Tokenize command-line arguments
@@ -133,37 +386,71 @@ PDBDebug<DebuggerType>::PDBDebug(const std::string &start_rountine,
   if (proc_count <= 0)
     throw std::runtime_error("Invalid number of MPI processes");
 
-  // Create temporal file to pass name of pipe
-  char temp_file[] = "/tmp/pdbpipeXXXXXXX";
-  temporal_file = mkstemp(temp_file);
-  if (temporal_file < 0)
-    throw std::runtime_error(std::string("Error opening temporal file: ") +
-                             temp_file);
-
-  close(temporal_file);
-  unlink(temp_file);
-  temporal_file =
-      open(temp_file, O_RDWR | O_CREAT, S_IRWXU | S_IRWXG | S_IRWXO);
-
-  if (temporal_file < 0)
-    throw std::runtime_error(std::string("Error opening temporal file: ") +
-                             temp_file);
-  temporal_file_name = temp_file;
-
-  // Create specified number of process handlers
-  std::vector<std::string> proc_name_files;
+  if (relay_fanout > 0 && transport != PDBTransport::FIFO)
+    throw std::runtime_error("Relay tree requires the FIFO transport");
+
+  // Private directory for pipes, PDB launch finds its own by rank
+  char temp_dir[] = "/tmp/pdbXXXXXX";
+  if (mkdtemp(temp_dir) == nullptr)
+    throw std::runtime_error(std::string("Error creating directory: ") +
+                             temp_dir);
+  channel_dir = temp_dir;
+
+  if (mode == PDBLaunchMode::Lazy) {
+    int marker = open(rendezvous::lazyMarker(channel_dir).c_str(),
+                      O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (marker < 0)
+      throw std::runtime_error("Error creating lazy launch marker");
+    close(marker);
+  }
+
+  registry = PDBRegistry::create(rendezvous::registryFile(channel_dir),
+                                 proc_count);
+
+  // Create specified number of process handlers, index is the channel
   pdb_proc.reserve(proc_count);
+  traces.resize(proc_count);
+  wait_graph = std::make_unique<PDBWaitGraph>(proc_count);
+  events = std::make_shared<PDBEventHub>();
 
   for (int i = 0; i < proc_count; i++) {
-    pdb_proc.emplace_back(std::make_unique<DebuggerType>());
-    auto proc_filenames = pdb_proc[i]->getPipeNames();
-
-    // Memorize pipe names
-    proc_name_files.push_back(proc_filenames.first);
-    proc_name_files.push_back(proc_filenames.second);
+    if (transport != PDBTransport::FIFO)
+      pdb_proc.emplace_back(std::make_unique<DebuggerType>());
+    else
+      pdb_proc.emplace_back(std::make_unique<DebuggerType>(
+          rendezvous::outputPipe(channel_dir, i),
+          rendezvous::inputPipe(channel_dir, i)));
+    pdb_proc.back()->setEventHub(events, i);
+  }
 
-    write(temporal_file, proc_filenames.first.c_str(), PDB_PIPE_LENGTH);
-    write(temporal_file, proc_filenames.second.c_str(), PDB_PIPE_LENGTH);
+  // Ranks connect in any order, each socket is handed to the handler of its
+  // rank. Process objects are heap allocated and outlive the listener
+  auto procs = std::make_shared<std::vector<PDBProcess *>>();
+  for (auto &proc : pdb_proc)
+    procs->push_back(proc.get());
+
+  auto links = std::make_shared<std::vector<std::shared_ptr<PDBRelayLink>>>();
+  if (transport == PDBTransport::Socket) {
+    listener = std::make_unique<PDBSocketListener>(
+        rendezvous::socketPath(channel_dir), pdb_proc.size(),
+        [procs](std::size_t rank, int fd) { (*procs)[rank]->attachSocket(fd); });
+  } else if (transport == PDBTransport::Mux) {
+    // Ranks behind a node relay become streams of its link as they attach
+    listener = std::make_unique<PDBSocketListener>(
+        rendezvous::muxSocketPath(channel_dir), pdb_proc.size(),
+        [procs](std::size_t rank, int fd) { (*procs)[rank]->attachSocket(fd); },
+        [procs, links](int fd) {
+          links->push_back(PDBRelayLink::adopt(
+              fd, procs->size(),
+              [procs](std::size_t rank, const char *data, std::size_t n) {
+                (*procs)[rank]->deliverInput(data, n);
+              },
+              [procs](std::size_t rank) { (*procs)[rank]->closeInput(); },
+              [procs](std::size_t rank,
+                      const std::shared_ptr<PDBRelayLink> &link) {
+                (*procs)[rank]->attachRelay(link, rank);
+              }));
+        });
   }
 
   /**
@@ -213,10 +500,10 @@ PDBDebug<DebuggerType>::PDBDebug(const std::string &start_rountine,
   new_argv[new_arg_size][exec.length()] = 0;
   new_arg_size++;
 
-  // Step 6: add pipe names
-  new_argv[new_arg_size] = new char[strlen(temp_file) + 1];
-  memcpy(new_argv[new_arg_size], temp_file, strlen(temp_file));
-  new_argv[new_arg_size][strlen(temp_file)] = 0;
+  // Step 6: add pipe directory
+  new_argv[new_arg_size] = new char[strlen(temp_dir) + 1];
+  memcpy(new_argv[new_arg_size], temp_dir, strlen(temp_dir));
+  new_argv[new_arg_size][strlen(temp_dir)] = 0;
   new_arg_size++;
 
   // Step 7: add process count number
@@ -231,8 +518,13 @@ PDBDebug<DebuggerType>::PDBDebug(const std::string &start_rountine,
   new_argv[new_arg_size] = NULL;
 
   // Spawn process
+  // The launcher leads a process group of its own, so the whole job on this
+  // node can be signalled at once on shutdown
   exec_pid = fork();
+  if (exec_pid > 0)
+    setpgid(exec_pid, exec_pid);
   if (exec_pid == 0) {
+    setpgid(0, 0);
     close(STDOUT_FILENO);
     close(STDIN_FILENO);
     close(STDERR_FILENO);
@@ -254,77 +546,135 @@ PDBDebug<DebuggerType>::PDBDebug(const std::string &start_rountine,
    * At this point, child process which is now PDB launch will try to open FIFO
    * and block because FIFO is blocked until it is dual-opened.
    * The following open() calls should be synchronized with the same open() in
-   * a child.
+   * a child. With a relay tree, the relays open them instead.
    */
-  for (auto &proc : pdb_proc)
-    proc->openFIFO();
+  if (relay_fanout > 0) {
+    auto procs = std::make_shared<std::vector<PDBProcess *>>();
+    std::vector<std::pair<std::string, std::string>> pipes;
+    for (auto &proc : pdb_proc) {
+      procs->push_back(proc.get());
+      pipes.push_back(proc->getPipeNames());
+    }
 
-  // Read out initial print from debugger to clear input for subsequent commands
+    // Process objects are heap allocated and outlive the link
+    relay = std::make_shared<PDBRelayLink>(
+        relay_fanout, pipes,
+        [procs](std::size_t rank, const char *data, std::size_t n) {
+          (*procs)[rank]->deliverInput(data, n);
+        },
+        [procs](std::size_t rank) { (*procs)[rank]->closeInput(); });
+
+    for (std::size_t i = 0; i < pdb_proc.size(); i++)
+      pdb_proc[i]->attachRelay(relay, i);
+  } else if (transport == PDBTransport::FIFO) {
+    for (auto &proc : pdb_proc)
+      proc->openFIFO();
+  }
+
+  // Read out initial print from debugger to clear input for subsequent commands.
+  // With sockets, this also waits until every rank has connected
   for (auto &proc : pdb_proc) {
     proc->checkInput(proc->readInput());
   }
+  listener.reset();
+  node_links = std::move(*links);
 }
 
 template <typename DebuggerType> PDBDebug<DebuggerType>::~PDBDebug() {
-  if (temporal_file >= 0)
-    close(temporal_file);
-
-  if (temporal_file_name.length() > 0)
-    unlink(temporal_file_name.c_str());
+  // Shut the relay tree down before the processes it delivers to
+  for (auto &proc : pdb_proc)
+    proc->attachRelay(nullptr, 0);
+  relay.reset();
+  listener.reset();
+  node_links.clear();
 
+  // Second chance to terminate process, if join has not reaped it
   if (exec_pid > 0) {
-    // Second chance to terminate process
-    int statlock;
-    pid_t pid = waitpid(exec_pid, &statlock, WNOHANG);
-    if (pid == 0) {
-      kill(exec_pid, SIGKILL);
+    PDBChildWatch watch(exec_pid);
+    if (!watch.waitUntil(std::chrono::steady_clock::now()))
+      terminateLauncher(watch, std::chrono::milliseconds(100));
+  }
+
+  // Process handlers unlink their pipes, slots and node relay sockets made by
+  // PDB launch are left over
+  pdb_proc.clear();
+  if (!channel_dir.empty()) {
+    if (DIR *dir = opendir(channel_dir.c_str())) {
+      while (dirent *entry = readdir(dir)) {
+        if (std::strcmp(entry->d_name, ".") != 0 &&
+            std::strcmp(entry->d_name, "..") != 0)
+          unlink((channel_dir + "/" + entry->d_name).c_str());
+      }
+      closedir(dir);
     }
+    rmdir(channel_dir.c_str());
   }
 }
 
 template <typename DebuggerType>
-std::pair<int, int> PDBDebug<DebuggerType>::join(useconds_t usec) {
-  for (auto &iter : pdb_proc)
-    iter->endDebug();
+PDBJoinStatus PDBDebug<DebuggerType>::join(std::chrono::milliseconds grace) {
+  PDBJoinStatus status;
+
+  // Quit is only sent, a debugger that exits has nothing more to reply
+  for (std::size_t i = 0; i < pdb_proc.size(); i++) {
+    status.ranks.emplace_back();
+    status.ranks.back().rank = i;
+    try {
+      pdb_proc[i]->submitEnd();
+    } catch (...) {
+      status.ranks.back().error = std::current_exception();
+    }
+  }
+
+  if (exec_pid > 0) {
+    PDBChildWatch watch(exec_pid);
+    if (watch.waitUntil(std::chrono::steady_clock::now() + grace) ||
+        terminateLauncher(watch, grace)) {
+      exec_pid = 0;
+      status.terminated = true;
+
+      int statlock = watch.status();
+      if (WIFEXITED(statlock))
+        status.exit_code = WEXITSTATUS(statlock);
+      else if (WIFSIGNALED(statlock))
+        status.signal = WTERMSIG(statlock);
+    }
+  }
 
-  // Try to wait a while to let the processes terminate
-  usleep(usec);
+  // Channels of ranks gone with the launcher close shortly after it
+  auto deadline = std::chrono::steady_clock::now() + grace;
+  for (auto &result : status.ranks) {
+    auto &proc = pdb_proc[result.rank];
+    result.value.closed =
+        status.terminated ? proc->waitClosed(deadline)
+                          : proc->waitClosed(std::chrono::steady_clock::now());
+    result.value.exit_code = proc->getExitCode();
+  }
 
-  int statlock;
-  pid_t pid = waitpid(exec_pid, &statlock, WNOHANG);
-  if (pid < 0) {
-    throw std::runtime_error("Error waiting for main process");
-  } else if (pid == 0)
-    return std::make_pair(0, 0); // If process has not terminated yet, do
-                                 // nothing, destructor will kill it
-  else {
-    exec_pid = 0;
+  return status;
+}
 
-    if (WIFEXITED(statlock))
-      return std::make_pair(1, WEXITSTATUS(statlock));
-    else if (WIFSIGNALED(statlock))
-      return std::make_pair(1, WTERMSIG(statlock));
-    else if (WIFSTOPPED(statlock))
-      return std::make_pair(1, WSTOPSIG(statlock));
-    else {
-      exec_pid = pid;
-      return std::make_pair(0, 0);
-    }
+template <typename DebuggerType>
+bool PDBDebug<DebuggerType>::terminateLauncher(
+    PDBChildWatch &watch, std::chrono::milliseconds grace) {
+  for (int sig : {SIGTERM, SIGKILL}) {
+    kill(-exec_pid, sig);
+    if (watch.waitUntil(std::chrono::steady_clock::now() + grace))
+      return true;
   }
 
-  return std::make_pair(0, 0);
+  return false;
 }
 
 template <typename DebuggerType>
 std::vector<std::string>
 PDBDebug<DebuggerType>::parseArgs(const std::string &pdb_args,
                                   const std::string &delim) {
-  char *args = new char[pdb_args.length()];
-  memcpy(args, pdb_args.c_str(), pdb_args.length());
-  args[pdb_args.length()] = 0;
+  std::vector<char> args(pdb_args.begin(), pdb_args.end());
+  args.push_back(0);
   std::vector<std::string> pdb_args_parsed;
 
-  char *token = strtok(args, delim.c_str());
+  char *token = strtok(args.data(), delim.c_str());
   if (token == NULL)
     return pdb_args_parsed;
 
@@ -336,12 +686,163 @@ PDBDebug<DebuggerType>::parseArgs(const std::string &pdb_args,
 }
 
 template <typename DebuggerType>
-void PDBDebug<DebuggerType>::setBreakpointsAll(PDBbr brpoint) {
+template <typename Submit, typename Collect>
+auto PDBDebug<DebuggerType>::broadcast(const PDBProcSet &procs, Submit submit,
+                                       Collect collect, bool any) {
+  using Value = std::invoke_result_t<Collect, PDBDebugger &>;
+  using Result = std::conditional_t<std::is_void_v<Value>, std::monostate,
+                                    Value>;
+
+  std::vector<PDBRankResult<Result>> results;
+  results.reserve(procs.count());
+
+  // Scatter: every debugger gets the command before anyone is waited on
+  for (auto rank : procs) {
+    if (rank >= pdb_proc.size())
+      break;
+
+    results.emplace_back();
+    results.back().rank = rank;
+    try {
+      if (!any)
+        requireAttached(*pdb_proc[rank]);
+      submit(*pdb_proc[rank]);
+    } catch (...) {
+      results.back().error = std::current_exception();
+    }
+  }
+
+  // Gather: replies are buffered by the readers as they arrive, so waiting on
+  // them in rank order costs as much as the slowest one
+  for (auto &result : results) {
+    if (result.error)
+      continue;
+
+    try {
+      if constexpr (std::is_void_v<Value>)
+        collect(*pdb_proc[result.rank]);
+      else
+        result.value = collect(*pdb_proc[result.rank]);
+    } catch (...) {
+      result.error = std::current_exception();
+    }
+  }
+
+  return results;
+}
+
+template <typename DebuggerType>
+template <typename Issue>
+auto PDBDebug<DebuggerType>::gather(const PDBProcSet &procs, Issue issue) {
+  using Value = decltype(issue(std::declval<PDBDebugger &>()).get());
+  using Result = std::conditional_t<std::is_void_v<Value>, std::monostate,
+                                    Value>;
+
+  struct State {
+    std::vector<PDBRankResult<Result>> results;
+    std::atomic<std::size_t> remaining{0};
+    boost::promise<std::vector<PDBRankResult<Result>>> promise;
+
+    void finish() {
+      if (--remaining == 0)
+        promise.set_value(std::move(results));
+    }
+  };
+
+  auto state = std::make_shared<State>();
+  for (auto rank : procs) {
+    if (rank >= pdb_proc.size())
+      break;
+    state->results.emplace_back();
+    state->results.back().rank = rank;
+  }
+
+  // One extra count keeps the promise open until every rank is issued
+  auto future = state->promise.get_future();
+  state->remaining = state->results.size() + 1;
+
+  for (std::size_t i = 0; i < state->results.size(); i++) {
+    auto &result = state->results[i];
+    try {
+      // A continuation only touches its own slot
+      requireAttached(*pdb_proc[result.rank]);
+      issue(*pdb_proc[result.rank])
+          .then(boost::launch::sync, [state, i](auto reply) {
+            try {
+              if constexpr (std::is_void_v<Value>)
+                reply.get();
+              else
+                state->results[i].value = reply.get();
+            } catch (...) {
+              state->results[i].error = std::current_exception();
+            }
+            state->finish();
+          });
+    } catch (...) {
+      result.error = std::current_exception();
+      state->finish();
+    }
+  }
+
+  state->finish();
+  return future;
+}
+
+template <typename DebuggerType>
+PDBProcSet PDBDebug<DebuggerType>::getProcSet(const std::string &spec) const {
+  if (spec == "all")
+    return PDBProcSet::all(pdb_proc.size());
+
+  if (!spec.empty() && spec[0] >= '0' && spec[0] <= '9')
+    return PDBProcSet::parse(spec, pdb_proc.size());
+
+  auto iter = proc_sets.find(spec);
+  if (iter == proc_sets.end())
+    throw std::logic_error("Unknown process set: " + spec);
+  return iter->second;
+}
+
+template <typename DebuggerType>
+void PDBDebug<DebuggerType>::defineProcSet(const std::string &name,
+                                           const std::string &spec) {
+  bool valid = !name.empty() && std::isalpha(name[0]) && name != "all" &&
+               std::all_of(name.begin(), name.end(), [](char c) {
+                 return std::isalnum(c) || c == '_';
+               });
+  if (!valid)
+    throw std::logic_error("Invalid process set name: " + name);
+
+  proc_sets[name] = getProcSet(spec);
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::PDBStatus
+PDBDebug<DebuggerType>::setBreakpoints(const PDBProcSet &procs,
+                                       PDBbr brpoint) {
+  PDBbr resolved;
+  return setBreakpoints(procs, std::move(brpoint), resolved);
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::PDBStatus
+PDBDebug<DebuggerType>::setBreakpoints(const PDBProcSet &procs,
+                                       PDBbr brpoint, PDBbr &resolved) {
   if (pdb_proc.size() == 0)
     throw std::runtime_error("Invalid process identifier: 0");
 
-  for (auto &iter : pdb_proc)
-    iter->setBreakpoint(brpoint);
+  // An invalid location fails here once instead of in every debugger
+  resolved = resolveBreakpoint(brpoint);
+
+  return broadcast(
+      procs,
+      [&](PDBDebugger &proc) { proc.submitBreakpoint(resolved); },
+      [&](PDBDebugger &proc) { proc.collectBreakpoint(resolved); });
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::PDBStatus
+PDBDebug<DebuggerType>::setBreakpointsAll(PDBbr brpoint) {
+  return setBreakpoints(PDBProcSet::all(pdb_proc.size()), brpoint);
 }
 
 template <typename DebuggerType>
@@ -352,44 +853,208 @@ void PDBDebug<DebuggerType>::setBreakpoint(size_t proc, PDBbr brpoints) {
   }
 
   auto &ptr = pdb_proc[proc];
-  ptr->setBreakpoint(brpoints);
+  ptr->setBreakpoint(resolveBreakpoint(brpoints));
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::PDBbr
+PDBDebug<DebuggerType>::resolveBreakpoint(const PDBbr &brpoint) const {
+  if (brpoint.second.length() == 0)
+    throw std::logic_error("Error setting breakpoint in unknown file");
+  if (brpoint.first <= 0)
+    throw std::logic_error("Invalid line number: " +
+                           std::to_string(brpoint.first));
+
+  const DwarfIndex &index = getDwarfIndex();
+  std::string location = brpoint.second + ":" + std::to_string(brpoint.first);
+
+  // The index tells why, no such file, an ambiguous one or no code
+  return boost::leaf::try_handle_all(
+      [&]() -> boost::leaf::result<PDBbr> {
+        auto result = index.getBreakpointLocation(
+            brpoint.second, static_cast<std::size_t>(brpoint.first));
+        if (!result)
+          return result.error();
+        return PDBbr(static_cast<int>(result->first), result->second);
+      },
+      [&](const std::string &reason) -> PDBbr {
+        throw std::logic_error(
+            "Cannot set breakpoint at specified location: " + location +
+            " (" + reason + ")");
+      },
+      [&]() -> PDBbr {
+        throw std::logic_error(
+            "Cannot set breakpoint at specified location: " + location);
+      });
+}
+
+template <typename DebuggerType>
+const DwarfIndex &PDBDebug<DebuggerType>::getDwarfIndex() const {
+  if (!dwarf_index) {
+    auto result = DwarfIndex::create(executable);
+    if (!result)
+      throw std::runtime_error("Error reading debug information: " +
+                               executable);
+    dwarf_index = std::move(*result);
+  }
+
+  return *dwarf_index;
+}
+
+template <typename DebuggerType>
+std::vector<PDBTraceRecord>
+PDBDebug<DebuggerType>::getMPITrace(std::size_t channel,
+                                    std::size_t last) const {
+  if (channel >= traces.size())
+    throw std::logic_error("Invalid process identifier: " +
+                           std::to_string(channel));
+
+  // A rank creates its trace in MPI_Init, until then there is nothing to map
+  auto &trace = traces[channel];
+  if (!trace) {
+    try {
+      trace = PDBTraceRing::open(rendezvous::traceFile(channel_dir, channel));
+    } catch (std::runtime_error &) {
+      return {};
+    }
+  }
+
+  return trace->read(last);
+}
+
+template <typename DebuggerType>
+void PDBDebug<DebuggerType>::scanBlockedCalls() {
+  for (std::size_t channel = 0; channel < pdb_proc.size(); channel++) {
+    auto info = registry->byChannel(channel);
+    if (!info)
+      continue;
+
+    auto records = getMPITrace(channel, 1);
+    std::optional<PDBBlockedCall> call;
+    if (!records.empty())
+      call = blockedCall(records.back());
+    wait_graph->update(info->mpi_rank, call);
+  }
+}
+
+template <typename DebuggerType>
+std::vector<PDBDeadlock>
+PDBDebug<DebuggerType>::findDeadlocks(std::chrono::milliseconds settle) {
+  scanBlockedCalls();
+  wait_graph->settle();
+  std::this_thread::sleep_for(settle);
+  scanBlockedCalls();
+
+  auto deadlocks = wait_graph->deadlocks();
+  wait_graph->settle();
+  return deadlocks;
 }
 
 template <typename DebuggerType>
 std::vector<std::string> PDBDebug<DebuggerType>::getSourceFiles() const {
-  auto result = dwarfGetSourceFiles(executable);
-  return *result;
+  return getDwarfIndex().getSourceFiles();
 }
 
 template <typename DebuggerType>
 std::pair<uint64_t, std::string> PDBDebug<DebuggerType>::getFunctionLocation(
     const std::string &func_name) const {
-  auto result = dwarfGetFunctionLocation(executable, func_name);
+  auto result = getDwarfIndex().getFunctionLocation(func_name);
+  if (!result)
+    throw std::logic_error("Unknown function: " + func_name);
   return *result;
 }
 
 template <typename DebuggerType>
-void PDBDebug<DebuggerType>::startDebug(const std::string &args) {
-  for (auto &iter : pdb_proc) {
-    iter->startDebug(args);
-  }
+typename PDBDebug<DebuggerType>::PDBStatus
+PDBDebug<DebuggerType>::startDebug(const PDBProcSet &procs,
+                                   const std::string &args) {
+  return broadcast(
+      procs, [&](PDBDebugger &proc) { proc.submitStart(args); },
+      [](PDBDebugger &proc) { proc.collectStart(); });
 }
 
-template <typename DebuggerType> void PDBDebug<DebuggerType>::endDebug() {
-  for (auto &iter : pdb_proc) {
-    iter->endDebug();
-  }
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::PDBStatus
+PDBDebug<DebuggerType>::startDebug(const std::string &args) {
+  return startDebug(PDBProcSet::all(pdb_proc.size()), args);
 }
 
 template <typename DebuggerType>
-bool PDBDebug<DebuggerType>::isAllRunning() const {
-  for (auto &i : pdb_proc) {
-    if (!i->getCurrentStatus())
+typename PDBDebug<DebuggerType>::PDBStatus
+PDBDebug<DebuggerType>::endDebug(const PDBProcSet &procs) {
+  // A stub quits as well, taking the application with it
+  return broadcast(
+      procs, [](PDBDebugger &proc) { proc.submitEnd(); },
+      [](PDBDebugger &proc) { proc.collectEnd(); }, true);
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::PDBStatus PDBDebug<DebuggerType>::endDebug() {
+  return endDebug(PDBProcSet::all(pdb_proc.size()));
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::PDBStatus
+PDBDebug<DebuggerType>::attach(const PDBProcSet &procs) {
+  return broadcast(
+      procs, [](PDBDebugger &proc) { proc.submitAttach(); },
+      [](PDBDebugger &proc) { proc.collectAttach(); }, true);
+}
+
+template <typename DebuggerType>
+void PDBDebug<DebuggerType>::requireAttached(PDBDebugger &proc) {
+  if (!proc.isAttached())
+    throw std::logic_error("No debugger attached, see attach");
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::template PDBFuture<>
+PDBDebug<DebuggerType>::setBreakpointsAsync(const PDBProcSet &procs,
+                                            PDBbr brpoint) {
+  brpoint = resolveBreakpoint(brpoint);
+
+  return gather(procs, [&](PDBDebugger &proc) {
+    return proc.setBreakpointAsync(brpoint);
+  });
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::template PDBFuture<>
+PDBDebug<DebuggerType>::startDebugAsync(const PDBProcSet &procs,
+                                        const std::string &args) {
+  return gather(procs,
+                [&](PDBDebugger &proc) { return proc.startAsync(args); });
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::template PDBFuture<>
+PDBDebug<DebuggerType>::stepAsync(const PDBProcSet &procs) {
+  return gather(procs, [](PDBDebugger &proc) { return proc.stepAsync(); });
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::template PDBFuture<std::string>
+PDBDebug<DebuggerType>::evaluateAsync(const PDBProcSet &procs,
+                                      const std::string &expression) {
+  return gather(procs, [&](PDBDebugger &proc) {
+    return proc.evaluateAsync(expression);
+  });
+}
+
+template <typename DebuggerType>
+bool PDBDebug<DebuggerType>::isAllRunning(const PDBProcSet &procs) const {
+  for (auto rank : procs) {
+    if (rank >= pdb_proc.size() || !pdb_proc[rank]->getCurrentStatus())
       return false;
   }
   return true;
 }
 
+template <typename DebuggerType>
+bool PDBDebug<DebuggerType>::isAllRunning() const {
+  return isAllRunning(PDBProcSet::all(pdb_proc.size()));
+}
+
 template <typename DebuggerType>
 std::pair<std::size_t, std::string>
 PDBDebug<DebuggerType>::getProcCurrentPosition(std::size_t proc_num) {
@@ -399,4 +1064,78 @@ PDBDebug<DebuggerType>::getProcCurrentPosition(std::size_t proc_num) {
   auto &proc = pdb_proc[proc_num];
   return proc->getCurrentPosition();
 }
+
+template <typename DebuggerType>
+std::vector<PDBPositionClass>
+PDBDebug<DebuggerType>::getPositionClasses(const PDBProcSet &procs) const {
+  PDBPositionClasses classes(pdb_proc.size());
+
+  // Every relay reduces the positions of its subtree
+  if (relay) {
+    classes.merge(relay->request(relay::Kind::PositionsRequest, procs));
+    return classes.take();
+  }
+
+  for (auto rank : procs) {
+    if (rank >= pdb_proc.size())
+      break;
+
+    auto &proc = pdb_proc[rank];
+    if (proc->getCurrentStatus())
+      classes.insert(rank, proc->getCurrentPosition());
+    else
+      classes.insert(rank, std::make_pair(std::size_t(0), std::string()));
+  }
+
+  return classes.take();
+}
+
+template <typename DebuggerType>
+std::vector<PDBPositionClass>
+PDBDebug<DebuggerType>::getPositionClasses() const {
+  return getPositionClasses(PDBProcSet::all(pdb_proc.size()));
+}
+
+template <typename DebuggerType>
+typename PDBDebug<DebuggerType>::PDBStatus
+PDBDebug<DebuggerType>::collectStacks(const PDBProcSet &procs,
+                                      PDBStackTree &tree) {
+  /**
+   * Stacks are merged on the way up the relay tree. Ranks that are missing
+   * from the merged tree either have not started or failed to list frames
+   */
+  if (relay) {
+    tree.merge(relay->request(relay::Kind::StacksRequest, procs));
+
+    PDBStatus status;
+    for (auto rank : procs) {
+      if (rank >= pdb_proc.size())
+        break;
+
+      status.emplace_back();
+      status.back().rank = rank;
+      if (!tree.getNodes()[0].procs.contains(rank))
+        status.back().error = std::make_exception_ptr(
+            std::logic_error("Cannot list stack frames"));
+    }
+    return status;
+  }
+
+  auto stacks = broadcast(
+      procs, [](PDBDebugger &proc) { proc.submitStack(); },
+      [](PDBDebugger &proc) { return proc.collectStack(); });
+
+  PDBStatus status(stacks.size());
+  for (std::size_t i = 0; i < stacks.size(); i++) {
+    status[i].rank = stacks[i].rank;
+    status[i].error = stacks[i].error;
+    if (stacks[i].ok())
+      tree.insert(stacks[i].rank, stacks[i].value);
+
+    // Frames are not needed once merged
+    stacks[i].value = std::vector<PDBFrame>();
+  }
+
+  return status;
+}
 } // namespace pdb
@@ -0,0 +1,39 @@
+/**
+ *  Native debugger of one rank, see PDBNativeAgent
+ *
+ *  Started by pdb_launch in place of gdb as "pdb_agent <exec>", or by the
+ *  lazy stub as "pdb_agent <exec> -p <pid>" to attach. Options meant for gdb
+ *  are ignored, so the agent can stand in for it anywhere
+ */
+#include <PDBNativeAgent.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+
+int main(int argc, char **argv) {
+  std::string exec;
+  pid_t attach_pid = -1;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-p" && i + 1 < argc)
+      attach_pid = static_cast<pid_t>(std::atol(argv[++i]));
+    else if (arg[0] != '-' && exec.empty())
+      exec = arg;
+  }
+
+  if (exec.empty() && attach_pid <= 0) {
+    std::fprintf(stderr, "Usage: %s <exec> [-p <pid>]\n", argv[0]);
+    return 2;
+  }
+
+  try {
+    pdb::PDBNativeAgent agent(exec, attach_pid);
+    agent.run();
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "pdb_agent: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ *  Times setBreakpoints as the number of ranks grows
+ *
+ *  pdb_bench <launcher> <debugger> <exec> <max ranks> <file:line>...
+ *  starts exec on 1, 2, 4, ... up to max ranks through "<launcher> -np N",
+ *  sets each breakpoint on every rank and prints the mean wall time of one
+ *  setBreakpointsAll. Commands are broadcast, so the time should stay close
+ *  to one debugger round trip whatever the number of ranks. Locations must
+ *  resolve to distinct lines, a breakpoint already set is refused locally.
+ *
+ *  With fewer cores than ranks, the debuggers queue for the CPU and the time
+ *  grows with the ranks even though the commands overlap. The broadcast
+ *  alone shows with a debugger that answers after a fixed delay
+ */
+#include <PDB.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <vector>
+
+using Debugger = pdb::PDBDebug<pdb::GDBDebugger>;
+
+int main(int argc, char **argv) {
+  if (argc < 6) {
+    std::fprintf(stderr,
+                 "Usage: %s <launcher> <debugger> <exec> <max ranks> "
+                 "<file:line>...\n",
+                 argv[0]);
+    return 2;
+  }
+
+  std::string launcher = argv[1];
+  std::string debugger = argv[2];
+  std::string exec = argv[3];
+  std::size_t max_ranks = std::strtoul(argv[4], nullptr, 10);
+
+  std::vector<Debugger::PDBbr> brpoints;
+  for (int i = 5; i < argc; i++) {
+    std::string location = argv[i];
+    auto colon = location.rfind(':');
+    if (colon == std::string::npos) {
+      std::fprintf(stderr, "Invalid location: %s\n", argv[i]);
+      return 2;
+    }
+    brpoints.emplace_back(std::atoi(location.c_str() + colon + 1),
+                          location.substr(0, colon));
+  }
+
+  std::printf("%8s %12s %10s\n", "ranks", "ms per call", "failures");
+  try {
+    for (std::size_t ranks = 1; ranks <= max_ranks; ranks *= 2) {
+      Debugger pdb_instance(launcher + " -np " + std::to_string(ranks),
+                            debugger, exec);
+
+      std::size_t failures = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (auto &brpoint : brpoints)
+        for (auto &result : pdb_instance.setBreakpointsAll(brpoint))
+          failures += !result.ok();
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+      std::printf("%8zu %12.2f %10zu\n", ranks,
+                  elapsed.count() / brpoints.size(), failures);
+      std::fflush(stdout);
+      pdb_instance.join(std::chrono::milliseconds(1000));
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "pdb_bench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <PDBChildWatch.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace pdb {
+PDBChildWatch::PDBChildWatch(pid_t pid)
+    : state(std::make_shared<State>(PDBReactor::instance().makeStrand())) {
+  state->pid = pid;
+
+  int fd = static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+  if (fd < 0) {
+    polling = true;
+    return;
+  }
+
+  state->pidfd.assign(fd);
+  awaitExit(state);
+}
+
+PDBChildWatch::~PDBChildWatch() {
+  boost::asio::post(state->pidfd.get_executor(), [st = state]() {
+    boost::system::error_code ec;
+    st->pidfd.close(ec);
+  });
+}
+
+bool PDBChildWatch::waitUntil(std::chrono::steady_clock::time_point deadline) {
+  if (polling) {
+    while (!reap(*state)) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= deadline)
+        return false;
+      std::this_thread::sleep_for(
+          std::min<std::chrono::steady_clock::duration>(
+              deadline - now, std::chrono::milliseconds(10)));
+    }
+    return true;
+  }
+
+  // The reactor may not have seen the pidfd yet, a child that has already
+  // exited is reaped here instead of waiting for it
+  reap(*state);
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  return state->done.wait_until(lock, deadline,
+                                [this]() { return state->exited; });
+}
+
+// A pidfd becomes readable once the process has exited
+void PDBChildWatch::awaitExit(std::shared_ptr<State> state) {
+  auto &pidfd = state->pidfd;
+
+  pidfd.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+                   [state = std::move(state)](boost::system::error_code ec) {
+                     if (ec)
+                       return;
+
+                     if (!reap(*state))
+                       awaitExit(std::move(state));
+                   });
+}
+
+bool PDBChildWatch::reap(State &state) {
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.exited)
+      return true;
+  }
+
+  int status = 0;
+  pid_t pid;
+  do {
+    pid = ::waitpid(state.pid, &status, WNOHANG);
+  } while (pid < 0 && errno == EINTR);
+
+  if (pid == 0)
+    return false;
+
+  // Reaped by someone else if waitpid failed, the status is lost then. The
+  // waiter and the reactor may both try, only the one that reaped sets it
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (pid > 0 || !state.exited)
+      state.status = pid > 0 ? status : 0;
+    state.exited = true;
+  }
+  state.done.notify_all();
+  return true;
+}
+} // namespace pdb
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <PDBReactor.hpp>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+
+namespace pdb {
+/**
+ * Exit of a child process observed on the reactor through its pidfd. The
+ * child is reaped there as soon as it exits, a waiter is woken right away
+ * instead of polling. Kernels without pidfd_open fall back to polling waitpid.
+ */
+class PDBChildWatch {
+public:
+  explicit PDBChildWatch(pid_t pid);
+  PDBChildWatch(const PDBChildWatch &) = delete;
+  PDBChildWatch &operator=(const PDBChildWatch &) = delete;
+  ~PDBChildWatch();
+
+  /**
+   * Block until the child has exited or deadline has passed
+   * @return true once the child is reaped, its wait status is in status()
+   */
+  bool waitUntil(std::chrono::steady_clock::time_point deadline);
+
+  int status() const { return state->status; }
+
+private:
+  // State shared with the pending wait, see PDBProcess::Channel
+  struct State {
+    explicit State(const PDBReactor::strand_type &strand) : pidfd(strand) {}
+
+    boost::asio::posix::stream_descriptor pidfd;
+    pid_t pid = 0;
+
+    std::mutex mutex;
+    std::condition_variable done;
+    bool exited = false;
+    int status = 0;
+  };
+
+  static void awaitExit(std::shared_ptr<State> state);
+
+  // Reap the child if it has exited, mutex must not be held
+  static bool reap(State &state);
+
+  std::shared_ptr<State> state;
+  bool polling = false;
+};
+} // namespace pdb
@@ -0,0 +1,270 @@
+#include <PDBDeadlock.hpp>
+#include <PDBProcSet.hpp>
+#include <algorithm>
+
+namespace pdb {
+std::optional<PDBBlockedCall> blockedCall(const PDBTraceRecord &record) {
+  if (record.end != 0)
+    return std::nullopt;
+
+  PDBBlockedCall blocked{record.call, record.peer, record.tag, -1,
+                         -1, record.comm, false, record.begin};
+  switch (record.call) {
+  case PDBMPICall::Isend:
+  case PDBMPICall::Irecv:
+    return std::nullopt;
+  case PDBMPICall::Sendrecv:
+    blocked.source = record.source;
+    blocked.source_tag = record.source_tag;
+    break;
+  case PDBMPICall::Send:
+  case PDBMPICall::Ssend:
+  case PDBMPICall::Recv:
+  case PDBMPICall::Wait:
+  case PDBMPICall::Waitall:
+    break;
+  default:
+    blocked.collective = record.comm == 0;
+    break;
+  }
+  return blocked;
+}
+
+std::string PDBDeadlock::toString() const {
+  std::string text;
+
+  if (cycle) {
+    text = "ranks ";
+    for (auto rank : ranks)
+      text += std::to_string(rank) + "→";
+    text += std::to_string(ranks.front()) + " deadlocked in ";
+
+    std::vector<PDBMPICall> distinct;
+    for (auto call : calls) {
+      if (std::find(distinct.begin(), distinct.end(), call) == distinct.end())
+        distinct.push_back(call);
+    }
+    for (std::size_t i = 0; i < distinct.size(); i++)
+      text += std::string(i > 0 ? ", " : "") + callName(distinct[i]);
+    return text;
+  }
+
+  // One group per call, in order of their lowest rank
+  std::vector<std::pair<PDBMPICall, PDBProcSet>> groups;
+  std::size_t size = ranks.empty() ? 0 : ranks.back() + 1;
+  for (std::size_t i = 0; i < ranks.size(); i++) {
+    auto group = std::find_if(groups.begin(), groups.end(),
+                              [&](auto &g) { return g.first == calls[i]; });
+    if (group == groups.end())
+      group = groups.insert(groups.end(), {calls[i], PDBProcSet(size)});
+    group->second.insert(ranks[i]);
+  }
+
+  for (std::size_t i = 0; i < groups.size(); i++) {
+    auto &[call, procs] = groups[i];
+    if (i > 0)
+      text += ", ";
+    text += procs.count() > 1 ? "ranks " : "rank ";
+    text += procs.toString();
+    text += i == 0 ? " deadlocked in " : " in ";
+    text += callName(call);
+  }
+  return text;
+}
+
+PDBWaitGraph::PDBWaitGraph(std::size_t size)
+    : size(size), nodes(size), next(size, -1) {}
+
+void PDBWaitGraph::update(std::size_t rank,
+                          const std::optional<PDBBlockedCall> &call) {
+  if (rank >= size)
+    return;
+
+  auto &node = nodes[rank];
+  if (node.call && call && node.call->id == call->id)
+    return;
+
+  if (node.call)
+    blocked--;
+  if (call)
+    blocked++;
+
+  // Peers of the old and the new call may be matched by it no longer or now
+  int peers[] = {-1, -1, -1, -1};
+  if (node.call) {
+    peers[0] = node.call->peer;
+    peers[1] = node.call->source;
+  }
+  if (call) {
+    peers[2] = call->peer;
+    peers[3] = call->source;
+  }
+
+  node.call = call;
+  node.since = generation;
+
+  auto suspect = std::find(suspects.begin(), suspects.end(), rank);
+  if (suspect != suspects.end()) {
+    *suspect = suspects.back();
+    suspects.pop_back();
+  }
+
+  relink(rank);
+  for (auto peer : peers) {
+    if (peer >= 0 && static_cast<std::size_t>(peer) < size &&
+        static_cast<std::size_t>(peer) != rank)
+      relink(peer);
+  }
+}
+
+// Send side of a point-to-point call of rank, received with the given tag
+bool PDBWaitGraph::sendsTo(std::size_t rank, std::size_t receiver,
+                           int tag) const {
+  const auto &call = nodes[rank].call;
+  if (!call || call->comm != 0 || call->peer != static_cast<int>(receiver))
+    return false;
+
+  return (call->call == PDBMPICall::Send || call->call == PDBMPICall::Ssend ||
+          call->call == PDBMPICall::Sendrecv) &&
+         (tag < 0 || call->tag == tag);
+}
+
+// Receive side of a point-to-point call of rank, sent with the given tag
+bool PDBWaitGraph::receivesFrom(std::size_t rank, std::size_t sender,
+                                int tag) const {
+  const auto &call = nodes[rank].call;
+  if (!call || call->comm != 0)
+    return false;
+
+  auto accepts = [&](int source, int source_tag) {
+    return (source < 0 || source == static_cast<int>(sender)) &&
+           (source_tag < 0 || source_tag == tag);
+  };
+  if (call->call == PDBMPICall::Recv)
+    return accepts(call->peer, call->tag);
+  if (call->call == PDBMPICall::Sendrecv)
+    return accepts(call->source, call->source_tag);
+  return false;
+}
+
+long PDBWaitGraph::waitsFor(std::size_t rank) const {
+  const auto &call = nodes[rank].call;
+  if (!call || call->collective || call->comm != 0)
+    return -1;
+
+  auto known = [&](int peer) {
+    return peer >= 0 && static_cast<std::size_t>(peer) < size;
+  };
+
+  switch (call->call) {
+  case PDBMPICall::Send:
+  case PDBMPICall::Ssend:
+    if (!known(call->peer) || receivesFrom(call->peer, rank, call->tag))
+      return -1;
+    return call->peer;
+  case PDBMPICall::Recv:
+    if (!known(call->peer) || sendsTo(call->peer, rank, call->tag))
+      return -1;
+    return call->peer;
+  case PDBMPICall::Sendrecv:
+    if (!known(call->peer) || !known(call->source) ||
+        receivesFrom(call->peer, rank, call->tag) ||
+        sendsTo(call->source, rank, call->source_tag))
+      return -1;
+    return call->source;
+  default:
+    return -1;
+  }
+}
+
+void PDBWaitGraph::relink(std::size_t rank) {
+  long target = waitsFor(rank);
+  if (next[rank] == target)
+    return;
+  next[rank] = target;
+  if (target < 0)
+    return;
+
+  // Only the new edge can have closed a cycle, it goes through this rank
+  long current = target;
+  for (std::size_t steps = 0; current >= 0 && steps < size; steps++) {
+    if (static_cast<std::size_t>(current) == rank) {
+      if (std::find(suspects.begin(), suspects.end(), rank) == suspects.end())
+        suspects.push_back(rank);
+      return;
+    }
+    current = next[current];
+  }
+}
+
+std::optional<PDBDeadlock> PDBWaitGraph::findCycle(std::size_t rank) const {
+  PDBDeadlock deadlock;
+  deadlock.cycle = true;
+
+  std::size_t current = rank;
+  do {
+    if (!settled(current) || deadlock.ranks.size() == size)
+      return std::nullopt;
+
+    deadlock.ranks.push_back(current);
+    deadlock.calls.push_back(nodes[current].call->call);
+    if (next[current] < 0)
+      return std::nullopt;
+    current = static_cast<std::size_t>(next[current]);
+  } while (current != rank);
+
+  // The same cycle is reported once, starting from its lowest rank
+  auto lowest = std::min_element(deadlock.ranks.begin(), deadlock.ranks.end());
+  auto shift = lowest - deadlock.ranks.begin();
+  std::rotate(deadlock.ranks.begin(), lowest, deadlock.ranks.end());
+  std::rotate(deadlock.calls.begin(), deadlock.calls.begin() + shift,
+              deadlock.calls.end());
+  return deadlock;
+}
+
+std::optional<PDBDeadlock> PDBWaitGraph::findCollective() const {
+  // A collective is stuck for good only if no rank is left to enter it
+  if (blocked < size || size == 0)
+    return std::nullopt;
+
+  bool any_collective = false;
+  bool all_same = true;
+  for (std::size_t rank = 0; rank < size; rank++) {
+    if (!settled(rank))
+      return std::nullopt;
+
+    auto &call = *nodes[rank].call;
+    any_collective |= call.collective;
+    all_same &= call.collective && call.call == nodes[0].call->call;
+  }
+  if (!any_collective || all_same)
+    return std::nullopt;
+
+  PDBDeadlock deadlock;
+  for (std::size_t rank = 0; rank < size; rank++) {
+    deadlock.ranks.push_back(rank);
+    deadlock.calls.push_back(nodes[rank].call->call);
+  }
+  return deadlock;
+}
+
+std::vector<PDBDeadlock> PDBWaitGraph::deadlocks() const {
+  std::vector<PDBDeadlock> found;
+
+  for (auto rank : suspects) {
+    auto deadlock = findCycle(rank);
+    if (!deadlock)
+      continue;
+
+    bool known = std::any_of(found.begin(), found.end(), [&](auto &other) {
+      return other.ranks == deadlock->ranks;
+    });
+    if (!known)
+      found.push_back(std::move(*deadlock));
+  }
+
+  if (auto deadlock = findCollective())
+    found.push_back(std::move(*deadlock));
+  return found;
+}
+} // namespace pdb
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <PDBTrace.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace pdb {
+// Blocking MPI call a rank is in, as read from its trace
+struct PDBBlockedCall {
+  PDBMPICall call;
+  int peer;         // Destination or source, negative if none or a wildcard
+  int tag;          // Negative if none or a wildcard
+  int source;       // Source of MPI_Sendrecv, negative if none or a wildcard
+  int source_tag;   // Tag received by MPI_Sendrecv
+  int comm;         // 0 for MPI_COMM_WORLD, see PDBTraceRecord
+  bool collective;  // Collective on MPI_COMM_WORLD
+  std::uint64_t id; // Tells repeated calls apart, its begin ticks
+};
+
+/**
+ * @return Call the rank of a trace is blocked in if record is the last one of
+ * the trace and still in progress, nothing for a call that does not block
+ */
+std::optional<PDBBlockedCall> blockedCall(const PDBTraceRecord &record);
+
+/**
+ * Ranks that wait for each other. Either a cycle of ranks each blocked on the
+ * next one, ranks listed in wait order, or a collective on MPI_COMM_WORLD
+ * that some rank blocked elsewhere never enters, ranks in ascending order
+ */
+struct PDBDeadlock {
+  bool cycle = false;
+  std::vector<std::size_t> ranks;
+  std::vector<PDBMPICall> calls; // Call of each rank
+
+  // "ranks 3→7→3 deadlocked in MPI_Recv"
+  std::string toString() const;
+};
+
+/**
+ * Wait-for graph over the MPI ranks of a job, kept up to date one rank at a
+ * time. A point-to-point call on MPI_COMM_WORLD waits for its peer unless the
+ * peer is in the matching call, a send to this rank for a receive and the
+ * other way round, with the same tag. The two are then only slow to transfer.
+ * MPI_Sendrecv waits for its source, unless either its send or its receive
+ * is matched. Every rank has at most one edge and a cycle through a new edge
+ * is found by following edges from its target, in steps bounded by the cycle
+ * length. Calls the graph cannot see through, MPI_Wait, wildcard sources or
+ * anything on another communicator, block a rank without an edge.
+ *
+ * Graph state is a snapshot of ranks read at different times, a call may have
+ * ended since. Deadlocks are therefore only reported once every rank of them
+ * has been seen in the same call by two updates of itself, see settle.
+ */
+class PDBWaitGraph {
+public:
+  // @param size - number of ranks in the job
+  explicit PDBWaitGraph(std::size_t size);
+
+  /**
+   * Record the blocking call rank is in, or that it is in none. Edges of the
+   * peers of its old and new call are matched again. Costs O(1) unless an
+   * edge has changed
+   */
+  void update(std::size_t rank, const std::optional<PDBBlockedCall> &call);
+
+  /**
+   * Mark the calls recorded so far as settled. Calls still the same when
+   * updated next are treated as ones that never returned in between
+   */
+  void settle() { generation++; }
+
+  // @return Deadlocks whose ranks have all settled in their calls
+  std::vector<PDBDeadlock> deadlocks() const;
+
+private:
+  struct Node {
+    std::optional<PDBBlockedCall> call;
+    std::uint64_t since = 0; // Generation the call was first seen in
+  };
+
+  std::size_t size;
+  std::vector<Node> nodes;
+  std::vector<long> next; // Rank waited for, -1 if none
+  std::size_t blocked = 0;
+  std::uint64_t generation = 1;
+
+  // Ranks whose new edge has closed a cycle, checked again when asked for
+  std::vector<std::size_t> suspects;
+
+  bool settled(std::size_t rank) const {
+    return nodes[rank].call && nodes[rank].since < generation;
+  }
+  bool sendsTo(std::size_t rank, std::size_t receiver, int tag) const;
+  bool receivesFrom(std::size_t rank, std::size_t sender, int tag) const;
+  long waitsFor(std::size_t rank) const; // Rank waited for, -1 if none
+  void relink(std::size_t rank);
+  std::optional<PDBDeadlock> findCycle(std::size_t rank) const;
+  std::optional<PDBDeadlock> findCollective() const;
+};
+} // namespace pdb
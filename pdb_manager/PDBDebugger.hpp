@@ -1,11 +1,32 @@
 #pragma once
 
+#include <GDBMIParser.hpp>
+#include <PDBEvents.hpp>
 #include <PDBProcess.hpp>
+#include <PDBStackTree.hpp>
+#include <boost/thread/future.hpp>
+#include <exception>
 #include <list>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <variant>
 #include <vector>
 
 namespace pdb {
+/**
+ * Outcome of an operation broadcast to a single rank. If the debugger instance
+ * failed, error holds the raised exception and value is left default
+ * constructed
+ */
+template <typename T = std::monostate> struct PDBRankResult {
+  std::size_t rank;
+  T value;
+  std::exception_ptr error;
+
+  bool ok() const { return !error; }
+};
+
 class PDBDebugger : public PDBProcess {
 public:
   using PDBbr_list = std::vector<std::pair<std::string, std::vector<int>>>;
@@ -18,8 +39,16 @@ protected:
   std::string currentFile;
   std::string currentFunction;
 
+  /**
+   * Guards the state above. Replies to asynchronous commands update it on the
+   * reactor while callers read it on their threads
+   */
+  mutable std::mutex state_mutex;
+
 public:
-  PDBDebugger() : isRunning(false) {};
+  PDBDebugger(const std::string &read_name, const std::string &write_name)
+      : PDBProcess(read_name, write_name), isRunning(false), currentLine(0) {};
+  PDBDebugger() : isRunning(false), currentLine(0) {};
   PDBDebugger(const PDBDebugger &) = delete;
   PDBDebugger(PDBDebugger &&) = default;
   virtual ~PDBDebugger() {};
@@ -32,19 +61,93 @@ public:
    * runtime
    * @return On error, throws std::runtime_error
    */
-  virtual void startDebug(const std::string &args) = 0;
-  virtual void endDebug() = 0;
-  virtual void setBreakpoint(PDBbr brpoint) = 0;
-  virtual std::vector<std::string> readInput() = 0;
+  virtual void startDebug(const std::string &args) {
+    submitStart(args);
+    collectStart();
+  }
+  virtual void endDebug() {
+    submitEnd();
+    collectEnd();
+  }
+  virtual void setBreakpoint(PDBbr brpoint) {
+    submitBreakpoint(brpoint);
+    collectBreakpoint(brpoint);
+  }
+
+  /**
+   * Two-phase versions of the calls above. submit* only writes the command to
+   * the debugger, collect* blocks until the reply arrives and interprets it.
+   * Splitting them lets PDBDebug scatter a command to every rank before
+   * gathering any reply
+   */
+  virtual void submitStart(const std::string &args) = 0;
+  virtual void collectStart() = 0;
+  virtual void submitEnd() = 0;
+  virtual void collectEnd() = 0;
+  virtual void submitBreakpoint(PDBbr brpoint) = 0;
+  virtual void collectBreakpoint(PDBbr brpoint) = 0;
+
+  // Call stack of the stopped process, innermost frame first
+  virtual void submitStack() = 0;
+  virtual std::vector<PDBFrame> collectStack() = 0;
 
-  virtual void checkInput(const std::vector<std::string> &) const = 0;
+  /**
+   * Asynchronous operations. The command is written right away and the
+   * future is settled on the reactor once the reply has arrived, so any
+   * number of operations may be in flight on any number of ranks. Errors are
+   * reported through the future, like the blocking calls would throw them.
+   * A debugger is driven either through these or through the blocking calls,
+   * not both at once
+   */
+  virtual boost::future<void> setBreakpointAsync(PDBbr brpoint) = 0;
+  virtual boost::future<void> startAsync(const std::string &args) = 0;
+
+  // Execute up to the next source line, the future is ready once stopped
+  virtual boost::future<void> stepAsync() = 0;
+
+  // Value of an expression in the current frame, as printed by the debugger
+  virtual boost::future<std::string>
+  evaluateAsync(const std::string &expression) = 0;
+
+  virtual PDBRecords readInput() = 0;
+
+  virtual void checkInput(const PDBRecords &) const = 0;
+
+  /**
+   * Publish events of this debugger to hub as its output arrives, tagged with
+   * rank. Must be called before the debugger is connected
+   */
+  virtual void setEventHub(std::shared_ptr<PDBEventHub> hub,
+                           std::size_t rank) = 0;
+
+  /**
+   * Exit code of the inferior once the debugger has reported its exit, -1 if
+   * a signal has killed it. Tracked as output arrives, nothing is read
+   */
+  virtual std::optional<int> getExitCode() const = 0;
+
+  /**
+   * With the lazy launch mode, a rank runs under a stub until a debugger is
+   * attached to it, see PDBStub. A stub attaches one to a faulting rank by
+   * itself, its greeting is consumed here before the rank is used
+   * @return Always true for a rank launched with its debugger
+   */
+  virtual bool isAttached() = 0;
+
+  // Attach a debugger to a lazily launched rank, nothing if it has one
+  virtual void submitAttach() = 0;
+  virtual void collectAttach() = 0;
 
   // Default set of options being passed to a debugger
   static std::string getDefaultOptions() { return ""; };
 
-  virtual bool getCurrentStatus() const { return isRunning; };
+  virtual bool getCurrentStatus() const {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return isRunning;
+  };
 
   virtual std::pair<std::size_t, std::string> getCurrentPosition() const {
+    std::lock_guard<std::mutex> lock(state_mutex);
     if (!isRunning) {
       throw std::logic_error("Cannot get the current source file position. The "
                              "debugging is not started");
@@ -67,19 +170,101 @@ private:
   // Leading \n is essential for gdb, it indicates end of input
   std::string makeCommand(std::string comm) { return comm += "\n"; };
 
+  mi::Parser parser;
+
+  /**
+   * Read one block of output and parse it record by record. Debugger state is
+   * updated from each record before it is passed to visit
+   */
+  template <typename Visitor> PDBRecords readRecords(Visitor &&visit);
+  template <typename Visitor>
+  void parseRecords(const PDBRecords &block, Visitor &&visit);
+  void updateState(const mi::Record &record);
+
+  /**
+   * Interpretation of reply blocks, shared by the blocking and asynchronous
+   * calls. Each throws the error the reply reports
+   */
+  void interpretBreakpoint(const PDBbr &brpoint, const PDBRecords &block);
+  bool interpretStartReply(const PDBRecords &block); // true if nothing to run
+  bool interpretStartStop(const PDBRecords &block);  // false if not stopped
+  bool interpretStop(const PDBRecords &block);       // false if not stopped
+  std::string interpretValue(const PDBRecords &block);
+
+  /**
+   * A breakpoint is reserved when its command is written and released once
+   * the reply is interpreted, so a location being inserted is refused as well
+   */
+  void reserveBreakpoint(const PDBbr &brpoint);
+  void releaseBreakpoint(const PDBbr &brpoint, bool created);
+  std::vector<PDBbr> pending; // Inserted, reply not interpreted yet
+
+  // False while a lazily launched rank runs under its stub
+  bool attached = true;
+  bool attaching = false; // Attach request sent, reply not collected yet
+
+  // Sees output on the reactor, see setEventHub
+  struct Tap;
+  std::shared_ptr<Tap> tap;
+  void installTap();
+
+  // Event of one line of output, false if it is none of the kinds wanted
+  static bool makeEvent(mi::Parser &parser, std::string_view line,
+                        unsigned kinds, PDBEvent &event);
+
+  template <typename T> class Completion;
+
+  // Issue command with a completion built from step, see Completion
+  template <typename T, typename Step>
+  boost::future<T> issue(const std::string &command, Step step);
+
 public:
   // By default, gdb will launch with Machine Interface enabled
-  GDBDebugger() {};
+  GDBDebugger(const std::string &read_name, const std::string &write_name)
+      : PDBDebugger(read_name, write_name) {
+    installTap();
+  };
+  GDBDebugger() { installTap(); };
   virtual ~GDBDebugger() {};
 
-  virtual void setBreakpoint(PDBbr);
-  virtual PDBbr_list getBreakpointList() { return breakpoints; };
-  virtual void startDebug(const std::string &);
-  virtual void endDebug();
-  virtual std::vector<std::string> readInput();
+  virtual PDBbr_list getBreakpointList() {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return breakpoints;
+  };
+  virtual void submitStart(const std::string &);
+  virtual void collectStart();
+  virtual void submitEnd();
+  virtual void collectEnd();
+  virtual void submitBreakpoint(PDBbr);
+  virtual void collectBreakpoint(PDBbr);
+  virtual void submitStack();
+  virtual std::vector<PDBFrame> collectStack();
+  virtual boost::future<void> setBreakpointAsync(PDBbr);
+  virtual boost::future<void> startAsync(const std::string &);
+  virtual boost::future<void> stepAsync();
+  virtual boost::future<std::string> evaluateAsync(const std::string &);
+  virtual PDBRecords readInput();
 
-  virtual void checkInput(const std::vector<std::string> &) const;
+  virtual void checkInput(const PDBRecords &) const;
+  virtual void setEventHub(std::shared_ptr<PDBEventHub>, std::size_t);
+  virtual std::optional<int> getExitCode() const;
+  virtual bool isAttached();
+  virtual void submitAttach();
+  virtual void collectAttach();
 
   static std::string getDefaultOptions() { return "-q --interpreter=mi2"; };
 };
+
+/**
+ * Ranks traced with ptrace by pdb_agent instead of gdb, see PDBNativeAgent.
+ * The agent runs next to its rank, where ptrace has to, and answers in the
+ * GDB/MI subset GDBDebugger reads, so the two only differ in how the
+ * debugger is started. Expressions cannot be evaluated
+ */
+class NativeDebugger : public GDBDebugger {
+public:
+  using GDBDebugger::GDBDebugger;
+
+  static std::string getDefaultOptions() { return ""; };
+};
 } // namespace pdb
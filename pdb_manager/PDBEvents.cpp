@@ -0,0 +1,83 @@
+#include <PDBEvents.hpp>
+#include <algorithm>
+
+namespace pdb {
+PDBEventHub::Id PDBEventHub::subscribe(unsigned kinds, Handler handler,
+                                       std::chrono::milliseconds window) {
+  auto subscription =
+      std::make_shared<Subscription>(PDBReactor::instance().makeStrand());
+  subscription->kinds = kinds;
+  subscription->window = window;
+  subscription->handler = std::move(handler);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  subscription->id = next_id++;
+  subscriptions.push_back(subscription);
+  mask.fetch_or(kinds, std::memory_order_relaxed);
+
+  return subscription->id;
+}
+
+void PDBEventHub::unsubscribe(Id id) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  unsigned kinds = 0;
+  for (auto iter = subscriptions.begin(); iter != subscriptions.end();) {
+    if ((*iter)->id != id) {
+      kinds |= (*iter)->kinds;
+      ++iter;
+      continue;
+    }
+
+    // A batch still queued finds the subscription inactive and is dropped
+    {
+      std::lock_guard<std::mutex> sub_lock((*iter)->mutex);
+      (*iter)->active = false;
+      (*iter)->pending.clear();
+    }
+    iter = subscriptions.erase(iter);
+  }
+
+  mask.store(kinds, std::memory_order_relaxed);
+}
+
+void PDBEventHub::publish(const PDBEvent &event) {
+  auto kind = static_cast<unsigned>(event.kind);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &subscription : subscriptions) {
+    if (!(subscription->kinds & kind))
+      continue;
+
+    std::lock_guard<std::mutex> sub_lock(subscription->mutex);
+    subscription->pending.push_back(event);
+    if (subscription->scheduled)
+      continue;
+
+    // First event of a batch, delivery is scheduled once per batch
+    subscription->scheduled = true;
+    if (subscription->window.count() == 0) {
+      boost::asio::post(subscription->timer.get_executor(),
+                        [subscription]() { flush(subscription); });
+    } else {
+      subscription->timer.expires_after(subscription->window);
+      subscription->timer.async_wait(
+          [subscription](boost::system::error_code) { flush(subscription); });
+    }
+  }
+}
+
+void PDBEventHub::flush(const std::shared_ptr<Subscription> &subscription) {
+  Batch batch;
+  {
+    std::lock_guard<std::mutex> lock(subscription->mutex);
+    batch.swap(subscription->pending);
+    subscription->scheduled = false;
+    if (!subscription->active)
+      return;
+  }
+
+  if (!batch.empty())
+    subscription->handler(batch);
+}
+} // namespace pdb
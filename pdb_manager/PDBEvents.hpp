@@ -0,0 +1,122 @@
+#pragma once
+
+#include <PDBReactor.hpp>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pdb {
+// Kinds of events, or-ed together to form a subscription mask
+enum class PDBEventKind : unsigned {
+  Stopped = 1u << 0,
+  Running = 1u << 1,
+  Exited = 1u << 2,
+  Output = 1u << 3, // Output of the inferior
+  BreakpointCreated = 1u << 4
+};
+
+constexpr unsigned operator|(PDBEventKind lhs, PDBEventKind rhs) {
+  return static_cast<unsigned>(lhs) | static_cast<unsigned>(rhs);
+}
+
+constexpr unsigned operator|(unsigned lhs, PDBEventKind rhs) {
+  return lhs | static_cast<unsigned>(rhs);
+}
+
+constexpr unsigned pdb_all_events =
+    PDBEventKind::Stopped | PDBEventKind::Running | PDBEventKind::Exited |
+    PDBEventKind::Output | PDBEventKind::BreakpointCreated;
+
+/**
+ * Event of a single rank. Only the fields of its kind are filled in
+ */
+struct PDBEvent {
+  std::size_t rank = 0;
+  PDBEventKind kind = PDBEventKind::Stopped;
+
+  // Stopped, Exited: reason reported by the debugger, like "breakpoint-hit"
+  std::string reason;
+
+  // Stopped, BreakpointCreated: line and file
+  std::pair<std::size_t, std::string> position;
+
+  // Stopped: function of the innermost frame
+  std::string function;
+
+  // Exited: exit code of the inferior, -1 if a signal has killed it
+  int exit_code = 0;
+
+  // Output: one line without newline. BreakpointCreated: breakpoint number.
+  // Stopped by a fault of a lazily launched rank: name of the signal
+  std::string text;
+};
+
+/**
+ * Fan-out of debugger events to subscribers. Debuggers publish from the
+ * reactor as output arrives, before any reader has looked at it.
+ *
+ * Each subscription has its own strand, its handler never runs concurrently
+ * with itself and receives events in the order they were published for a
+ * rank. Events published while a batch is pending join it, so events of many
+ * ranks stopping together arrive as one batch. A window delays delivery to
+ * coalesce even more of them.
+ */
+class PDBEventHub {
+public:
+  using Batch = std::vector<PDBEvent>;
+  using Handler = std::function<void(const Batch &)>;
+  using Id = std::size_t;
+
+  PDBEventHub() = default;
+  PDBEventHub(const PDBEventHub &) = delete;
+  PDBEventHub &operator=(const PDBEventHub &) = delete;
+
+  /**
+   * @param kinds - mask of PDBEventKind values
+   * @param handler - called on a reactor thread, must not block
+   * @param window - time a batch is held open after its first event
+   * @return Identifier to unsubscribe with
+   */
+  Id subscribe(unsigned kinds, Handler handler,
+               std::chrono::milliseconds window = {});
+
+  // No batch is delivered once this returns, except one already running
+  void unsubscribe(Id id);
+
+  // Kinds anyone is subscribed to, publishers skip the others early
+  unsigned kinds() const { return mask.load(std::memory_order_relaxed); }
+
+  void publish(const PDBEvent &event);
+
+private:
+  struct Subscription {
+    explicit Subscription(const PDBReactor::strand_type &strand)
+        : timer(strand) {}
+
+    boost::asio::steady_timer timer;
+    Id id;
+    unsigned kinds;
+    std::chrono::milliseconds window;
+    Handler handler;
+
+    std::mutex mutex;
+    Batch pending;
+    bool scheduled = false;
+    bool active = true;
+  };
+
+  static void flush(const std::shared_ptr<Subscription> &subscription);
+
+  mutable std::mutex mutex;
+  std::vector<std::shared_ptr<Subscription>> subscriptions;
+  std::atomic<unsigned> mask{0};
+  Id next_id = 1;
+};
+} // namespace pdb
@@ -0,0 +1,78 @@
+/**
+ *  Times the startup of DwarfIndex with and without its on-disk cache
+ *
+ *  pdb_index_bench <exec> [rounds]
+ *  indexes exec with an empty cache directory (cold), then again with the
+ *  image the cold run has left there (warm), and prints the mean wall time
+ *  of both. Startup lasts up to the first answer, the list of source files.
+ *  The cache directory is a fresh one under /tmp, only the index image is
+ *  cleared between rounds, the executable stays in the page cache
+ */
+#include <PDB_DWARF_Handlers.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+namespace {
+// Wall time of one startup in ms, negative if exec cannot be indexed
+double startup(const std::string &exec, std::size_t &files) {
+  auto start = std::chrono::steady_clock::now();
+  auto index = pdb::DwarfIndex::create(exec);
+  if (!index)
+    return -1;
+  files = (*index)->getSourceFiles().size();
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <exec> [rounds]\n", argv[0]);
+    return 2;
+  }
+
+  std::string exec = argv[1];
+  std::size_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5;
+  if (rounds == 0)
+    rounds = 1;
+
+  char cache_dir[] = "/tmp/pdb_index_bench_XXXXXX";
+  if (mkdtemp(cache_dir) == nullptr) {
+    std::perror("Cannot create cache directory");
+    return 1;
+  }
+  setenv("PDB_CACHE_DIR", cache_dir, 1);
+
+  double cold = 0, warm = 0;
+  std::size_t files = 0;
+  bool failed = false;
+  for (std::size_t i = 0; i < rounds && !failed; i++) {
+    std::error_code ec;
+    for (auto &entry : std::filesystem::directory_iterator(cache_dir, ec))
+      std::filesystem::remove(entry.path(), ec);
+
+    double cold_ms = startup(exec, files);
+    double warm_ms = startup(exec, files);
+    failed = cold_ms < 0 || warm_ms < 0;
+    cold += cold_ms;
+    warm += warm_ms;
+  }
+
+  std::error_code ec;
+  std::filesystem::remove_all(cache_dir, ec);
+  if (failed) {
+    std::fprintf(stderr, "Error reading debug information: %s\n",
+                 exec.c_str());
+    return 1;
+  }
+
+  std::printf("%zu source files, mean of %zu rounds\n", files, rounds);
+  std::printf("cold %10.2f ms\nwarm %10.2f ms\n", cold / rounds,
+              warm / rounds);
+  return 0;
+}
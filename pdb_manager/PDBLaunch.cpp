@@ -1,78 +1,207 @@
 /**
  *  Auxiliary helper which set up the PDB runtime for each process
+ *
+ *  Started as "pdb_launch --relay <fanout> <fd>", it serves as a node of the
+ *  relay tree instead, see PDBRelay. In the lazy launch mode, it runs the
+ *  application under a PDBStub instead of starting the debugger
  */
+#include <PDBRegistry.hpp>
+#include <PDBRelay.hpp>
+#include <PDBRendezvous.hpp>
+#include <PDBStub.hpp>
+#include <PDBTrace.hpp>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
 #include <stdexcept>
 #include <string>
-#include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <system_error>
 #include <unistd.h>
 #include <utility>
 #include <vector>
 
-#define PDB_PIPE_LENGTH 20
+/**
+ * Fallback for launchers that do not export a rank. Each process takes the
+ * lowest slot it can create exclusively, which needs no lock and costs one
+ * failed create per process started before it.
+ */
+long claimRank(const std::string &dir, long proc_num) {
+  for (long rank = 0; rank < proc_num; rank++) {
+    int fd = open(pdb::rendezvous::slotFile(dir, rank).c_str(),
+                  O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd >= 0) {
+      close(fd);
+      return rank;
+    }
+
+    if (errno != EEXIST)
+      throw std::system_error(std::error_code(errno, std::generic_category()),
+                              "Error claiming rank slot: ");
+  }
+
+  throw std::runtime_error("No free rank slot in " + dir);
+}
 
-std::pair<std::string, std::string> readPipeNames(const char *temp_file,
-                                                  int proc_num) {
-  int fd = open(temp_file, O_RDWR);
+sockaddr_un socketAddress(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    throw std::runtime_error("Socket path too long: " + path);
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return address;
+}
+
+/**
+ * Connect to a listening socket of PDBDebug or of a node relay and send the
+ * hello. The socket then carries both standard input and output of the
+ * debugger
+ */
+int connectSocket(const std::string &path, pdb::rendezvous::Hello hello) {
+  auto address = socketAddress(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
   if (fd < 0)
     throw std::system_error(std::error_code(errno, std::generic_category()),
-                            "Error opening temporal file: ");
-
-  if (flock(fd, LOCK_EX) < 0)
+                            "Error creating socket: ");
+
+  // A full backlog is reported as EAGAIN while many ranks connect at once, a
+  // node relay may be bound but not listening yet
+  for (int attempt = 0; connect(fd, reinterpret_cast<sockaddr *>(&address),
+                                sizeof(address)) < 0;
+       attempt++) {
+    if ((errno != EAGAIN && errno != EINTR && errno != ECONNREFUSED) ||
+        attempt == 10000)
+      throw std::system_error(std::error_code(errno, std::generic_category()),
+                              "Error connecting to " + path + ": ");
+    usleep(1000);
+  }
+
+  if (write(fd, &hello, sizeof(hello)) != sizeof(hello))
     throw std::system_error(std::error_code(errno, std::generic_category()),
-                            "Error locking temporal file: ");
+                            "Error sending hello: ");
 
-  std::vector<char> file(4096);
-  std::vector<char> in_pipe(PDB_PIPE_LENGTH);
-  std::vector<char> out_pipe(PDB_PIPE_LENGTH);
+  return fd;
+}
 
-  int nbytes;
-  if ((nbytes = read(fd, file.data(), 4096)) < 0)
+/**
+ * Elect the node relay of this host. Whichever process binds the node socket
+ * first forks the relay, which connects to PDBDebug on behalf of the node.
+ * @return Path of the node socket every rank of the node connects to
+ */
+std::string startNodeRelay(const std::string &dir, long proc_num) {
+  char host[256] = {};
+  if (gethostname(host, sizeof(host) - 1) < 0)
     throw std::system_error(std::error_code(errno, std::generic_category()),
-                            "Error reading from temporal file: ");
+                            "Error reading host name: ");
+
+  std::string path = pdb::rendezvous::nodeSocketPath(dir, host);
+  auto address = socketAddress(path);
 
-  std::copy(file.begin(), file.begin() + PDB_PIPE_LENGTH, in_pipe.begin());
-  std::copy(file.begin() + PDB_PIPE_LENGTH, file.begin() + PDB_PIPE_LENGTH * 2,
-            out_pipe.begin());
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    throw std::system_error(std::error_code(errno, std::generic_category()),
+                            "Error creating socket: ");
 
-  ftruncate(fd, 0);
-  lseek(fd, 0, SEEK_SET);
-  if (write(fd, file.data() + (PDB_PIPE_LENGTH * 2),
-            nbytes - (PDB_PIPE_LENGTH * 2)) < 0)
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+    close(fd);
+    if (errno == EADDRINUSE)
+      return path;
     throw std::system_error(std::error_code(errno, std::generic_category()),
-                            "Error writing to temporal file: ");
+                            "Error binding " + path + ": ");
+  }
 
-  flock(fd, LOCK_UN);
-  close(fd);
+  if (listen(fd, SOMAXCONN) < 0)
+    throw std::system_error(std::error_code(errno, std::generic_category()),
+                            "Error listening on " + path + ": ");
 
-  std::string input_pipe(in_pipe.begin(), in_pipe.end());
-  std::string output_pipe(out_pipe.begin(), out_pipe.end());
+  pid_t pid = fork();
+  if (pid < 0)
+    throw std::system_error(std::error_code(errno, std::generic_category()),
+                            "Error spawning node relay: ");
+
+  // The relay outlives this process, it must not hold the launcher's output
+  if (pid == 0) {
+    int status = 0;
+    try {
+      int null = open("/dev/null", O_RDWR);
+      dup2(null, STDIN_FILENO);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+
+      int parent = connectSocket(pdb::rendezvous::muxSocketPath(dir),
+                                 pdb::rendezvous::node_hello);
+      pdb::PDBRelay relay(parent, fd, proc_num);
+      relay.run();
+    } catch (...) {
+      status = 1;
+    }
+    _exit(status);
+  }
 
-  return std::make_pair(input_pipe, output_pipe);
+  close(fd);
+  return path;
 }
 
 int main(int argc, char **argv) {
+  if (argc == 4 && std::strcmp(argv[1], "--relay") == 0) {
+    pdb::PDBRelay relay(std::atoi(argv[3]), std::atoi(argv[2]));
+    relay.run();
+    return 0;
+  }
+
   // The last 2 parameters in the current scheme would be process specific
   // arguments
-  int proc_num = atoi(argv[argc - 1]);
-  auto pipes = readPipeNames(argv[argc - 2], proc_num);
-
-  // The following calls to open should be synchronized with calls in PDBDebug
-  // constructor For more information, see PDBDebug
-  int pipe_out = open(pipes.first.c_str(), O_WRONLY);
-  if (pipe_out < 0)
-    throw std::system_error(std::error_code(errno, std::generic_category()),
-                            "Error opening STDOUT pipe file: ");
-
-  int pipe_in = open(pipes.second.c_str(), O_RDONLY);
-  if (pipe_in < 0)
-    throw std::system_error(std::error_code(errno, std::generic_category()),
-                            "Error opening STDIN pipe file: ");
+  long proc_num = atol(argv[argc - 1]);
+  std::string dir = argv[argc - 2];
+
+  long rank = pdb::rendezvous::launcherRank();
+  if (rank < 0)
+    rank = claimRank(dir, proc_num);
+  else if (rank >= proc_num)
+    throw std::runtime_error("Launcher rank " + std::to_string(rank) +
+                             " is out of range");
+
+  // The PDB runtime publishes the rank under this channel from MPI_Init and
+  // traces its MPI calls next to it. The application inherits the environment
+  // through the debugger or the stub
+  setenv(pdb::PDBRegistry::path_variable,
+         pdb::rendezvous::registryFile(dir).c_str(), 1);
+  setenv(pdb::PDBRegistry::channel_variable, std::to_string(rank).c_str(), 1);
+  setenv(pdb::PDBTraceRing::path_variable,
+         pdb::rendezvous::traceFile(dir, rank).c_str(), 1);
+
+  auto pipes = std::make_pair(pdb::rendezvous::outputPipe(dir, rank),
+                              pdb::rendezvous::inputPipe(dir, rank));
+  int pipe_out, pipe_in;
+
+  std::string socket_path = pdb::rendezvous::socketPath(dir);
+  if (access(pdb::rendezvous::muxSocketPath(dir).c_str(), F_OK) == 0) {
+    std::string node_path = startNodeRelay(dir, proc_num);
+    pipes = std::make_pair(node_path, node_path);
+    pipe_out = pipe_in = connectSocket(node_path, rank);
+  } else if (access(socket_path.c_str(), F_OK) == 0) {
+    pipes = std::make_pair(socket_path, socket_path);
+    pipe_out = pipe_in = connectSocket(socket_path, rank);
+  } else {
+    // The following calls to open should be synchronized with calls in
+    // PDBDebug constructor For more information, see PDBDebug
+    pipe_out = open(pipes.first.c_str(), O_WRONLY);
+    if (pipe_out < 0)
+      throw std::system_error(std::error_code(errno, std::generic_category()),
+                              "Error opening STDOUT pipe file: ");
+
+    pipe_in = open(pipes.second.c_str(), O_RDONLY);
+    if (pipe_in < 0)
+      throw std::system_error(std::error_code(errno, std::generic_category()),
+                              "Error opening STDIN pipe file: ");
+  }
 
   close(STDIN_FILENO);
   close(STDOUT_FILENO);
@@ -99,6 +228,14 @@ int main(int argc, char **argv) {
 
   argc -= 2;
   argv[argc] = NULL;
+
+  // Debugger command line ends with the executable, the stub attaches it later
+  if (access(pdb::rendezvous::lazyMarker(dir).c_str(), F_OK) == 0) {
+    pdb::PDBStub stub(std::vector<std::string>(argv + 1, argv + argc),
+                      argv[argc - 1]);
+    return stub.run();
+  }
+
   if (execvp(argv[1], argv + 1) < 0)
     throw std::system_error(std::error_code(errno, std::generic_category()),
                             "execvp error: ");
@@ -0,0 +1,1297 @@
+#include <PDBNativeAgent.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <fstream>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/personality.h>
+#include <sys/ptrace.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace pdb {
+struct PDBNativeAgent::Symbols {
+  struct Entry {
+    std::uint64_t start;
+    std::uint64_t end;
+    std::string name;
+  };
+
+  std::vector<Entry> entries;
+  std::uint64_t entry_point = 0;
+  std::uint64_t first_load = 0; // Lowest address of a loaded segment
+
+  // Functions of .symtab and .dynsym, nothing if path is no 64-bit ELF
+  static std::shared_ptr<const Symbols> load(const std::string &path);
+
+  const Entry *find(std::uint64_t address) const {
+    auto entry = std::upper_bound(
+        entries.begin(), entries.end(), address,
+        [](std::uint64_t addr, const Entry &e) { return addr < e.start; });
+    if (entry == entries.begin())
+      return nullptr;
+    --entry;
+    return address < entry->end ? &*entry : nullptr;
+  }
+};
+
+namespace {
+// Frames past this many are not unwound, nor is the stack scanned further
+constexpr std::size_t max_frames = 128;
+constexpr std::uint64_t scan_limit = 16 * 1024;
+
+[[noreturn]] void throwErrno(const std::string &what) {
+  throw std::system_error(std::error_code(errno, std::generic_category()),
+                          what);
+}
+
+// Signals gdb stops the application on, the rest is passed on silently
+bool isFault(int sig) {
+  return sig == SIGSEGV || sig == SIGBUS || sig == SIGFPE || sig == SIGILL ||
+         sig == SIGABRT;
+}
+
+std::string signalName(int sig) {
+  const char *abbrev = ::sigabbrev_np(sig);
+  return abbrev ? std::string("SIG") + abbrev : "SIG" + std::to_string(sig);
+}
+
+std::string hex(std::uint64_t value) {
+  char text[24];
+  std::snprintf(text, sizeof(text), "0x%016llx",
+                static_cast<unsigned long long>(value));
+  return text;
+}
+
+// Contents of a GDB/MI c-string
+std::string quote(const std::string &text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string baseName(const std::string &path) {
+  auto slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+std::vector<std::string> splitWords(const std::string &text) {
+  std::istringstream stream(text);
+  std::vector<std::string> words;
+  for (std::string word; stream >> word;)
+    words.push_back(word);
+  return words;
+}
+
+void restoreSignals() {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  ::sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+  ::signal(SIGPIPE, SIG_DFL);
+}
+} // namespace
+
+std::shared_ptr<const PDBNativeAgent::Symbols>
+PDBNativeAgent::Symbols::load(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat info;
+  if (::fstat(fd, &info) < 0 ||
+      static_cast<std::size_t>(info.st_size) < sizeof(Elf64_Ehdr)) {
+    ::close(fd);
+    return nullptr;
+  }
+
+  std::size_t size = static_cast<std::size_t>(info.st_size);
+  void *base = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED)
+    return nullptr;
+
+  auto *image = static_cast<const char *>(base);
+  auto *header = reinterpret_cast<const Elf64_Ehdr *>(image);
+  auto inside = [&](std::uint64_t offset, std::uint64_t length) {
+    return offset <= size && length <= size - offset;
+  };
+
+  if (std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+      header->e_ident[EI_CLASS] != ELFCLASS64 ||
+      !inside(header->e_phoff, header->e_phnum * sizeof(Elf64_Phdr)) ||
+      !inside(header->e_shoff, header->e_shnum * sizeof(Elf64_Shdr))) {
+    ::munmap(base, size);
+    return nullptr;
+  }
+
+  auto symbols = std::make_shared<Symbols>();
+  symbols->entry_point = header->e_entry;
+
+  auto *segments = reinterpret_cast<const Elf64_Phdr *>(image + header->e_phoff);
+  bool loaded = false;
+  for (std::size_t i = 0; i < header->e_phnum; i++) {
+    if (segments[i].p_type != PT_LOAD)
+      continue;
+    auto start = segments[i].p_vaddr & ~std::uint64_t(0xfff);
+    symbols->first_load = loaded ? std::min(symbols->first_load, start) : start;
+    loaded = true;
+  }
+
+  auto *sections = reinterpret_cast<const Elf64_Shdr *>(image + header->e_shoff);
+  for (std::size_t i = 0; i < header->e_shnum; i++) {
+    const auto &table = sections[i];
+    if ((table.sh_type != SHT_SYMTAB && table.sh_type != SHT_DYNSYM) ||
+        table.sh_link >= header->e_shnum ||
+        !inside(table.sh_offset, table.sh_size))
+      continue;
+
+    const auto &strings = sections[table.sh_link];
+    if (!inside(strings.sh_offset, strings.sh_size))
+      continue;
+
+    auto *syms = reinterpret_cast<const Elf64_Sym *>(image + table.sh_offset);
+    for (std::size_t j = 0; j < table.sh_size / sizeof(Elf64_Sym); j++) {
+      auto type = ELF64_ST_TYPE(syms[j].st_info);
+      if ((type != STT_FUNC && type != STT_GNU_IFUNC) ||
+          syms[j].st_shndx == SHN_UNDEF || syms[j].st_value == 0 ||
+          syms[j].st_name >= strings.sh_size)
+        continue;
+
+      const char *name = image + strings.sh_offset + syms[j].st_name;
+      symbols->entries.push_back(
+          {syms[j].st_value, syms[j].st_value + syms[j].st_size,
+           std::string(name, strnlen(name, strings.sh_size - syms[j].st_name))});
+    }
+  }
+  ::munmap(base, size);
+
+  // Both tables list most functions, the sized entry is kept
+  auto &entries = symbols->entries;
+  std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) {
+    return a.start != b.start ? a.start < b.start : a.end > b.end;
+  });
+  entries.erase(std::unique(entries.begin(), entries.end(),
+                            [](auto &a, auto &b) { return a.start == b.start; }),
+                entries.end());
+
+  // Functions of unknown size, hand-written ones mostly, end at the next one
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].end == entries[i].start)
+      entries[i].end = i + 1 < entries.size() ? entries[i + 1].start
+                                              : entries[i].start + 1;
+  }
+  entries.shrink_to_fit();
+  return symbols;
+}
+
+PDBNativeAgent::PDBNativeAgent(std::string exec, pid_t attach_pid)
+    : exec(std::move(exec)) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (::sigprocmask(SIG_BLOCK, &mask, nullptr) < 0)
+    throwErrno("Error blocking SIGCHLD: ");
+
+  signal_fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signal_fd < 0)
+    throwErrno("Error creating signalfd: ");
+  ::signal(SIGPIPE, SIG_IGN);
+
+  // An attached process is whatever it executes, not what it was told
+  if (attach_pid > 0) {
+    char path[PATH_MAX];
+    auto link = "/proc/" + std::to_string(attach_pid) + "/exe";
+    auto n = ::readlink(link.c_str(), path, sizeof(path) - 1);
+    if (n < 0)
+      throwErrno("Error reading executable of " + std::to_string(attach_pid) +
+                 ": ");
+    this->exec.assign(path, n);
+  }
+
+  auto result = DwarfIndex::create(this->exec);
+  if (!result)
+    throw std::runtime_error("Error reading debug information: " + this->exec);
+  index = std::move(*result);
+
+  exec_symbols = Symbols::load(this->exec);
+  if (!exec_symbols)
+    throw std::runtime_error("Error reading symbols: " + this->exec);
+  exec_entry = exec_symbols->entry_point;
+
+  if (attach_pid > 0)
+    attach(attach_pid);
+}
+
+PDBNativeAgent::~PDBNativeAgent() {
+  if (signal_fd >= 0)
+    ::close(signal_fd);
+}
+
+void PDBNativeAgent::run() {
+  send("=thread-group-added,id=\"i1\"\n");
+  if (state == State::Stopped)
+    reportStop("");
+  else
+    send("(gdb) \n");
+
+  while (!quit) {
+    pollfd fds[2] = {{signal_fd, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+    if (::poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      throwErrno("Error polling agent: ");
+    }
+
+    if (fds[0].revents & POLLIN) {
+      signalfd_siginfo info;
+      while (::read(signal_fd, &info, sizeof(info)) == sizeof(info))
+        ;
+      reap();
+    }
+
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+      readCommands();
+  }
+
+  finish();
+}
+
+void PDBNativeAgent::readCommands() {
+  char buffer[4096];
+  auto n = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (n < 0 && errno == EINTR)
+    return;
+
+  // pdb_man has gone, so has the job
+  if (n <= 0) {
+    quit = true;
+    return;
+  }
+
+  input.append(buffer, n);
+  serveCommands();
+}
+
+void PDBNativeAgent::serveCommands() {
+  while (!quit) {
+    // Only quit is served while the application runs
+    if (state == State::Running) {
+      for (std::size_t begin = 0, end; (end = input.find('\n', begin)) !=
+                                       std::string::npos;
+           begin = end + 1) {
+        auto words = splitWords(input.substr(begin, end - begin));
+        if (words.size() == 1 && (words[0] == "quit" || words[0] == "-gdb-exit"))
+          quit = true;
+      }
+      return;
+    }
+
+    auto end = input.find('\n');
+    if (end == std::string::npos)
+      return;
+    std::string line = input.substr(0, end);
+    input.erase(0, end + 1);
+    command(line);
+  }
+}
+
+void PDBNativeAgent::command(const std::string &line) {
+  auto words = splitWords(line);
+  if (words.empty())
+    return;
+
+  auto &name = words[0];
+  auto args = line.substr(std::min(line.size(), line.find(name) + name.size()));
+
+  if (name == "quit" || name == "-gdb-exit")
+    quit = true;
+  else if (name == "-break-insert" || name == "b" || name == "break")
+    breakInsert(args);
+  else if (name == "r" || name == "run" || name == "-exec-run")
+    start(args);
+  else if (name == "-exec-continue" || name == "c" || name == "continue")
+    resume();
+  else if (name == "-exec-next" || name == "n" || name == "next")
+    next();
+  else if (name == "-stack-list-frames")
+    listFrames();
+  else if (name == "-data-evaluate-expression")
+    send("^error,msg=\"Expressions are not evaluated by pdb_agent\"\n(gdb) \n");
+  else
+    send("^error,msg=" + quote("Undefined command: \"" + name + "\"") +
+         "\n(gdb) \n");
+}
+
+/**
+ * Like gdb, a breakpoint gets one location per function the line has code
+ * in, the lowest address of it. Options of -break-insert are not supported,
+ * the location is its last word
+ */
+void PDBNativeAgent::breakInsert(const std::string &args) {
+  auto words = splitWords(args);
+  std::string location = words.empty() ? "" : words.back();
+
+  auto colon = location.rfind(':');
+  std::size_t line = 0;
+  if (colon != std::string::npos && colon + 1 < location.size() &&
+      location.find_first_not_of("0123456789", colon + 1) == std::string::npos)
+    line = std::stoul(location.substr(colon + 1));
+  if (line == 0) {
+    send("^error,msg=" + quote("Unsupported location: " + location) +
+         "\n(gdb) \n");
+    return;
+  }
+
+  std::string file = location.substr(0, colon);
+  auto resolved = index->getBreakpointLocation(file, line);
+  std::vector<DwarfIndex::AddressRange> ranges;
+  if (resolved) {
+    auto found = index->getLineAddresses(resolved->second, resolved->first);
+    if (found)
+      ranges = std::move(*found);
+  }
+  if (ranges.empty()) {
+    send("^error,msg=" +
+         quote("No line " + std::to_string(line) + " in file \"" + file +
+               "\".") +
+         "\n(gdb) \n");
+    return;
+  }
+
+  Breakpoint breakpoint{static_cast<int>(breakpoints.size()) + 1,
+                        resolved->second, resolved->first, {}};
+  std::vector<std::uint64_t> functions;
+  for (auto &range : ranges) {
+    auto *function = exec_symbols->find(range.first);
+    auto key = function ? function->start : range.first;
+    if (std::find(functions.begin(), functions.end(), key) != functions.end())
+      continue;
+    functions.push_back(key);
+    breakpoint.addresses.push_back(range.first);
+  }
+  breakpoints.push_back(breakpoint);
+
+  if (state != State::Idle) {
+    for (auto address : breakpoint.addresses)
+      insertSite(address + bias, false);
+  }
+
+  auto address = breakpoint.addresses.size() > 1
+                     ? std::string("<MULTIPLE>")
+                     : hex(breakpoint.addresses.front() + bias);
+  auto *function = exec_symbols->find(breakpoint.addresses.front());
+  send("^done,bkpt={number=\"" + std::to_string(breakpoint.number) +
+       "\",type=\"breakpoint\",disp=\"keep\",enabled=\"y\",addr=\"" + address +
+       "\",func=" + quote(function ? function->name : "??") +
+       ",file=" + quote(baseName(breakpoint.file)) +
+       ",fullname=" + quote(breakpoint.file) + ",line=\"" +
+       std::to_string(breakpoint.line) +
+       "\",thread-groups=[\"i1\"],times=\"0\",original-location=" +
+       quote(location) + "}\n(gdb) \n");
+}
+
+/**
+ * The application is seized before it execs and stops at the exec, where
+ * breakpoints are inserted. As gdb does, address space randomization is
+ * turned off for it
+ */
+void PDBNativeAgent::start(const std::string &args) {
+  if (state != State::Idle) {
+    send("^error,msg=\"The program being debugged has been started "
+         "already.\"\n(gdb) \n");
+    return;
+  }
+
+  int sync[2];
+  if (::pipe2(sync, O_CLOEXEC) < 0)
+    throwErrno("Error creating pipe: ");
+
+  auto argv_words = splitWords(args);
+  argv_words.insert(argv_words.begin(), exec);
+
+  pid = ::fork();
+  if (pid < 0)
+    throwErrno("Error spawning application: ");
+
+  if (pid == 0) {
+    restoreSignals();
+    ::personality(ADDR_NO_RANDOMIZE);
+
+    // Standard input carries commands of pdb_man, output is shared with it
+    int null = ::open("/dev/null", O_RDONLY);
+    ::dup2(null, STDIN_FILENO);
+
+    char go;
+    ::close(sync[1]);
+    if (::read(sync[0], &go, 1) != 1)
+      ::_exit(127);
+
+    std::vector<char *> argv;
+    for (auto &arg : argv_words)
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    ::execv(argv[0], argv.data());
+    ::_exit(127);
+  }
+
+  ::close(sync[0]);
+  if (::ptrace(PTRACE_SEIZE, pid, nullptr,
+               PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC |
+                   PTRACE_O_EXITKILL) < 0)
+    throwErrno("Error tracing application: ");
+
+  char go = 1;
+  if (::write(sync[1], &go, 1) != 1)
+    throwErrno("Error starting application: ");
+  ::close(sync[1]);
+
+  next_thread_id = 1;
+  addThread(pid, false);
+  state = State::Running;
+  send("^running\n*running,thread-id=\"all\"\n(gdb) \n");
+
+  for (;;) {
+    int status;
+    if (::waitpid(pid, &status, __WALL) < 0) {
+      if (errno == EINTR)
+        continue;
+      throwErrno("Error waiting for application: ");
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      handleExit(pid, status);
+      return;
+    }
+    if (status >> 16 == PTRACE_EVENT_EXEC)
+      break;
+
+    int sig = status >> 16 == 0 ? WSTOPSIG(status) : 0;
+    ::ptrace(PTRACE_CONT, pid, nullptr, sig);
+  }
+
+  threads.at(pid).stopped = true;
+  bias = loadBias();
+  insertSites();
+  current = pid;
+  continueAll();
+}
+
+void PDBNativeAgent::resume() {
+  if (state != State::Stopped) {
+    send("^error,msg=\"The program is not being run.\"\n(gdb) \n");
+    return;
+  }
+
+  send("^running\n*running,thread-id=\"all\"\n(gdb) \n");
+  continueAll();
+}
+
+void PDBNativeAgent::next() {
+  if (state != State::Stopped) {
+    send("^error,msg=\"The program is not being run.\"\n(gdb) \n");
+    return;
+  }
+
+  auto location = findLocation(registers(current).rip);
+  if (!location) {
+    send("^error,msg=\"Cannot find bounds of current function\"\n(gdb) \n");
+    return;
+  }
+
+  send("^running\n*running,thread-id=\"all\"\n(gdb) \n");
+  step = Step{current, location->first, location->second};
+  continueStep();
+}
+
+/**
+ * "next" is executed an instruction at a time on the stepping thread, the
+ * others stay stopped. A call is run at full speed instead, up to a
+ * step-resume breakpoint at its return address. A return lands in the
+ * middle of the line of the call, the rest of that line is stepped over too.
+ * A breakpoint reached on the way ends the step, as it would at full speed.
+ */
+void PDBNativeAgent::continueStep() {
+  for (;;) {
+    pid_t tid = step->tid;
+    auto before = registers(tid);
+    if (!stepOver(tid)) {
+      // Only the thread is gone, the others carry on
+      if (state != State::Idle) {
+        step.reset();
+        continueAll();
+      }
+      return;
+    }
+
+    if (isFault(threads.at(tid).signal)) {
+      endStep();
+      current = tid;
+      reportStop("reason=\"signal-received\",signal-name=\"" +
+                 signalName(threads.at(tid).signal) + "\"");
+      return;
+    }
+
+    auto after = registers(tid);
+    auto site = sites.find(after.rip);
+    if (site != sites.end() && site->second.inserted &&
+        site->second.users > 0) {
+      reportHit(tid, after.rip);
+      return;
+    }
+
+    std::uint64_t top = 0;
+    if (after.rsp == before.rsp - 8 && peek(after.rsp, top) &&
+        top > before.rip && top <= before.rip + 15) {
+      step->return_site = top;
+      step->call_sp = after.rsp;
+      insertSite(top, true);
+      continueAll();
+      return;
+    }
+
+    auto location = findLocation(after.rip);
+    std::uint64_t popped = 0;
+    if (after.rsp == before.rsp + 8 && peek(before.rsp, popped) &&
+        popped == after.rip) {
+      // Out of the function stepped in and into code without lines, main
+      // returning for one, nothing is left to step through
+      if (!location) {
+        step.reset();
+        continueAll();
+        return;
+      }
+      step->line = location->first;
+      step->file = location->second;
+      continue;
+    }
+
+    if (leftLine(after.rip)) {
+      step.reset();
+      current = tid;
+      reportStop("reason=\"end-stepping-range\"");
+      return;
+    }
+  }
+}
+
+bool PDBNativeAgent::leftLine(std::uint64_t pc) const {
+  auto location = findLocation(pc);
+  return location &&
+         (location->first != step->line || location->second != step->file);
+}
+
+void PDBNativeAgent::endStep() {
+  if (step && step->return_site != 0)
+    removeSite(step->return_site);
+  step.reset();
+}
+
+void PDBNativeAgent::listFrames() {
+  if (state != State::Stopped) {
+    send("^error,msg=\"No registers.\"\n(gdb) \n");
+    return;
+  }
+
+  auto pcs = unwind(current);
+  std::string reply = "^done,stack=[";
+  for (std::size_t level = 0; level < pcs.size(); level++) {
+    if (level > 0)
+      reply += ",";
+    reply += "frame={level=\"" + std::to_string(level) + "\"," +
+             frameTuple(pcs[level], level > 0) + "}";
+  }
+  send(reply + "]\n(gdb) \n");
+}
+
+/**
+ * Threads are seized one by one, a thread started meanwhile is found by
+ * listing them again. The application may have been stopped with SIGSTOP
+ * by the lazy stub, the stop is not passed on and the application continued
+ */
+void PDBNativeAgent::attach(pid_t target) {
+  pid = target;
+  attached = true;
+  state = State::Running;
+
+  auto tasks = "/proc/" + std::to_string(target) + "/task";
+  for (bool found = true; found;) {
+    found = false;
+    DIR *dir = ::opendir(tasks.c_str());
+    if (!dir)
+      throwErrno("Error listing threads of " + std::to_string(target) + ": ");
+
+    while (auto *entry = ::readdir(dir)) {
+      pid_t tid = std::atoi(entry->d_name);
+      if (tid <= 0 || threads.count(tid))
+        continue;
+      if (::ptrace(PTRACE_SEIZE, tid, nullptr, PTRACE_O_TRACECLONE) < 0)
+        continue;
+      addThread(tid, false);
+      ::ptrace(PTRACE_INTERRUPT, tid, nullptr, 0);
+      found = true;
+    }
+    ::closedir(dir);
+  }
+
+  if (threads.empty())
+    throwErrno("Error attaching to " + std::to_string(target) + ": ");
+  if (!stopAll())
+    throw std::runtime_error("The application has exited");
+
+  current = pid;
+  for (auto &[tid, thread] : threads) {
+    if (thread.signal == SIGSTOP)
+      thread.signal = 0;
+    if (isFault(thread.signal))
+      current = tid;
+  }
+  ::kill(pid, SIGCONT);
+
+  bias = loadBias();
+  insertSites();
+  state = State::Stopped;
+}
+
+void PDBNativeAgent::finish() {
+  if (pid <= 0)
+    return;
+
+  if (!attached) {
+    ::kill(pid, SIGKILL);
+    int status;
+    pid_t tid;
+    while ((tid = ::waitpid(-1, &status, __WALL)) > 0 || errno == EINTR) {
+      if (tid == pid && (WIFEXITED(status) || WIFSIGNALED(status)))
+        break;
+    }
+    return;
+  }
+
+  if (state == State::Running && !stopAll())
+    return;
+  for (auto &[address, site] : sites) {
+    if (site.inserted)
+      writeSite(address, site, false);
+  }
+  for (auto &[tid, thread] : threads)
+    ::ptrace(PTRACE_DETACH, tid, nullptr, thread.signal);
+}
+
+void PDBNativeAgent::addThread(pid_t tid, bool stopped) {
+  auto &thread = threads.emplace(tid, Thread{next_thread_id, false, 0})
+                     .first->second;
+  if (thread.id == next_thread_id)
+    next_thread_id++;
+  thread.stopped = stopped;
+}
+
+void PDBNativeAgent::reap() {
+  int status;
+  pid_t tid;
+  while (state != State::Idle &&
+         (tid = ::waitpid(-1, &status, WNOHANG | __WALL)) > 0) {
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+      handleExit(tid, status);
+    else
+      handleStop(tid, status);
+  }
+
+  serveCommands();
+}
+
+void PDBNativeAgent::handleStop(pid_t tid, int status) {
+  // Threads starting while the application is stopped stay stopped
+  if (state != State::Running) {
+    noteStop(tid, status);
+    return;
+  }
+
+  if (!threads.count(tid))
+    addThread(tid, true);
+  auto &thread = threads.at(tid);
+  thread.stopped = true;
+
+  auto resumeThread = [&](int sig) {
+    ::ptrace(PTRACE_CONT, tid, nullptr, sig);
+    thread.stopped = false;
+  };
+
+  int event = status >> 16;
+  int sig = WSTOPSIG(status);
+  if (event == PTRACE_EVENT_CLONE) {
+    unsigned long child;
+    if (::ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &child) == 0 &&
+        !threads.count(static_cast<pid_t>(child)))
+      addThread(static_cast<pid_t>(child), false);
+    resumeThread(0);
+    return;
+  }
+
+  // New threads start stopped, interrupts may still be pending from a stop
+  if (event != 0) {
+    resumeThread(0);
+    return;
+  }
+
+  if (sig == SIGTRAP) {
+    auto regs = registers(tid);
+    auto site = sites.find(regs.rip - 1);
+    if (site != sites.end() && site->second.inserted) {
+      auto address = site->first;
+      setPC(tid, address);
+
+      if (site->second.users > 0) {
+        if (stopAll())
+          reportHit(tid, address);
+        return;
+      }
+
+      // The step-resume breakpoint only counts once the call has returned,
+      // a recursive call passes it on a deeper stack
+      if (step && tid == step->tid && regs.rsp > step->call_sp) {
+        if (!stopAll())
+          return;
+        removeSite(address);
+        step->return_site = 0;
+
+        // The call may have been the last instruction of the line
+        if (!leftLine(address)) {
+          continueStep();
+          return;
+        }
+        step.reset();
+        current = tid;
+        reportStop("reason=\"end-stepping-range\"");
+        return;
+      }
+
+      if (stepOver(tid))
+        resumeThread(0);
+      return;
+    }
+  }
+
+  if (isFault(sig)) {
+    thread.signal = sig;
+    if (!stopAll())
+      return;
+    endStep();
+    current = tid;
+    reportStop("reason=\"signal-received\",signal-name=\"" + signalName(sig) +
+               "\"");
+    return;
+  }
+
+  resumeThread(sig);
+}
+
+bool PDBNativeAgent::handleExit(pid_t tid, int status) {
+  threads.erase(tid);
+  if (tid != pid)
+    return false;
+
+  reportExit(status);
+  return true;
+}
+
+/**
+ * Stop every thread still running and wait for all of them. A thread that
+ * hits a breakpoint meanwhile is moved back onto it, it hits it again once
+ * resumed. Signals are kept to be delivered then
+ */
+bool PDBNativeAgent::stopAll() {
+  for (auto &[tid, thread] : threads) {
+    if (!thread.stopped)
+      ::ptrace(PTRACE_INTERRUPT, tid, nullptr, 0);
+  }
+
+  auto running = [this]() {
+    return std::any_of(threads.begin(), threads.end(),
+                       [](auto &thread) { return !thread.second.stopped; });
+  };
+
+  while (state != State::Idle && running()) {
+    int status;
+    pid_t tid = ::waitpid(-1, &status, __WALL);
+    if (tid < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (handleExit(tid, status))
+        return false;
+      continue;
+    }
+    noteStop(tid, status);
+  }
+
+  return state != State::Idle;
+}
+
+void PDBNativeAgent::noteStop(pid_t tid, int status) {
+  if (!threads.count(tid))
+    addThread(tid, true);
+  auto &thread = threads.at(tid);
+  thread.stopped = true;
+
+  int event = status >> 16;
+  int sig = WSTOPSIG(status);
+  if (event == PTRACE_EVENT_CLONE) {
+    unsigned long child;
+    if (::ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &child) == 0 &&
+        !threads.count(static_cast<pid_t>(child)))
+      addThread(static_cast<pid_t>(child), false);
+    return;
+  }
+  if (event != 0)
+    return;
+
+  if (sig == SIGTRAP) {
+    auto pc = registers(tid).rip - 1;
+    auto site = sites.find(pc);
+    if (site != sites.end() && site->second.inserted)
+      setPC(tid, pc);
+    return;
+  }
+  thread.signal = sig;
+}
+
+bool PDBNativeAgent::singleStep(pid_t tid) {
+  auto &thread = threads.at(tid);
+  if (::ptrace(PTRACE_SINGLESTEP, tid, nullptr, 0) < 0)
+    return false;
+  thread.stopped = false;
+  thread.on_hit = false;
+
+  for (;;) {
+    int status;
+    if (::waitpid(tid, &status, __WALL) < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      handleExit(tid, status);
+      return false;
+    }
+
+    int event = status >> 16;
+    int sig = WSTOPSIG(status);
+    if (event == 0 && sig == SIGTRAP)
+      break;
+
+    if (event == PTRACE_EVENT_CLONE) {
+      unsigned long child;
+      if (::ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &child) == 0 &&
+          !threads.count(static_cast<pid_t>(child)))
+        addThread(static_cast<pid_t>(child), false);
+    } else if (event == 0) {
+      // Delivered on resume, a fault ends the step right here
+      thread.signal = sig;
+      if (isFault(sig))
+        break;
+    }
+    ::ptrace(PTRACE_SINGLESTEP, tid, nullptr, 0);
+  }
+
+  thread.stopped = true;
+  return true;
+}
+
+// Execute one instruction of a stopped thread, a breakpoint on it lifted
+bool PDBNativeAgent::stepOver(pid_t tid) {
+  auto pc = registers(tid).rip;
+  auto site = sites.find(pc);
+  if (site == sites.end() || !site->second.inserted)
+    return singleStep(tid);
+
+  writeSite(pc, site->second, false);
+  if (!singleStep(tid))
+    return false;
+
+  site = sites.find(pc);
+  if (site != sites.end())
+    writeSite(pc, site->second, true);
+  return true;
+}
+
+// A thread resumed from a breakpoint it has reported does not hit it again,
+// any other thread on a breakpoint hits it once resumed
+void PDBNativeAgent::continueAll() {
+  if (threads.count(current) && threads.at(current).stopped &&
+      threads.at(current).on_hit) {
+    auto site = sites.find(registers(current).rip);
+    if (site != sites.end() && site->second.inserted && !stepOver(current)) {
+      if (state == State::Idle)
+        return;
+    }
+  }
+
+  for (auto &[tid, thread] : threads) {
+    if (!thread.stopped)
+      continue;
+    ::ptrace(PTRACE_CONT, tid, nullptr, thread.signal);
+    thread.signal = 0;
+    thread.stopped = false;
+    thread.on_hit = false;
+  }
+  state = State::Running;
+  modules_stale = true;
+}
+
+void PDBNativeAgent::insertSites() {
+  sites.clear();
+  for (auto &breakpoint : breakpoints) {
+    for (auto address : breakpoint.addresses)
+      insertSite(address + bias, false);
+  }
+}
+
+void PDBNativeAgent::insertSite(std::uint64_t address, bool temporary) {
+  auto &site = sites[address];
+  if (temporary)
+    site.temporary = true;
+  else
+    site.users++;
+
+  if (!site.inserted)
+    writeSite(address, site, true);
+}
+
+void PDBNativeAgent::removeSite(std::uint64_t address) {
+  auto site = sites.find(address);
+  if (site == sites.end())
+    return;
+
+  site->second.temporary = false;
+  if (site->second.users > 0)
+    return;
+  if (site->second.inserted)
+    writeSite(address, site->second, false);
+  sites.erase(site);
+}
+
+void PDBNativeAgent::writeSite(std::uint64_t address, Site &site,
+                               bool insert) {
+  auto *at = reinterpret_cast<void *>(address);
+  errno = 0;
+  long word = ::ptrace(PTRACE_PEEKTEXT, tracee(), at, nullptr);
+  if (errno != 0)
+    return;
+
+  if (insert)
+    site.original = static_cast<std::uint8_t>(word & 0xff);
+  word = (word & ~0xffL) | (insert ? 0xcc : site.original);
+  if (::ptrace(PTRACE_POKETEXT, tracee(), at, word) == 0)
+    site.inserted = insert;
+}
+
+pid_t PDBNativeAgent::tracee() const {
+  for (auto &[tid, thread] : threads) {
+    if (thread.stopped)
+      return tid;
+  }
+  return pid;
+}
+
+user_regs_struct PDBNativeAgent::registers(pid_t tid) const {
+  user_regs_struct regs{};
+  ::ptrace(PTRACE_GETREGS, tid, nullptr, &regs);
+  return regs;
+}
+
+void PDBNativeAgent::setPC(pid_t tid, std::uint64_t pc) const {
+  auto regs = registers(tid);
+  regs.rip = pc;
+  ::ptrace(PTRACE_SETREGS, tid, nullptr, &regs);
+}
+
+bool PDBNativeAgent::peek(std::uint64_t address, std::uint64_t &word) const {
+  errno = 0;
+  long value = ::ptrace(PTRACE_PEEKDATA, tracee(),
+                        reinterpret_cast<void *>(address), nullptr);
+  if (errno != 0)
+    return false;
+  word = static_cast<std::uint64_t>(value);
+  return true;
+}
+
+// Where the executable is loaded, from the entry point the kernel reports
+std::uint64_t PDBNativeAgent::loadBias() const {
+  std::ifstream auxv("/proc/" + std::to_string(pid) + "/auxv",
+                     std::ios::binary);
+  std::uint64_t entry[2];
+  while (auxv.read(reinterpret_cast<char *>(entry), sizeof(entry))) {
+    if (entry[0] == AT_ENTRY)
+      return entry[1] - exec_entry;
+    if (entry[0] == AT_NULL)
+      break;
+  }
+  return 0;
+}
+
+std::optional<PDBNativeAgent::Function>
+PDBNativeAgent::findFunction(std::uint64_t address) {
+  // Stops are mostly in the executable, which needs no look at /proc
+  if (auto *entry = exec_symbols->find(address - bias))
+    return Function{entry->name, entry->start + bias, ""};
+
+  if (pid > 0 && modules_stale)
+    readModules();
+  for (auto &module : modules) {
+    if (address < module.start || address >= module.end || !module.symbols)
+      continue;
+    if (auto *entry = module.symbols->find(address - module.bias))
+      return Function{entry->name, entry->start + module.bias, module.path};
+    return std::nullopt;
+  }
+  return std::nullopt;
+}
+
+std::optional<std::pair<std::size_t, std::string>>
+PDBNativeAgent::findLocation(std::uint64_t address) const {
+  auto location = index->getAddressLocation(address - bias);
+  if (!location)
+    return std::nullopt;
+  return *location;
+}
+
+// Address just past a call instruction of a known function
+bool PDBNativeAgent::isReturnAddress(std::uint64_t address) {
+  std::uint64_t word;
+  if (address < 8 || !findFunction(address) || !peek(address - 8, word))
+    return false;
+
+  std::uint8_t code[8];
+  std::memcpy(code, &word, sizeof(code));
+  auto indirect = [&](std::size_t at) {
+    return code[at] == 0xff && ((code[at + 1] >> 3) & 7) == 2;
+  };
+  return code[3] == 0xe8 || indirect(6) || indirect(5) || indirect(2) ||
+         indirect(1);
+}
+
+void PDBNativeAgent::readModules() {
+  modules_stale = false;
+  modules.clear();
+
+  std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+  std::map<std::string, std::uint64_t> loaded_at;
+  std::string line;
+  while (std::getline(maps, line)) {
+    std::istringstream fields(line);
+    std::string range, perms, offset, device, inode, path;
+    fields >> range >> perms >> offset >> device >> inode >> path;
+    if (path.empty() || path[0] != '/')
+      continue;
+
+    auto dash = range.find('-');
+    auto start = std::stoull(range.substr(0, dash), nullptr, 16);
+    auto end = std::stoull(range.substr(dash + 1), nullptr, 16);
+    if (std::stoull(offset, nullptr, 16) == 0 && !loaded_at.count(path))
+      loaded_at[path] = start;
+    if (perms.size() < 3 || perms[2] != 'x')
+      continue;
+
+    auto &symbols = module_symbols[path];
+    if (!symbols)
+      symbols = Symbols::load(path);
+    auto base = loaded_at.count(path) ? loaded_at[path] : start;
+    modules.push_back({start, end,
+                       base - (symbols ? symbols->first_load : 0), path,
+                       symbols});
+  }
+}
+
+std::vector<std::uint64_t> PDBNativeAgent::unwind(pid_t tid) {
+  auto regs = registers(tid);
+  Frame frame{regs.rip, regs.rsp, regs.rbp};
+
+  std::vector<std::uint64_t> pcs{frame.pc};
+  while (pcs.size() < max_frames) {
+    auto caller = callerOf(frame);
+    if (!caller)
+      break;
+    pcs.push_back(caller->pc);
+    frame = *caller;
+  }
+  return pcs;
+}
+
+/**
+ * A function with the standard prologue has its return address next to the
+ * saved frame pointer, unless the frame is not set up yet or torn down
+ * already. Past code without frame pointers, the first return address up the
+ * stack is taken, and the frame pointer of a caller with the prologue is
+ * found as a saved one next to a return address. Like gdb, unwinding ends
+ * at main
+ */
+std::optional<PDBNativeAgent::Frame>
+PDBNativeAgent::callerOf(const Frame &frame) {
+  auto function = findFunction(frame.pc);
+  if (function && function->name == "main")
+    return std::nullopt;
+
+  std::uint64_t prologue[2] = {0, 0}, at_pc = 0;
+  if (function) {
+    peek(function->entry, prologue[0]);
+    peek(function->entry + 8, prologue[1]);
+  }
+  peek(frame.pc, at_pc);
+  std::uint8_t code[16];
+  std::memcpy(code, prologue, sizeof(code));
+
+  // endbr64, push %rbp, mov %rsp,%rbp
+  std::size_t push = std::memcmp(code, "\xf3\x0f\x1e\xfa", 4) == 0 ? 4 : 0;
+  bool framed = function && code[push] == 0x55 &&
+                std::memcmp(code + push + 1, "\x48\x89\xe5", 3) == 0;
+
+  if (framed) {
+    auto offset = frame.pc - function->entry;
+    std::uint64_t slot = 0, fp = 0;
+    bool known = true;
+    if (offset <= push || (at_pc & 0xff) == 0xc3) {
+      slot = frame.sp;
+      fp = frame.fp.value_or(0);
+    } else if (offset < push + 4) {
+      slot = frame.sp + 8;
+      known = peek(frame.sp, fp);
+    } else if (frame.fp) {
+      slot = *frame.fp + 8;
+      known = peek(*frame.fp, fp);
+    } else {
+      known = false;
+      for (auto at = frame.sp; at < frame.sp + scan_limit; at += 8) {
+        std::uint64_t saved, ret;
+        if (peek(at, saved) && peek(at + 8, ret) &&
+            (saved == 0 || saved > at) && isReturnAddress(ret)) {
+          slot = at + 8;
+          known = peek(at, fp);
+          break;
+        }
+      }
+    }
+
+    std::uint64_t ret;
+    if (known && peek(slot, ret) && isReturnAddress(ret))
+      return Frame{ret, slot + 8, fp};
+  }
+
+  for (auto at = frame.sp; at < frame.sp + scan_limit; at += 8) {
+    std::uint64_t ret;
+    if (!peek(at, ret))
+      break;
+    if (isReturnAddress(ret))
+      return Frame{ret, at + 8, std::nullopt};
+  }
+  return std::nullopt;
+}
+
+/**
+ * Fields of a frame tuple. A caller is at the instruction after its call,
+ * its line is the one of the call
+ */
+std::string PDBNativeAgent::frameTuple(std::uint64_t pc, bool caller) {
+  auto function = findFunction(pc);
+  std::string tuple = "addr=\"" + hex(pc) +
+                      "\",func=" + quote(function ? function->name : "??");
+
+  if (function && !function->module.empty())
+    return tuple + ",from=" + quote(function->module);
+
+  auto location = findLocation(caller ? pc - 1 : pc);
+  if (location) {
+    tuple += ",file=" + quote(baseName(location->second)) +
+             ",fullname=" + quote(location->second) + ",line=\"" +
+             std::to_string(location->first) + "\"";
+  }
+  return tuple;
+}
+
+void PDBNativeAgent::reportStop(const std::string &reason) {
+  state = State::Stopped;
+
+  std::string record = "*stopped,";
+  if (!reason.empty())
+    record += reason + ",";
+  record += "frame={" + frameTuple(registers(current).rip, false) +
+            ",args=[]},thread-id=\"" + std::to_string(threads.at(current).id) +
+            "\",stopped-threads=\"all\"";
+  send(record + "\n(gdb) \n");
+}
+
+// Every thread is stopped, tid on the breakpoint at address
+void PDBNativeAgent::reportHit(pid_t tid, std::uint64_t address) {
+  auto hit = std::find_if(
+      breakpoints.begin(), breakpoints.end(), [&](auto &breakpoint) {
+        auto &addresses = breakpoint.addresses;
+        return std::find(addresses.begin(), addresses.end(), address - bias) !=
+               addresses.end();
+      });
+
+  endStep();
+  current = tid;
+  threads.at(tid).on_hit = true;
+  reportStop("reason=\"breakpoint-hit\",disp=\"keep\",bkptno=\"" +
+             std::to_string(hit != breakpoints.end() ? hit->number : 0) +
+             "\"");
+}
+
+// Same records gdb prints once its inferior has exited
+void PDBNativeAgent::reportExit(int status) {
+  std::string record = "*stopped,reason=";
+  if (WIFSIGNALED(status)) {
+    record += "\"exited-signalled\",signal-name=\"" +
+              signalName(WTERMSIG(status)) + "\"";
+  } else if (WEXITSTATUS(status) == 0) {
+    record += "\"exited-normally\"";
+  } else {
+    char code[8];
+    std::snprintf(code, sizeof(code), "%02o", WEXITSTATUS(status));
+    record += "\"exited\",exit-code=\"" + std::string(code) + "\"";
+  }
+  send(record + "\n(gdb) \n");
+
+  state = State::Idle;
+  pid = -1;
+  current = -1;
+  attached = false;
+  threads.clear();
+  sites.clear();
+  step.reset();
+  modules.clear();
+  modules_stale = true;
+}
+
+void PDBNativeAgent::send(const std::string &text) {
+  std::size_t written = 0;
+  while (written < text.size()) {
+    auto n = ::write(STDOUT_FILENO, text.data() + written,
+                     text.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return;
+    written += n;
+  }
+}
+} // namespace pdb
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <PDB_DWARF_Handlers.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <vector>
+
+namespace pdb {
+/**
+ * Debugger of one rank that traces the application with ptrace itself, run
+ * by pdb_launch in place of gdb, see NativeDebugger. Breakpoints are int3
+ * instructions patched into the application, stops are resolved to source
+ * positions through the DwarfIndex line tables of the executable and to
+ * functions through the ELF symbols of the modules mapped. A stop is
+ * reported as soon as waitpid returns it. The index is mapped from the
+ * shared cache, so the agents of a node share it. With LLVM linked
+ * statically an agent takes about 6 MB of proportional set size, about 4 MB
+ * of it private dirty pages.
+ *
+ * The agent speaks the part of GDB/MI pdb_man uses, so relays, events and
+ * the lazy stub work with it unchanged: -break-insert, r, -exec-continue,
+ * -exec-next, -stack-list-frames and quit. Expressions are not evaluated.
+ * Commands sent while the application runs are served once it stops, as gdb
+ * does in synchronous mode.
+ *
+ * Like gdb in all-stop mode, every thread is stopped when one of them stops.
+ * Stacks are unwound along frame pointers and, through code built without
+ * them, by scanning for return addresses, so frames are exact only in code
+ * built with -O0 or -fno-omit-frame-pointer. x86-64 only.
+ */
+class PDBNativeAgent {
+public:
+  /**
+   * @param exec - application, started by "r"
+   * @param attach_pid - process to attach to instead, -1 to start exec
+   */
+  PDBNativeAgent(std::string exec, pid_t attach_pid);
+  PDBNativeAgent(const PDBNativeAgent &) = delete;
+  ~PDBNativeAgent();
+
+  // Serve commands on standard input until "quit" or its end
+  void run();
+
+private:
+  // Functions of one module, sorted by address as linked
+  struct Symbols;
+
+  enum class State {
+    Idle,    // No application
+    Stopped, // Every thread is stopped
+    Running
+  };
+
+  struct Thread {
+    int id; // Thread number as gdb would give it
+    bool stopped = false;
+    int signal = 0;      // Delivered when the thread is resumed
+    bool on_hit = false; // On a breakpoint reported hit, stepped over first
+  };
+
+  // As set by -break-insert, addresses as linked
+  struct Breakpoint {
+    int number;
+    std::string file;
+    std::size_t line;
+    std::vector<std::uint64_t> addresses;
+  };
+
+  // int3 at a runtime address, shared by every breakpoint placed there
+  struct Site {
+    std::uint8_t original = 0;
+    int users = 0;          // Breakpoints placed at the address
+    bool temporary = false; // Step-resume breakpoint of a "next"
+    bool inserted = false;
+  };
+
+  // "next" in progress
+  struct Step {
+    pid_t tid;
+    std::size_t line;
+    std::string file;
+    std::uint64_t return_site = 0; // Step-resume breakpoint, 0 if none
+    std::uint64_t call_sp = 0;     // Stack pointer at the call it returns from
+  };
+
+  struct Function {
+    std::string name;
+    std::uint64_t entry;
+    std::string module; // Shared object, empty for the executable
+  };
+
+  // Executable range of a module, symbols queried at address - bias
+  struct Module {
+    std::uint64_t start;
+    std::uint64_t end;
+    std::uint64_t bias;
+    std::string path;
+    std::shared_ptr<const Symbols> symbols;
+  };
+
+  struct Frame {
+    std::uint64_t pc;
+    std::uint64_t sp;
+    std::optional<std::uint64_t> fp; // Frame pointer, if known
+  };
+
+  std::string exec;
+  std::unique_ptr<DwarfIndex> index;
+  std::shared_ptr<const Symbols> exec_symbols;
+  std::uint64_t exec_entry = 0; // Entry point as linked
+
+  State state = State::Idle;
+  bool attached = false; // Detached from, not killed, on quit
+  bool quit = false;
+  pid_t pid = -1;
+  std::uint64_t bias = 0; // Load address minus link address of exec
+  std::map<pid_t, Thread> threads;
+  int next_thread_id = 1;
+  pid_t current = -1; // Thread reported stopped last
+
+  std::vector<Breakpoint> breakpoints;
+  std::map<std::uint64_t, Site> sites;
+  std::optional<Step> step;
+
+  // Modules other than exec, read from /proc once an address needs them
+  std::vector<Module> modules;
+  bool modules_stale = true;
+  std::map<std::string, std::shared_ptr<const Symbols>> module_symbols;
+
+  int signal_fd = -1;
+  std::string input;
+
+  void readCommands();
+  void serveCommands();
+  void command(const std::string &line);
+  void breakInsert(const std::string &args);
+  void start(const std::string &args);
+  void resume();
+  void next();
+  void listFrames();
+  void attach(pid_t target);
+  void finish();
+
+  void addThread(pid_t tid, bool stopped);
+  void reap();
+  void handleStop(pid_t tid, int status);
+  bool handleExit(pid_t tid, int status); // True if the application is gone
+  bool stopAll();                         // False if the application is gone
+  void noteStop(pid_t tid, int status);
+  bool singleStep(pid_t tid);
+  bool stepOver(pid_t tid);
+  void continueAll();
+  void continueStep();
+  bool leftLine(std::uint64_t pc) const; // On a line other than the stepped
+  void endStep();
+
+  void insertSites();
+  void insertSite(std::uint64_t address, bool temporary);
+  void removeSite(std::uint64_t address); // Only the step-resume use of it
+  void writeSite(std::uint64_t address, Site &site, bool insert);
+
+  pid_t tracee() const; // A stopped thread, memory is accessed through it
+  user_regs_struct registers(pid_t tid) const;
+  void setPC(pid_t tid, std::uint64_t pc) const;
+  bool peek(std::uint64_t address, std::uint64_t &word) const;
+  std::uint64_t loadBias() const;
+
+  std::optional<Function> findFunction(std::uint64_t address);
+  std::optional<std::pair<std::size_t, std::string>>
+  findLocation(std::uint64_t address) const;
+  bool isReturnAddress(std::uint64_t address);
+  void readModules();
+
+  std::vector<std::uint64_t> unwind(pid_t tid);
+  std::optional<Frame> callerOf(const Frame &frame);
+  std::string frameTuple(std::uint64_t pc, bool caller);
+
+  void reportStop(const std::string &reason);
+  void reportHit(pid_t tid, std::uint64_t address);
+  void reportExit(int status);
+
+  static void send(const std::string &text);
+};
+} // namespace pdb
@@ -0,0 +1,62 @@
+/**
+ *  Measures the throughput of the GDB/MI parser
+ *
+ *  pdb_parse_bench <transcript>...
+ *  reads each transcript of gdb output, parses it line by line for about a
+ *  second and prints MB/s and records/s. Lines that are not MI, like the
+ *  output of the inferior, are parsed as well. Transcripts of sessions on
+ *  examples/mpi_test.cpp are in examples/transcripts
+ */
+#include <GDBMIParser.hpp>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <transcript>...\n", argv[0]);
+    return 2;
+  }
+
+  std::printf("%-24s %10s %8s %12s %14s\n", "transcript", "bytes", "invalid",
+              "MB/s", "records/s");
+  for (int i = 1; i < argc; i++) {
+    std::ifstream file(argv[i]);
+    if (!file) {
+      std::fprintf(stderr, "Cannot read %s\n", argv[i]);
+      return 1;
+    }
+
+    // Lines as PDBProcess hands them over, without the newline
+    std::vector<std::string> lines;
+    std::size_t bytes = 0;
+    for (std::string line; std::getline(file, line);) {
+      bytes += line.size() + 1;
+      lines.push_back(std::move(line));
+    }
+    if (lines.empty())
+      continue;
+
+    pdb::mi::Parser parser;
+    pdb::mi::Record record;
+    std::size_t rounds = 0, invalid = 0;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < 1.0) {
+      invalid = 0;
+      for (auto &line : lines)
+        invalid += !parser.parse(line, record);
+      rounds++;
+      elapsed = std::chrono::steady_clock::now() - start;
+    }
+
+    std::string name = argv[i];
+    name = name.substr(name.rfind('/') + 1);
+    std::printf("%-24s %10zu %8zu %12.1f %14.0f\n", name.c_str(), bytes,
+                invalid, bytes * rounds / elapsed.count() / 1e6,
+                lines.size() * rounds / elapsed.count());
+  }
+  return 0;
+}
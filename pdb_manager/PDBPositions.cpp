@@ -0,0 +1,79 @@
+#include <PDBPositions.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace pdb {
+PDBProcSet &
+PDBPositionClasses::find(const std::pair<std::size_t, std::string> &position) {
+  key = position.second;
+  key += ':';
+  key += std::to_string(position.first);
+
+  auto [iter, inserted] = class_ids.try_emplace(key, classes.size());
+  if (inserted)
+    classes.push_back({position, PDBProcSet(size)});
+  return classes[iter->second].procs;
+}
+
+void PDBPositionClasses::insert(
+    std::size_t rank, const std::pair<std::size_t, std::string> &position) {
+  find(position).insert(rank);
+}
+
+void PDBPositionClasses::insert(const PDBPositionClass &position_class) {
+  find(position_class.position) |= position_class.procs;
+}
+
+void PDBPositionClasses::merge(std::string_view serialized) {
+  PDBPositionClass position_class;
+
+  while (!serialized.empty()) {
+    auto end = serialized.find('\n');
+    auto line = serialized.substr(0, end);
+    serialized.remove_prefix(end == std::string_view::npos ? serialized.size()
+                                                           : end + 1);
+
+    auto first_tab = line.find('\t');
+    auto second_tab = line.find('\t', first_tab + 1);
+    if (first_tab == std::string_view::npos ||
+        second_tab == std::string_view::npos)
+      throw std::runtime_error("Malformed position classes");
+
+    position_class.position.first =
+        std::stoull(std::string(line.substr(0, first_tab)));
+    position_class.position.second = line.substr(second_tab + 1);
+    position_class.procs = PDBProcSet::parse(
+        std::string(line.substr(first_tab + 1, second_tab - first_tab - 1)),
+        size);
+    insert(position_class);
+  }
+}
+
+std::string PDBPositionClasses::serialize() const {
+  std::string result;
+  for (auto &position_class : classes) {
+    result += std::to_string(position_class.position.first);
+    result += '\t';
+    result += position_class.procs.toString();
+    result += '\t';
+    result += position_class.position.second;
+    result += '\n';
+  }
+  return result;
+}
+
+std::vector<PDBPositionClass> PDBPositionClasses::take() {
+  std::vector<PDBPositionClass> result = std::move(classes);
+  std::sort(result.begin(), result.end(),
+            [](const PDBPositionClass &a, const PDBPositionClass &b) {
+              auto a_count = a.procs.count(), b_count = b.procs.count();
+              if (a_count != b_count)
+                return a_count > b_count;
+              return *a.procs.begin() < *b.procs.begin();
+            });
+
+  classes.clear();
+  class_ids.clear();
+  return result;
+}
+} // namespace pdb
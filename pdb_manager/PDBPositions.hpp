@@ -0,0 +1,51 @@
+#pragma once
+
+#include <PDBProcSet.hpp>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace pdb {
+/**
+ * Ranks stopped at the same source position. Ranks that are not running are
+ * grouped under an empty position, line 0 and no file
+ */
+struct PDBPositionClass {
+  std::pair<std::size_t, std::string> position;
+  PDBProcSet procs;
+};
+
+/**
+ * Groups ranks by position as they are added, one rank or one already
+ * reduced class at a time, so partial results can be merged in any order.
+ */
+class PDBPositionClasses {
+public:
+  // @param size - number of ranks in the job
+  explicit PDBPositionClasses(std::size_t size) : size(size) {}
+
+  void insert(std::size_t rank,
+              const std::pair<std::size_t, std::string> &position);
+  void insert(const PDBPositionClass &position_class);
+
+  // Merge classes serialized by another instance over the same ranks
+  void merge(std::string_view serialized);
+
+  // One class per line, "line\tranks\tfile"
+  std::string serialize() const;
+
+  // @return Classes ordered by size, largest first, then by lowest rank
+  std::vector<PDBPositionClass> take();
+
+private:
+  std::size_t size;
+  std::vector<PDBPositionClass> classes;
+  std::unordered_map<std::string, std::size_t> class_ids;
+  std::string key; // Reused lookup key
+
+  PDBProcSet &find(const std::pair<std::size_t, std::string> &position);
+};
+} // namespace pdb
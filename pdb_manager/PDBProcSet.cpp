@@ -0,0 +1,154 @@
+#include <PDBProcSet.hpp>
+#include <stdexcept>
+
+namespace pdb {
+PDBProcSet::PDBProcSet(std::size_t size) : words((size + 63) / 64, 0), bits(size) {}
+
+PDBProcSet PDBProcSet::all(std::size_t size) {
+  PDBProcSet set(size);
+  if (size > 0)
+    set.insert(0, size - 1);
+  return set;
+}
+
+PDBProcSet PDBProcSet::parse(const std::string &ranks, std::size_t size) {
+  PDBProcSet set(size);
+
+  auto number = [&](std::size_t &pos) {
+    if (pos >= ranks.size() || ranks[pos] < '0' || ranks[pos] > '9')
+      throw std::logic_error("Invalid rank list: " + ranks);
+
+    std::size_t value = 0;
+    while (pos < ranks.size() && ranks[pos] >= '0' && ranks[pos] <= '9') {
+      value = value * 10 + (ranks[pos++] - '0');
+      if (value >= size)
+        break;
+    }
+    if (value >= size)
+      throw std::logic_error("Invalid process identifier in: " + ranks);
+    return value;
+  };
+
+  std::size_t pos = 0;
+  do {
+    auto first = number(pos);
+    auto last = first;
+    if (pos < ranks.size() && ranks[pos] == '-') {
+      pos++;
+      last = number(pos);
+      if (last < first)
+        throw std::logic_error("Invalid rank range in: " + ranks);
+    }
+    set.insert(first, last);
+
+    if (pos == ranks.size())
+      break;
+    if (ranks[pos] != ',')
+      throw std::logic_error("Invalid rank list: " + ranks);
+  } while (++pos <= ranks.size());
+
+  return set;
+}
+
+void PDBProcSet::insert(std::size_t rank) {
+  if (rank < bits)
+    words[rank / 64] |= std::uint64_t(1) << (rank % 64);
+}
+
+// Whole words in the middle of the range are filled at once
+void PDBProcSet::insert(std::size_t first, std::size_t last) {
+  if (bits == 0 || first > last || first >= bits)
+    return;
+  if (last >= bits)
+    last = bits - 1;
+
+  auto first_word = first / 64, last_word = last / 64;
+  auto head = ~std::uint64_t(0) << (first % 64);
+  auto tail = ~std::uint64_t(0) >> (63 - last % 64);
+
+  if (first_word == last_word) {
+    words[first_word] |= head & tail;
+    return;
+  }
+
+  words[first_word] |= head;
+  for (auto i = first_word + 1; i < last_word; i++)
+    words[i] = ~std::uint64_t(0);
+  words[last_word] |= tail;
+}
+
+void PDBProcSet::erase(std::size_t rank) {
+  if (rank < bits)
+    words[rank / 64] &= ~(std::uint64_t(1) << (rank % 64));
+}
+
+bool PDBProcSet::contains(std::size_t rank) const {
+  return rank < bits && (words[rank / 64] >> (rank % 64)) & 1;
+}
+
+std::size_t PDBProcSet::count() const {
+  std::size_t result = 0;
+  for (auto word : words)
+    result += __builtin_popcountll(word);
+  return result;
+}
+
+std::size_t PDBProcSet::next(std::size_t rank) const {
+  std::size_t start = rank == npos ? 0 : rank + 1;
+  if (start >= bits)
+    return bits;
+
+  auto i = start / 64;
+  auto word = words[i] & (~std::uint64_t(0) << (start % 64));
+  while (word == 0) {
+    if (++i == words.size())
+      return bits;
+    word = words[i];
+  }
+
+  return i * 64 + __builtin_ctzll(word);
+}
+
+std::string PDBProcSet::toString() const {
+  std::string result;
+
+  auto rank = next(npos);
+  while (rank < bits) {
+    auto last = rank;
+    while (last + 1 < bits && contains(last + 1))
+      last++;
+
+    if (!result.empty())
+      result += ",";
+    result += std::to_string(rank);
+    if (last > rank)
+      result += "-" + std::to_string(last);
+
+    rank = next(last);
+  }
+
+  return result;
+}
+
+PDBProcSet &PDBProcSet::operator|=(const PDBProcSet &other) {
+  for (std::size_t i = 0; i < words.size() && i < other.words.size(); i++)
+    words[i] |= other.words[i];
+  return *this;
+}
+
+PDBProcSet &PDBProcSet::operator&=(const PDBProcSet &other) {
+  for (std::size_t i = 0; i < words.size(); i++)
+    words[i] &= i < other.words.size() ? other.words[i] : 0;
+  return *this;
+}
+
+PDBProcSet &PDBProcSet::operator-=(const PDBProcSet &other) {
+  for (std::size_t i = 0; i < words.size() && i < other.words.size(); i++)
+    words[i] &= ~other.words[i];
+  return *this;
+}
+
+bool PDBProcSet::operator==(const PDBProcSet &other) const {
+  return bits == other.bits && words == other.words;
+}
+} // namespace pdb
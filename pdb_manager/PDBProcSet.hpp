@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pdb {
+/**
+ * Set of ranks, stored as a bitset over all ranks of a job. A few thousand
+ * ranks take a few hundred bytes, membership and iteration cost one word per
+ * 64 ranks.
+ *
+ * Sets are written as comma separated ranks and inclusive ranges, like
+ * "0-255,512".
+ */
+class PDBProcSet {
+public:
+  PDBProcSet() = default;
+
+  // Empty set over ranks [0, size)
+  explicit PDBProcSet(std::size_t size);
+
+  // Set holding every rank in [0, size)
+  static PDBProcSet all(std::size_t size);
+
+  /**
+   * @param ranks - rank list, like "0-255,512"
+   * @param size - number of ranks in the job
+   * @return Set of the listed ranks. Throws std::logic_error if the list is
+   * malformed or names a rank outside of the job
+   */
+  static PDBProcSet parse(const std::string &ranks, std::size_t size);
+
+  void insert(std::size_t rank);
+  void insert(std::size_t first, std::size_t last); // Inclusive range
+  void erase(std::size_t rank);
+  bool contains(std::size_t rank) const;
+
+  // Number of ranks in the set
+  std::size_t count() const;
+  bool empty() const { return count() == 0; }
+
+  // Number of ranks in the job
+  std::size_t size() const { return bits; }
+
+  /**
+   * @return First rank in the set after the given one, size() if there is
+   * none. Use next(npos) to get the first rank
+   */
+  std::size_t next(std::size_t rank) const;
+  static constexpr std::size_t npos = ~std::size_t(0);
+
+  // Ranks in ascending order, with consecutive ranks collapsed into ranges
+  std::string toString() const;
+
+  PDBProcSet &operator|=(const PDBProcSet &other);
+  PDBProcSet &operator&=(const PDBProcSet &other);
+  PDBProcSet &operator-=(const PDBProcSet &other);
+  bool operator==(const PDBProcSet &other) const;
+  bool operator!=(const PDBProcSet &other) const { return !(*this == other); }
+
+  class iterator {
+  public:
+    iterator(const PDBProcSet *set, std::size_t rank) : set(set), rank(rank) {}
+
+    std::size_t operator*() const { return rank; }
+    iterator &operator++() {
+      rank = set->next(rank);
+      return *this;
+    }
+    bool operator!=(const iterator &other) const { return rank != other.rank; }
+
+  private:
+    const PDBProcSet *set;
+    std::size_t rank;
+  };
+
+  iterator begin() const { return iterator(this, next(npos)); }
+  iterator end() const { return iterator(this, bits); }
+
+private:
+  std::vector<std::uint64_t> words;
+  std::size_t bits = 0;
+};
+} // namespace pdb
@@ -1,54 +1,85 @@
 #include <PDBProcess.hpp>
+#include <PDBRelayLink.hpp>
+#include <cerrno>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
 #include <poll.h>
 #include <stdexcept>
 #include <sys/file.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <system_error>
 #include <vector>
 
 namespace pdb {
-PDBProcess::PDBProcess() : fd_read_desc(io_context), fd_write_desc(io_context) {
-  char tmp_read_file[] = "/tmp/pdbpipeXXXXXXX";
-  char tmp_write_file[] = "/tmp/pdbpipeXXXXXXX";
-
-  fd_read = ::mkstemp(tmp_read_file);
-  if (fd_read < 0)
-    throw std::runtime_error("Error creating temporal read pipe");
-
-  fd_write = ::mkstemp(tmp_write_file);
-  if (fd_write < 0)
-    throw std::runtime_error("Error creating temporal write pipe");
-
-  ::close(fd_read);
-  ::close(fd_write);
-
-  ::unlink(tmp_read_file);
-  ::unlink(tmp_write_file);
+namespace {
+// Write all of msg to a blocking socket, a vanished peer raises no SIGPIPE
+void sendAll(int fd, const std::string &msg) {
+  std::size_t sent = 0;
+  while (sent < msg.size()) {
+    ssize_t n = ::send(fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throw std::system_error(std::error_code(errno, std::generic_category()),
+                              "Error writing to socket");
+    sent += n;
+  }
+}
+} // namespace
 
-  if (::mkfifo(tmp_read_file, 0666) < 0)
-    throw std::runtime_error("Error creating read pipe");
+PDBProcess::PDBProcess(const std::string &read_name,
+                       const std::string &write_name)
+    : transport(PDBTransport::FIFO),
+      channel(std::make_shared<Channel>(PDBReactor::instance().makeStrand())) {
+  if (::mkfifo(read_name.c_str(), 0600) < 0)
+    throw std::runtime_error("Error creating read pipe: " + read_name);
 
-  if (::mkfifo(tmp_write_file, 0666) < 0)
-    throw std::runtime_error("Error creating write pipe");
+  if (::mkfifo(write_name.c_str(), 0600) < 0) {
+    ::unlink(read_name.c_str());
+    throw std::runtime_error("Error creating write pipe: " + write_name);
+  }
 
   // Set them to NULL and open lately, we don't want to block here upon call to
   // open()
   fd_read = fd_write = 0;
 
-  fd_read_name = tmp_read_file;
-  fd_write_name = tmp_write_file;
+  fd_read_name = read_name;
+  fd_write_name = write_name;
+}
+
+PDBProcess::PDBProcess()
+    : transport(PDBTransport::Socket),
+      channel(std::make_shared<Channel>(PDBReactor::instance().makeStrand())) {
+  fd_read = fd_write = 0;
 }
 
 PDBProcess::~PDBProcess() {
-  io_context.stop();
-  reader.join();
+  // Operations left pending would outlive the debugger, they fail right away
+  std::deque<std::shared_ptr<PDBCompletion>> pending;
+  if (channel) {
+    std::lock_guard<std::mutex> lock(channel->completion_mutex);
+    pending.swap(channel->completions);
+  }
+  for (auto &completion : pending)
+    completion->abandon();
+
+  // Descriptors are only touched on the channel strand, close them there too.
+  // A handler still queued sees operation_aborted and drops the channel
+  if (channel) {
+    boost::asio::post(channel->fd_read_desc.get_executor(), [ch = channel]() {
+      boost::system::error_code ec;
+      ch->fd_read_desc.close(ec);
+      ch->fd_write_desc.close(ec);
+    });
+  }
 
-  ::unlink(fd_read_name.c_str());
-  ::unlink(fd_write_name.c_str());
+  if (!fd_read_name.empty())
+    ::unlink(fd_read_name.c_str());
+  if (!fd_write_name.empty())
+    ::unlink(fd_write_name.c_str());
 }
 
 void PDBProcess::openFIFO() {
@@ -60,50 +91,194 @@ void PDBProcess::openFIFO() {
   if (fd_write < 0)
     throw std::runtime_error("Error opening write-end pipe");
 
-  fd_read_desc.assign(fd_read);
-  fd_write_desc.assign(fd_write);
-
-  // Submit a work
-  reader = std::thread([this]() {
-    // Callback to be called whenever we pipe is available for read
-    std::function<void(boost::system::error_code, std::size_t)>
-        async_read_callback = [&](boost::system::error_code ec, std::size_t n) {
-          if (!ec && n > 0) {
-            // Separate strings by newline character and push onto the queue
-            std::string line(local_buffer.begin(), local_buffer.begin() + n);
-            std::string temp;
-            std::stringstream sstream(line);
-
-            while (std::getline(sstream, temp, '\n'))
-              read_queue.push(temp);
-          }
-
-          // This handler would eventuall wake up, and if there's nothing to
-          // read it would return with ec set to boost::asio::error_code::eof.
-          // In this case just do nothing and register another callback
-          fd_read_desc.async_read_some(boost::asio::buffer(local_buffer),
-                                       async_read_callback);
-        };
-
-    // Let it go
-    fd_read_desc.async_read_some(boost::asio::buffer(local_buffer),
-                                 async_read_callback);
-    this->io_context.run();
+  channel->fd_read_desc.assign(fd_read);
+  channel->fd_write_desc.assign(fd_write);
+  channel->fd_read_desc.non_blocking(true);
+
+  // Let it go
+  awaitInput(channel);
+}
+
+/**
+ * A socket stays in blocking mode and is owned by the read descriptor alone.
+ * The reactor reads only once it is readable, commands are sent with blocking
+ * writes on the same descriptor, so one fd serves both directions.
+ */
+void PDBProcess::attachSocket(int fd) {
+  fd_read = fd_write = fd;
+
+  boost::asio::post(channel->fd_read_desc.get_executor(), [ch = channel, fd]() {
+    ch->fd_read_desc.assign(fd);
+    awaitInput(ch);
   });
 }
 
+void PDBProcess::awaitInput(std::shared_ptr<Channel> channel) {
+  auto &desc = channel->fd_read_desc;
+
+  desc.async_wait(
+      boost::asio::posix::stream_descriptor::wait_read,
+      [channel = std::move(channel)](boost::system::error_code ec) {
+        if (ec) {
+          channel->records.close();
+          drainCompletions(channel);
+          return;
+        }
+
+        auto &buffer = PDBReactor::scratch();
+        std::size_t n = channel->fd_read_desc.read_some(
+            boost::asio::buffer(buffer), ec);
+
+        // Spurious wakeup, nothing to read yet
+        if (ec == boost::asio::error::would_block) {
+          awaitInput(std::move(channel));
+          return;
+        }
+
+        // The other end has closed the pipe, wake up whoever waits for input
+        if (ec || n == 0) {
+          channel->records.close();
+          drainCompletions(channel);
+          return;
+        }
+
+        // Lines are framed by the reader, a partial line waits for the rest
+        feedTap(*channel, buffer.data(), n);
+        channel->records.append(buffer.data(), n);
+        drainCompletions(channel);
+
+        awaitInput(std::move(channel));
+      });
+}
+
+void PDBProcess::attachRelay(std::shared_ptr<PDBRelayLink> link,
+                             std::size_t rank) {
+  relay = std::move(link);
+  relay_rank = rank;
+}
+
+void PDBProcess::deliverInput(const char *data, std::size_t n) {
+  feedTap(*channel, data, n);
+  channel->records.append(data, n);
+  drainCompletions(channel);
+}
+
+void PDBProcess::closeInput() {
+  channel->records.close();
+  drainCompletions(channel);
+}
+
+void PDBProcess::setOutputTap(std::function<void(std::string_view)> tap) {
+  channel->tap = std::move(tap);
+}
+
+void PDBProcess::feedTap(Channel &channel, const char *data, std::size_t n) {
+  if (!channel.tap)
+    return;
+
+  std::string_view input(data, n);
+  std::size_t pos = 0;
+  for (auto end = input.find('\n'); end != std::string_view::npos;
+       end = input.find('\n', pos)) {
+    if (channel.tap_partial.empty()) {
+      channel.tap(input.substr(pos, end - pos));
+    } else {
+      channel.tap_partial.append(input.substr(pos, end - pos));
+      channel.tap(channel.tap_partial);
+      channel.tap_partial.clear();
+    }
+    pos = end + 1;
+  }
+
+  channel.tap_partial.append(input.substr(pos));
+}
+
 void PDBProcess::submitCommand(const std::string &msg) {
-  fd_write_desc.write_some(boost::asio::buffer(msg));
+  if (relay) {
+    relay->send(relay_rank, msg);
+    return;
+  }
+
+  if (transport == PDBTransport::Socket) {
+    sendAll(fd_write, msg);
+    return;
+  }
+
+  boost::asio::write(channel->fd_write_desc, boost::asio::buffer(msg));
+}
+
+void PDBProcess::submitAsync(const std::string &command, const std::string &tm,
+                             std::unique_ptr<PDBCompletion> completion) {
+  // Queued before writing, the reply cannot overtake it
+  PDBCompletion *queued = completion.get();
+  {
+    std::lock_guard<std::mutex> lock(channel->completion_mutex);
+    channel->terminator = tm;
+    channel->completions.push_back(std::move(completion));
+  }
+
+  try {
+    submitCommand(command);
+  } catch (...) {
+    // No reply will come, it must not take the reply of a later command
+    std::lock_guard<std::mutex> lock(channel->completion_mutex);
+    if (!channel->completions.empty() &&
+        channel->completions.back().get() == queued)
+      channel->completions.pop_back();
+    throw;
+  }
+
+  // Output may have arrived while nothing was waiting for it
+  drainCompletions(channel);
 }
 
-std::vector<std::string> PDBProcess::fetchByLinesUntil(const std::string &tm) {
-  std::vector<std::string> result;
-  std::string temp;
+void PDBProcess::drainCompletions(const std::shared_ptr<Channel> &channel) {
+  std::unique_lock<std::mutex> lock(channel->completion_mutex);
+  if (channel->draining) {
+    channel->redrain = true;
+    return;
+  }
+  channel->draining = true;
+
+  PDBRecords block;
+  while (!channel->completions.empty()) {
+    // Closed is checked first, a block completed before closing is still fed
+    bool closed = channel->records.isClosed();
+    // Held for the call, the destructor may drop the queue meanwhile
+    auto completion = channel->completions.front();
+
+    if (channel->records.tryTakeUntil(channel->terminator, block)) {
+      // Completions run unlocked, they may issue further operations
+      lock.unlock();
+      bool done = completion->consume(block);
+      lock.lock();
+
+      // The queue may have been emptied by the destructor in the meantime
+      if (done && !channel->completions.empty() &&
+          channel->completions.front() == completion)
+        channel->completions.pop_front();
+      continue;
+    }
 
-  while ((temp = read_queue.pull()) != tm) {
-    result.push_back(temp);
+    if (closed) {
+      channel->completions.pop_front();
+      lock.unlock();
+      completion->abandon();
+      lock.lock();
+      continue;
+    }
+
+    // Input delivered while draining is looked at before leaving
+    if (!channel->redrain)
+      break;
+    channel->redrain = false;
   }
 
-  return result;
+  channel->redrain = false;
+  channel->draining = false;
+}
+
+PDBRecords PDBProcess::fetchByLinesUntil(const std::string &tm) {
+  return channel->records.takeUntil(tm);
 }
 } // namespace pdb
\ No newline at end of file
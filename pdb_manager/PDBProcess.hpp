@@ -1,21 +1,63 @@
 #pragma once
 
+#include <PDBReactor.hpp>
+#include <PDBRecordBuffer.hpp>
 #include <boost/asio.hpp>
 #include <boost/leaf.hpp>
-#include <boost/thread/sync_queue.hpp>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unistd.h>
 #include <utility>
 
 namespace pdb {
+class PDBRelayLink;
+
+/**
+ * How a process handler reaches the debugger of its rank
+ *   FIFO   - a pair of named pipes, opened in rank order by openFIFO
+ *   Socket - one AF_UNIX stream accepted by PDBDebug, see attachSocket
+ *   Mux    - a logical stream over the one connection of the node relay
+ *            serving the rank, see attachRelay
+ */
+enum class PDBTransport { FIFO, Socket, Mux };
+
+/**
+ * Operation waiting for output of its process. Blocks of output are handed
+ * over on the reactor, in order, to the oldest operation still incomplete.
+ * A process going away abandons operations while a block may still be
+ * consumed by another thread, an operation settles only once either way.
+ */
+class PDBCompletion {
+public:
+  virtual ~PDBCompletion() = default;
+
+  // @return true once the operation is complete and wants no more blocks
+  virtual bool consume(const PDBRecords &block) = 0;
+
+  // The process has closed its output before the operation was complete
+  virtual void abandon() = 0;
+};
+
 /**
  * Process handler that creates connections to spawned processes.
  * Does not spawn any process by itself.
  */
 class PDBProcess : std::enable_shared_from_this<PDBProcess> {
 public:
+  /**
+   * Create the named pipes of a process, they are opened later by openFIFO
+   * @param read_name - pipe carrying the output of the process
+   * @param write_name - pipe carrying the input of the process
+   */
+  PDBProcess(const std::string &read_name, const std::string &write_name);
+
+  // Process reached through a socket or a node relay, connected later
   PDBProcess();
   PDBProcess(const PDBProcess &) = delete;
   PDBProcess(PDBProcess &&) = default;
@@ -29,29 +71,98 @@ public:
   };
   void openFIFO();
 
+  /**
+   * Take over a connected socket carrying both directions of the debugger.
+   * Safe to call from a reactor thread
+   */
+  void attachSocket(int fd);
+
+  /**
+   * Route the process through a relay instead of opening its pipes.
+   * Commands are sent through the link, output arrives through deliverInput
+   */
+  void attachRelay(std::shared_ptr<PDBRelayLink> link, std::size_t rank);
+  void deliverInput(const char *data, std::size_t n);
+  void closeInput();
+
+  /**
+   * See every complete line of output, without its newline, as it arrives
+   * and before any reader takes it. Called on the reactor, in order. Must be
+   * set before the process is connected
+   */
+  void setOutputTap(std::function<void(std::string_view)> tap);
+
+  /**
+   * Wait until the process has closed its output
+   * @return false if it is still open at deadline
+   */
+  bool waitClosed(std::chrono::steady_clock::time_point deadline) {
+    return channel->records.waitClosedUntil(deadline);
+  }
+
 protected:
-  // Read a read-end pipe until tm
-  std::vector<std::string> fetchByLinesUntil(const std::string &tm);
+  // Read a read-end pipe until a line equal to tm
+  PDBRecords fetchByLinesUntil(const std::string &tm);
 
   // Issues a write to a process write-end pipe
   void submitCommand(const std::string &);
 
-  boost::sync_queue<std::string> read_queue;
+  /**
+   * Queue completion and issue the command without waiting for its reply.
+   * Output is then framed into blocks ending with a line equal to tm and fed
+   * to the queued completions instead of being left to fetchByLinesUntil, so
+   * a process is driven either this way or by blocking reads at a time.
+   * On error, throws if the command cannot be written
+   */
+  void submitAsync(const std::string &command, const std::string &tm,
+                   std::unique_ptr<PDBCompletion> completion);
 
 private:
+  /**
+   * Channel state shared with pending reactor handlers. A queued handler keeps
+   * it alive, so the process object may go away while a read is in flight.
+   */
+  struct Channel {
+    explicit Channel(const PDBReactor::strand_type &strand)
+        : fd_read_desc(strand), fd_write_desc(strand) {}
+
+    boost::asio::posix::stream_descriptor fd_read_desc;
+    boost::asio::posix::stream_descriptor fd_write_desc; // Unused by a socket
+    PDBRecordBuffer records;
+
+    // Operations waiting for their reply, oldest first
+    std::mutex completion_mutex;
+    std::deque<std::shared_ptr<PDBCompletion>> completions;
+    std::string terminator;
+    bool draining = false;
+    bool redrain = false;
+
+    std::function<void(std::string_view)> tap;
+    std::string tap_partial; // Line not yet complete
+  };
+
+  // Wait on the reactor until the read-end pipe becomes readable
+  static void awaitInput(std::shared_ptr<Channel> channel);
+
+  // Feed complete blocks to pending completions, from whichever thread has
+  // delivered input. One caller drains at a time, others only signal it
+  static void drainCompletions(const std::shared_ptr<Channel> &channel);
+
+  // Hand the complete lines of freshly read output to the tap
+  static void feedTap(Channel &channel, const char *data, std::size_t n);
+
+  PDBTransport transport;
   int fd_read;
-  int fd_write;
+  int fd_write; // Same as fd_read for a socket
 
-  boost::asio::io_context io_context;
+  std::shared_ptr<Channel> channel;
 
-  boost::asio::posix::stream_descriptor fd_read_desc;
-  boost::asio::posix::stream_descriptor fd_write_desc;
-  std::array<char, 4096> local_buffer;
+  // Set if the pipes are owned by a relay
+  std::shared_ptr<PDBRelayLink> relay;
+  std::size_t relay_rank = 0;
 
   // File names for named pipes
   std::string fd_read_name;
   std::string fd_write_name;
-
-  std::thread reader;
 };
 } // namespace pdb
\ No newline at end of file
@@ -0,0 +1,30 @@
+#include <PDBReactor.hpp>
+#include <algorithm>
+
+namespace pdb {
+PDBReactor::PDBReactor(std::size_t threads)
+    : work(boost::asio::make_work_guard(io_context)) {
+  workers.reserve(threads);
+  for (std::size_t i = 0; i < threads; i++)
+    workers.emplace_back([this]() { io_context.run(); });
+}
+
+PDBReactor::~PDBReactor() {
+  work.reset();
+  io_context.stop();
+
+  for (auto &worker : workers)
+    worker.join();
+}
+
+PDBReactor &PDBReactor::instance() {
+  static PDBReactor reactor(
+      std::max<std::size_t>(1, std::thread::hardware_concurrency()));
+  return reactor;
+}
+
+std::vector<char> &PDBReactor::scratch() {
+  static thread_local std::vector<char> buffer(65536);
+  return buffer;
+}
+} // namespace pdb
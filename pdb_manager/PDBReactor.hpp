@@ -0,0 +1,44 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <thread>
+#include <vector>
+
+namespace pdb {
+/**
+ * Event loop shared by every PDBProcess. A small pool of threads, sized to the
+ * number of cores, serves the channels of all ranks, so neither threads nor
+ * read buffers scale with the number of debugged processes.
+ */
+class PDBReactor {
+public:
+  using executor_type = boost::asio::io_context::executor_type;
+  using strand_type = boost::asio::strand<executor_type>;
+
+  PDBReactor(const PDBReactor &) = delete;
+  PDBReactor &operator=(const PDBReactor &) = delete;
+  ~PDBReactor();
+
+  // Process-wide instance, started on first use
+  static PDBReactor &instance();
+
+  /**
+   * Handlers bound to the same strand never run concurrently. Every channel
+   * gets its own strand, distinct channels are served in parallel.
+   */
+  strand_type makeStrand() { return boost::asio::make_strand(io_context); }
+
+  /**
+   * Read buffer of the calling reactor thread. Data is read here and copied
+   * out before the handler returns, so one buffer per thread is enough.
+   */
+  static std::vector<char> &scratch();
+
+private:
+  explicit PDBReactor(std::size_t threads);
+
+  boost::asio::io_context io_context;
+  boost::asio::executor_work_guard<executor_type> work;
+  std::vector<std::thread> workers;
+};
+} // namespace pdb
@@ -0,0 +1,103 @@
+#include <PDBRecordBuffer.hpp>
+#include <cstring>
+#include <stdexcept>
+
+namespace pdb {
+// Initial capacity of the pending buffer, enough for a typical reply
+static constexpr std::size_t initial_capacity = 4096;
+
+void PDBRecordBuffer::append(const char *data, std::size_t n) {
+  // Only a completed line can change the outcome of takeUntil
+  bool has_line = std::memchr(data, '\n', n) != nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.insert(pending.end(), data, data + n);
+  }
+
+  if (has_line)
+    ready.notify_one();
+}
+
+void PDBRecordBuffer::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+  }
+
+  ready.notify_all();
+  closing.notify_all();
+}
+
+PDBRecords PDBRecordBuffer::takeUntil(std::string_view tm) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  PDBRecords records;
+  while (!takeLocked(tm, records)) {
+    if (closed)
+      throw std::runtime_error("Debugger has closed the connection");
+
+    ready.wait(lock);
+  }
+
+  return records;
+}
+
+bool PDBRecordBuffer::tryTakeUntil(std::string_view tm, PDBRecords &records) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return takeLocked(tm, records);
+}
+
+bool PDBRecordBuffer::isClosed() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return closed;
+}
+
+bool PDBRecordBuffer::waitClosedUntil(
+    std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(mutex);
+  return closing.wait_until(lock, deadline, [this]() { return closed; });
+}
+
+bool PDBRecordBuffer::takeLocked(std::string_view tm, PDBRecords &records) {
+  // Resume scanning where the previous wakeup has stopped
+  while (scan_pos < pending.size()) {
+    const char *begin = pending.data() + scan_pos;
+    auto *newline = static_cast<const char *>(
+        std::memchr(begin, '\n', pending.size() - scan_pos));
+    if (newline == nullptr)
+      break;
+
+    std::size_t start = scan_pos;
+    std::size_t length = newline - begin;
+    scan_pos += length + 1;
+
+    if (std::string_view(begin, length) != tm) {
+      spans.emplace_back(start, length);
+      continue;
+    }
+
+    /**
+     * Hand the whole buffer over to the block and keep only what follows
+     * the terminator. The debugger waits for the next command after
+     * printing the terminator, so the remainder is usually empty.
+     */
+    records.storage.swap(pending);
+    pending.reserve(initial_capacity);
+    pending.assign(records.storage.begin() + scan_pos, records.storage.end());
+    records.storage.resize(start);
+
+    records.lines.clear();
+    records.lines.reserve(spans.size());
+    for (auto &span : spans)
+      records.lines.emplace_back(records.storage.data() + span.first,
+                                 span.second);
+
+    spans.clear();
+    scan_pos = 0;
+    return true;
+  }
+
+  return false;
+}
+} // namespace pdb
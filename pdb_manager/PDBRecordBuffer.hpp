@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pdb {
+/**
+ * Block of complete output lines taken out of a PDBRecordBuffer. Lines are
+ * views into storage owned by the block and stay valid as long as the block
+ * lives. Moving a block keeps the views valid, copying is not allowed.
+ */
+class PDBRecords {
+public:
+  using const_iterator = std::vector<std::string_view>::const_iterator;
+
+  PDBRecords() = default;
+  PDBRecords(const PDBRecords &) = delete;
+  PDBRecords(PDBRecords &&) = default;
+  PDBRecords &operator=(const PDBRecords &) = delete;
+  PDBRecords &operator=(PDBRecords &&) = default;
+
+  const_iterator begin() const { return lines.begin(); }
+  const_iterator end() const { return lines.end(); }
+  std::size_t size() const { return lines.size(); }
+  bool empty() const { return lines.empty(); }
+  std::string_view operator[](std::size_t i) const { return lines[i]; }
+
+private:
+  friend class PDBRecordBuffer;
+
+  std::vector<char> storage;
+  std::vector<std::string_view> lines;
+};
+
+/**
+ * Per-channel buffer framing debugger output into lines. The reactor appends
+ * raw reads, a line split across reads is simply completed by the next one.
+ * The reader takes everything up to a terminating line in one block, without
+ * allocating or copying per line.
+ */
+class PDBRecordBuffer {
+public:
+  PDBRecordBuffer() = default;
+  PDBRecordBuffer(const PDBRecordBuffer &) = delete;
+  PDBRecordBuffer &operator=(const PDBRecordBuffer &) = delete;
+
+  // Producer side, called from the reactor with freshly read data
+  void append(const char *data, std::size_t n);
+
+  // No more data will be appended, wake up the reader
+  void close();
+
+  /**
+   * Block until a line equal to tm has arrived and return every line before
+   * it. The terminating line itself is consumed but not returned.
+   * @return On error, throws std::runtime_error if the buffer is closed
+   */
+  PDBRecords takeUntil(std::string_view tm);
+
+  /**
+   * Non-blocking takeUntil, used by the reactor to complete asynchronous
+   * operations
+   * @return false if no terminating line has arrived yet
+   */
+  bool tryTakeUntil(std::string_view tm, PDBRecords &records);
+
+  bool isClosed();
+
+  // Block until the buffer is closed or deadline has passed
+  bool waitClosedUntil(std::chrono::steady_clock::time_point deadline);
+
+private:
+  // Scan pending for tm and cut the block out, mutex must be held
+  bool takeLocked(std::string_view tm, PDBRecords &records);
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::condition_variable closing; // Only woken by close, unlike ready
+
+  // Data not yet handed out, the last line may be incomplete
+  std::vector<char> pending;
+
+  // Complete lines of pending already scanned by takeUntil, as offset/length
+  std::vector<std::pair<std::size_t, std::size_t>> spans;
+  std::size_t scan_pos = 0;
+
+  bool closed = false;
+};
+} // namespace pdb
@@ -0,0 +1,645 @@
+#include <PDBRelay.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace pdb {
+namespace {
+[[noreturn]] void throwErrno(const std::string &what) {
+  throw std::system_error(std::error_code(errno, std::generic_category()),
+                          what);
+}
+
+void setNonBlocking(int fd) {
+  int flags = ::fcntl(fd, F_GETFL);
+  if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    throwErrno("Error setting non-blocking mode: ");
+}
+
+// Blocking read of exactly size bytes, false on end of file
+bool readExactly(int fd, char *data, std::size_t size) {
+  while (size > 0) {
+    auto n = ::read(fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throwErrno("Error reading from peer: ");
+    if (n == 0)
+      return false;
+
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+void closeFd(int &fd) {
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+}
+} // namespace
+
+PDBRelay::PDBRelay(int parent_fd, std::size_t fanout)
+    : fanout(fanout < 2 ? 2 : fanout) {
+  parent.in = parent.out = parent_fd;
+
+  // Children must not inherit the connection, or they would keep it open
+  ::fcntl(parent_fd, F_SETFD, FD_CLOEXEC);
+
+  // A peer that went away is noticed on read, not through a signal
+  ::signal(SIGPIPE, SIG_IGN);
+}
+
+PDBRelay::PDBRelay(int parent_fd, int listener, std::size_t total)
+    : fanout(2), total(total), count(total), listener(listener) {
+  parent.in = parent.out = parent_fd;
+
+  ::fcntl(parent_fd, F_SETFD, FD_CLOEXEC);
+  ::fcntl(listener, F_SETFD, FD_CLOEXEC);
+  setNonBlocking(parent_fd);
+  setNonBlocking(listener);
+
+  ::signal(SIGPIPE, SIG_IGN);
+}
+
+PDBRelay::~PDBRelay() {
+  for (auto &rank : ranks)
+    closeRank(rank);
+
+  for (auto &child : children) {
+    closeFd(child.link.in);
+    if (child.pid > 0)
+      ::waitpid(child.pid, nullptr, 0);
+  }
+
+  closeFd(listener);
+  closeFd(parent.in);
+}
+
+void PDBRelay::setup() {
+  relay::Header header;
+  if (!readExactly(parent.in, reinterpret_cast<char *>(&header),
+                   sizeof(header)) ||
+      header.kind != relay::Kind::Setup)
+    throw std::runtime_error("Relay setup message expected");
+
+  std::string payload(header.length, '\0');
+  if (!readExactly(parent.in, payload.data(), payload.size()))
+    throw std::runtime_error("Relay setup message truncated");
+
+  // "total first count", followed by one "read write" pipe pair per rank
+  std::vector<std::string> pipes;
+  std::size_t pos = 0;
+  while (pos < payload.size()) {
+    auto end = payload.find('\n', pos);
+    if (end == std::string::npos)
+      end = payload.size();
+    pipes.push_back(payload.substr(pos, end - pos));
+    pos = end + 1;
+  }
+
+  if (pipes.empty() ||
+      std::sscanf(pipes[0].c_str(), "%zu %zu %zu", &total, &first, &count) !=
+          3 ||
+      pipes.size() != count + 1 || first + count > total)
+    throw std::runtime_error("Malformed relay setup message");
+  pipes.erase(pipes.begin());
+
+  setNonBlocking(parent.in);
+
+  if (count <= fanout) {
+    openRanks(pipes);
+    return;
+  }
+
+  // Split the range evenly, at most fanout children
+  std::size_t step = (count + fanout - 1) / fanout;
+  children.reserve(fanout);
+  for (std::size_t offset = 0; offset < count; offset += step) {
+    std::size_t child_count = std::min(step, count - offset);
+    std::vector<std::string> child_pipes(pipes.begin() + offset,
+                                         pipes.begin() + offset + child_count);
+    spawnChild(first + offset, child_count, child_pipes);
+  }
+}
+
+void PDBRelay::spawnChild(std::size_t child_first, std::size_t child_count,
+                          const std::vector<std::string> &pipes) {
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+    throwErrno("Error creating relay connection: ");
+
+  pid_t pid = ::fork();
+  if (pid < 0)
+    throwErrno("Error spawning relay: ");
+
+  if (pid == 0) {
+    ::fcntl(fds[1], F_SETFD, 0);
+
+    std::string fanout_arg = std::to_string(fanout);
+    std::string fd_arg = std::to_string(fds[1]);
+    ::execl("/proc/self/exe", "pdb_launch", "--relay", fanout_arg.c_str(),
+            fd_arg.c_str(), static_cast<char *>(nullptr));
+    ::_exit(127);
+  }
+
+  ::close(fds[1]);
+  setNonBlocking(fds[0]);
+
+  Child child;
+  child.link.in = child.link.out = fds[0];
+  child.first = child_first;
+  child.count = child_count;
+  child.pid = pid;
+
+  std::string setup = std::to_string(total) + " " +
+                      std::to_string(child_first) + " " +
+                      std::to_string(child_count) + "\n";
+  for (auto &pipe : pipes)
+    setup += pipe + "\n";
+  child.link.output = relay::makeMessage(relay::Kind::Setup, relay::no_rank,
+                                         setup);
+
+  children.push_back(std::move(child));
+}
+
+/**
+ * Pipes are opened in the same order pdb_launch opens them on the debugger
+ * side, each open blocks until the other end is opened as well.
+ */
+void PDBRelay::openRanks(const std::vector<std::string> &pipes) {
+  ranks.resize(count);
+
+  for (std::size_t i = 0; i < count; i++) {
+    char read_name[256], write_name[256];
+    if (std::sscanf(pipes[i].c_str(), "%255s %255s", read_name, write_name) !=
+        2)
+      throw std::runtime_error("Malformed pipe names: " + pipes[i]);
+
+    auto &rank = ranks[i];
+    rank.rank = first + i;
+    rank_index[rank.rank] = i;
+
+    rank.debugger.in = ::open(read_name, O_RDONLY | O_CLOEXEC);
+    if (rank.debugger.in < 0)
+      throwErrno("Error opening read-end pipe: ");
+
+    rank.debugger.out = ::open(write_name, O_WRONLY | O_CLOEXEC);
+    if (rank.debugger.out < 0)
+      throwErrno("Error opening write-end pipe: ");
+
+    setNonBlocking(rank.debugger.in);
+    setNonBlocking(rank.debugger.out);
+  }
+}
+
+/**
+ * A rank sends its hello right after connecting, so it is read blocking
+ * before the connection joins the others
+ */
+void PDBRelay::acceptRank() {
+  while (true) {
+    int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      throwErrno("Error accepting rank: ");
+    }
+
+    std::uint32_t hello;
+    if (!readExactly(fd, reinterpret_cast<char *>(&hello), sizeof(hello)) ||
+        hello >= total || rank_index.count(hello)) {
+      ::close(fd);
+      continue;
+    }
+    setNonBlocking(fd);
+
+    Rank rank;
+    rank.rank = hello;
+    rank.debugger.in = rank.debugger.out = fd;
+    rank_index[hello] = ranks.size();
+    ranks.push_back(std::move(rank));
+
+    parent.output +=
+        relay::makeMessage(relay::Kind::Attached, hello, std::string());
+  }
+}
+
+PDBRelay::Rank *PDBRelay::findRank(std::size_t rank) {
+  auto iter = rank_index.find(rank);
+  return iter == rank_index.end() ? nullptr : &ranks[iter->second];
+}
+
+void PDBRelay::run() {
+  if (listener < 0)
+    setup();
+
+  std::vector<pollfd> fds;
+  while (true) {
+    fds.clear();
+
+    // Parent first, then children, then debugger input and output of ranks
+    fds.push_back(pollfd{parent.in,
+                         static_cast<short>(POLLIN | (parent.output.empty()
+                                                          ? 0
+                                                          : POLLOUT)),
+                         0});
+    for (auto &child : children) {
+      short events = child.link.in < 0 ? 0 : POLLIN;
+      if (!child.link.output.empty())
+        events |= POLLOUT;
+      fds.push_back(pollfd{child.link.in, events, 0});
+    }
+    for (auto &rank : ranks) {
+      fds.push_back(pollfd{rank.debugger.in, POLLIN, 0});
+      fds.push_back(pollfd{rank.debugger.out,
+                           static_cast<short>(rank.debugger.output.empty()
+                                                  ? 0
+                                                  : POLLOUT),
+                           0});
+    }
+    fds.push_back(pollfd{listener, POLLIN, 0});
+
+    if (::poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      throwErrno("Error polling relay connections: ");
+    }
+
+    std::size_t idx = 0;
+    auto &parent_events = fds[idx++];
+    if (parent_events.revents & (POLLIN | POLLHUP | POLLERR)) {
+      // Parent is gone, the whole subtree shuts down
+      if (!readInto(parent.in, parent.input))
+        return;
+
+      readMessages(parent.input, [&](const relay::Header &header,
+                                     std::string &payload) {
+        handleParent(header, payload);
+      });
+    }
+
+    for (auto &child : children) {
+      auto &events = fds[idx++];
+      if (child.link.in < 0 || !(events.revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+
+      // Messages read along with the end of the stream are still handled
+      bool open = readInto(child.link.in, child.link.input);
+      readMessages(child.link.input, [&](const relay::Header &header,
+                                         std::string &payload) {
+        handleChild(child, header, payload);
+      });
+      if (!open)
+        closeChild(child);
+    }
+
+    for (auto &rank : ranks) {
+      auto &events = fds[idx];
+      idx += 2;
+      if (rank.debugger.in < 0 ||
+          !(events.revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+
+      // The last records of a debugger often come with the end of its output
+      bool open = readInto(rank.debugger.in, rank.debugger.input);
+      handleRank(rank);
+      if (!open)
+        closeRank(rank);
+    }
+
+    // New ranks join only after the loops above, they have no entry in fds
+    if (fds[idx].revents & POLLIN)
+      acceptRank();
+
+    flush(parent);
+    for (auto &child : children)
+      flush(child.link);
+    for (auto &rank : ranks)
+      flush(rank.debugger);
+  }
+}
+
+void PDBRelay::handleParent(const relay::Header &header,
+                            std::string &payload) {
+  switch (header.kind) {
+  case relay::Kind::Data: {
+    if (header.rank < first || header.rank >= first + count)
+      return;
+
+    if (children.empty()) {
+      auto rank = findRank(header.rank);
+      if (rank && rank->debugger.out >= 0)
+        rank->debugger.output += payload;
+      return;
+    }
+
+    for (auto &child : children) {
+      if (header.rank >= child.first &&
+          header.rank < child.first + child.count) {
+        if (child.link.out >= 0)
+          child.link.output +=
+              relay::makeMessage(header.kind, header.rank, payload);
+        return;
+      }
+    }
+    return;
+  }
+  case relay::Kind::StacksRequest:
+  case relay::Kind::PositionsRequest:
+    startQuery(header.kind, payload);
+    return;
+  default:
+    return;
+  }
+}
+
+void PDBRelay::handleChild(Child &child, const relay::Header &header,
+                           std::string &payload) {
+  switch (header.kind) {
+  case relay::Kind::Data:
+  case relay::Kind::Closed:
+    parent.output += relay::makeMessage(header.kind, header.rank, payload);
+    return;
+  case relay::Kind::StacksReply:
+    if (query && query->stacks && child.pending) {
+      query->stacks->merge(payload);
+      child.pending = false;
+      query->waiting--;
+      finishQuery();
+    }
+    return;
+  case relay::Kind::PositionsReply:
+    if (query && query->positions && child.pending) {
+      query->positions->merge(payload);
+      child.pending = false;
+      query->waiting--;
+      finishQuery();
+    }
+    return;
+  default:
+    return;
+  }
+}
+
+// Complete lines are parsed one by one, the rest of a line waits in input
+void PDBRelay::handleRank(Rank &rank) {
+  auto &input = rank.debugger.input;
+  std::string forward;
+  std::size_t pos = 0;
+  mi::Record record;
+
+  while (true) {
+    auto end = input.find('\n', pos);
+    if (end == std::string::npos)
+      break;
+
+    std::string_view line(input.data() + pos, end - pos);
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+
+    parser.parse(line, record);
+    updateState(rank, record);
+
+    bool consumed = false;
+    if (rank.querying) {
+      if (record.kind == mi::RecordKind::Result && !rank.replied &&
+          record.token == rank.token) {
+        // <token>^done,stack=[frame={...},...] or <token>^error
+        for (auto frame : record["stack"]) {
+          PDBFrame entry;
+          entry.func = frame["func"].str();
+          entry.file = frame["fullname"] ? frame["fullname"].str()
+                                         : frame["file"].str();
+          entry.line = static_cast<std::size_t>(frame["line"].toInt());
+          if (entry.func.empty())
+            entry.func = frame["addr"].str();
+          rank.frames.push_back(std::move(entry));
+        }
+        rank.replied = true;
+        consumed = true;
+      } else if (record.kind == mi::RecordKind::Prompt && rank.replied) {
+        rank.querying = false;
+        consumed = true;
+
+        if (query && query->stacks) {
+          if (!rank.frames.empty())
+            query->stacks->insert(rank.rank, rank.frames);
+          query->waiting--;
+          finishQuery();
+        }
+      }
+    }
+
+    if (!consumed)
+      forward.append(input, pos, end + 1 - pos);
+    pos = end + 1;
+  }
+
+  input.erase(0, pos);
+  if (!forward.empty())
+    parent.output += relay::makeMessage(
+        relay::Kind::Data, static_cast<std::uint32_t>(rank.rank), forward);
+}
+
+void PDBRelay::updateState(Rank &rank, const mi::Record &record) {
+  if (record.isResult("running"))
+    rank.running = true;
+
+  if (!record.isExec("stopped"))
+    return;
+
+  if (record["reason"].raw().substr(0, 6) == "exited") {
+    rank.running = false;
+    return;
+  }
+
+  auto frame = record["frame"];
+  if (frame["fullname"] && frame["line"]) {
+    rank.position.first = static_cast<std::size_t>(frame["line"].toInt());
+    rank.position.second = frame["fullname"].str();
+  }
+}
+
+void PDBRelay::closeRank(Rank &rank) {
+  if (rank.debugger.in < 0)
+    return;
+
+  // A rank connected to a node relay reads and writes the same socket
+  if (rank.debugger.out == rank.debugger.in)
+    rank.debugger.out = -1;
+  closeFd(rank.debugger.in);
+  closeFd(rank.debugger.out);
+  rank.debugger.output.clear();
+  rank.running = false;
+
+  parent.output += relay::makeMessage(relay::Kind::Closed,
+                                      static_cast<std::uint32_t>(rank.rank),
+                                      std::string());
+
+  if (rank.querying) {
+    rank.querying = false;
+    if (query) {
+      query->waiting--;
+      finishQuery();
+    }
+  }
+}
+
+// A relay that died takes its ranks with it, they are reported closed
+void PDBRelay::closeChild(Child &child) {
+  closeFd(child.link.in);
+  child.link.out = -1;
+  child.link.output.clear();
+
+  for (std::size_t i = 0; i < child.count; i++) {
+    parent.output += relay::makeMessage(
+        relay::Kind::Closed, static_cast<std::uint32_t>(child.first + i),
+        std::string());
+  }
+
+  if (child.pending) {
+    child.pending = false;
+    if (query) {
+      query->waiting--;
+      finishQuery();
+    }
+  }
+}
+
+void PDBRelay::startQuery(relay::Kind kind, const std::string &payload) {
+  auto procs =
+      payload.empty() ? PDBProcSet(total) : PDBProcSet::parse(payload, total);
+
+  query = std::make_unique<Query>();
+  if (kind == relay::Kind::StacksRequest) {
+    query->kind = relay::Kind::StacksReply;
+    query->stacks = std::make_unique<PDBStackTree>(total);
+  } else {
+    query->kind = relay::Kind::PositionsReply;
+    query->positions = std::make_unique<PDBPositionClasses>(total);
+  }
+
+  // Children are asked first, so they work while this relay does its part
+  for (auto &child : children) {
+    auto next = procs.next(child.first == 0 ? PDBProcSet::npos
+                                            : child.first - 1);
+    if (child.link.out < 0 || next >= child.first + child.count)
+      continue;
+
+    child.link.output += relay::makeMessage(kind, relay::no_rank, payload);
+    child.pending = true;
+    query->waiting++;
+  }
+
+  for (auto &rank : ranks) {
+    if (!procs.contains(rank.rank))
+      continue;
+
+    if (query->positions) {
+      if (rank.running)
+        query->positions->insert(rank.rank, rank.position);
+      else
+        query->positions->insert(rank.rank,
+                                 std::make_pair(std::size_t(0), std::string()));
+      continue;
+    }
+
+    // Only a started process has a stack, like GDBDebugger::submitStack
+    if (rank.debugger.out < 0 || !rank.running)
+      continue;
+
+    rank.token = std::to_string(++next_token);
+    rank.debugger.output += rank.token + "-stack-list-frames\n";
+    rank.querying = true;
+    rank.replied = false;
+    rank.frames.clear();
+    query->waiting++;
+  }
+
+  finishQuery();
+}
+
+void PDBRelay::finishQuery() {
+  if (!query || query->waiting > 0)
+    return;
+
+  std::string reply = query->stacks ? query->stacks->serialize()
+                                    : query->positions->serialize();
+  parent.output += relay::makeMessage(query->kind, relay::no_rank, reply);
+  query.reset();
+}
+
+// Append whatever is available, false once the other end is closed
+bool PDBRelay::readInto(int fd, std::string &input) {
+  char buffer[65536];
+
+  while (true) {
+    auto n = ::read(fd, buffer, sizeof(buffer));
+    if (n > 0) {
+      input.append(buffer, n);
+      continue;
+    }
+    if (n == 0)
+      return false;
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return true;
+    return false;
+  }
+}
+
+void PDBRelay::flush(Endpoint &endpoint) {
+  std::size_t written = 0;
+
+  while (endpoint.out >= 0 && written < endpoint.output.size()) {
+    auto n = ::write(endpoint.out, endpoint.output.data() + written,
+                     endpoint.output.size() - written);
+    if (n > 0) {
+      written += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+
+    // Peer is gone, its end is cleaned up when the read side notices
+    written = endpoint.output.size();
+  }
+
+  endpoint.output.erase(0, written);
+}
+
+template <typename Handler>
+void PDBRelay::readMessages(std::string &input, Handler &&handle) {
+  std::size_t pos = 0;
+  relay::Header header;
+  std::string payload;
+
+  while (input.size() - pos >= sizeof(header)) {
+    std::memcpy(&header, input.data() + pos, sizeof(header));
+    if (input.size() - pos - sizeof(header) < header.length)
+      break;
+
+    payload.assign(input, pos + sizeof(header), header.length);
+    pos += sizeof(header) + header.length;
+    handle(header, payload);
+  }
+
+  input.erase(0, pos);
+}
+} // namespace pdb
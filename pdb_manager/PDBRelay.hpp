@@ -0,0 +1,133 @@
+#pragma once
+
+#include <GDBMIParser.hpp>
+#include <PDBPositions.hpp>
+#include <PDBProcSet.hpp>
+#include <PDBRelayProtocol.hpp>
+#include <PDBStackTree.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace pdb {
+/**
+ * Node of the relay tree, run as "pdb_launch --relay <fanout> <fd>".
+ *
+ * A relay serves a contiguous range of ranks. If the range is larger than
+ * fanout, it is split between at most fanout child relays, otherwise the
+ * relay opens the debugger pipes of its ranks itself. Debugger input is
+ * routed down by rank, output is forwarded up unchanged. Stack and position
+ * queries are answered by each relay for its own ranks and reduced with the
+ * replies of its children, so a parent receives one message per child
+ * whatever the number of ranks below it.
+ *
+ * A node relay, started by pdb_launch on every node with the multiplexed
+ * transport, has no Setup and no children. Ranks of its node connect to it in
+ * any order, and it announces each of them to pdb_man with an Attached
+ * message, so pdb_man holds one connection per node instead of one per rank.
+ *
+ * Relays are driven by poll(), every descriptor is non-blocking and output is
+ * queued, so a slow peer never blocks traffic of the others.
+ */
+class PDBRelay {
+public:
+  /**
+   * @param parent - connection to the parent, Setup message is read from it
+   * @param fanout - maximal number of ranks or child relays of one relay
+   */
+  PDBRelay(int parent, std::size_t fanout);
+
+  /**
+   * Node relay
+   * @param parent - connection to pdb_man
+   * @param listener - listening socket the ranks of the node connect to
+   * @param total - number of ranks in the job
+   */
+  PDBRelay(int parent, int listener, std::size_t total);
+  PDBRelay(const PDBRelay &) = delete;
+  ~PDBRelay();
+
+  // Serve until the parent closes the connection
+  void run();
+
+private:
+  struct Endpoint {
+    int in = -1;
+    int out = -1;
+    std::string input;
+    std::string output;
+  };
+
+  struct Child {
+    Endpoint link;
+    std::size_t first;
+    std::size_t count;
+    pid_t pid;
+    bool pending = false; // Query reply not received yet
+  };
+
+  struct Rank {
+    std::size_t rank;
+    Endpoint debugger;
+
+    // Same state GDBDebugger keeps, updated from the output passing by
+    bool running = false;
+    std::pair<std::size_t, std::string> position;
+
+    /**
+     * Stack query in flight. The command carries an MI token, only the reply
+     * with that token and the prompt after it are consumed, other output
+     * passing meanwhile is forwarded
+     */
+    bool querying = false;
+    bool replied = false;
+    std::string token;
+    std::vector<PDBFrame> frames;
+  };
+
+  struct Query {
+    relay::Kind kind;
+    std::size_t waiting = 0;
+    std::unique_ptr<PDBStackTree> stacks;
+    std::unique_ptr<PDBPositionClasses> positions;
+  };
+
+  std::size_t fanout;
+  std::size_t total = 0, first = 0, count = 0;
+  Endpoint parent;
+  std::vector<Child> children;
+  std::vector<Rank> ranks;
+  std::unordered_map<std::size_t, std::size_t> rank_index; // Rank to ranks
+  int listener = -1;
+  std::unique_ptr<Query> query;
+  std::uint64_t next_token = 0; // Of the stack queries
+  mi::Parser parser;
+
+  void setup();
+  void spawnChild(std::size_t child_first, std::size_t child_count,
+                  const std::vector<std::string> &pipes);
+  void openRanks(const std::vector<std::string> &pipes);
+  void acceptRank();
+  Rank *findRank(std::size_t rank);
+
+  void handleParent(const relay::Header &header, std::string &payload);
+  void handleChild(Child &child, const relay::Header &header,
+                   std::string &payload);
+  void handleRank(Rank &rank);
+  void closeRank(Rank &rank);
+  void closeChild(Child &child);
+  void updateState(Rank &rank, const mi::Record &record);
+
+  void startQuery(relay::Kind kind, const std::string &payload);
+  void finishQuery();
+
+  static bool readInto(int fd, std::string &input);
+  static void flush(Endpoint &endpoint);
+  template <typename Handler>
+  static void readMessages(std::string &input, Handler &&handle);
+};
+} // namespace pdb
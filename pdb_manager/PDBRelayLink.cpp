@@ -0,0 +1,277 @@
+#include <PDBRelayLink.hpp>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace pdb {
+PDBRelayLink::PDBRelayLink(
+    std::size_t fanout,
+    const std::vector<std::pair<std::string, std::string>> &pipes,
+    DataHandler on_data, ClosedHandler on_closed)
+    : connection(
+          std::make_shared<Connection>(PDBReactor::instance().makeStrand())) {
+  connection->size = pipes.size();
+  connection->members = PDBProcSet::all(pipes.size());
+  connection->on_data = std::move(on_data);
+  connection->on_closed = std::move(on_closed);
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+    throw std::runtime_error("Error creating relay connection");
+
+  // Arguments are built before forking, the child of a threaded process
+  // must not allocate
+  std::string fanout_arg = std::to_string(fanout);
+  std::string fd_arg = std::to_string(fds[1]);
+
+  pid = ::fork();
+  if (pid < 0) {
+    ::close(fds[0]);
+    ::close(fds[1]);
+    throw std::runtime_error("Error spawning relay");
+  }
+
+  // Relay is started the same way as PDB launch, from the current directory
+  if (pid == 0) {
+    ::fcntl(fds[1], F_SETFD, 0);
+    ::execl("./pdb_launch", "pdb_launch", "--relay", fanout_arg.c_str(),
+            fd_arg.c_str(), static_cast<char *>(nullptr));
+    ::_exit(127);
+  }
+  ::close(fds[1]);
+
+  int write_fd = ::dup(fds[0]);
+  if (write_fd < 0) {
+    ::close(fds[0]);
+    throw std::runtime_error("Error creating relay connection");
+  }
+
+  connection->read_desc.assign(fds[0]);
+  connection->write_desc.assign(write_fd);
+  connection->read_desc.non_blocking(true);
+
+  std::string setup = std::to_string(pipes.size()) + " 0 " +
+                      std::to_string(pipes.size()) + "\n";
+  for (auto &pipe : pipes)
+    setup += pipe.first + " " + pipe.second + "\n";
+  boost::asio::write(connection->write_desc,
+                     boost::asio::buffer(relay::makeMessage(
+                         relay::Kind::Setup, relay::no_rank, setup)));
+
+  awaitInput(connection);
+}
+
+PDBRelayLink::PDBRelayLink(std::shared_ptr<Connection> connection)
+    : connection(std::move(connection)) {}
+
+std::shared_ptr<PDBRelayLink>
+PDBRelayLink::adopt(int fd, std::size_t size, DataHandler on_data,
+                    ClosedHandler on_closed, AttachedHandler on_attached) {
+  auto connection =
+      std::make_shared<Connection>(PDBReactor::instance().makeStrand());
+  connection->size = size;
+  connection->members = PDBProcSet(size);
+  connection->on_data = std::move(on_data);
+  connection->on_closed = std::move(on_closed);
+  connection->on_attached = std::move(on_attached);
+
+  int write_fd = ::dup(fd);
+  if (write_fd < 0) {
+    ::close(fd);
+    throw std::runtime_error("Error adopting relay connection");
+  }
+
+  connection->read_desc.assign(fd);
+  connection->write_desc.assign(write_fd);
+  connection->read_desc.non_blocking(true);
+
+  std::shared_ptr<PDBRelayLink> link(new PDBRelayLink(connection));
+  connection->link = link;
+
+  // Reading starts on the strand, after the link is complete
+  boost::asio::post(connection->read_desc.get_executor(),
+                    [connection]() { awaitInput(connection); });
+  return link;
+}
+
+/**
+ * Closing the connection shuts the tree down from the root, every relay closes
+ * its children and the debugger pipes of its ranks.
+ */
+PDBRelayLink::~PDBRelayLink() {
+  // A handler dispatch has already copied may still run once
+  {
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    connection->on_data = nullptr;
+    connection->on_closed = nullptr;
+    connection->on_attached = nullptr;
+  }
+
+  boost::asio::post(connection->read_desc.get_executor(),
+                    [conn = connection]() {
+                      boost::system::error_code ec;
+                      conn->read_desc.close(ec);
+                      conn->write_desc.close(ec);
+                    });
+
+  // A relay stuck opening pipes of a rank that never started is killed
+  if (pid > 0) {
+    int status;
+    for (int i = 0; i < 100; i++) {
+      if (::waitpid(pid, &status, WNOHANG) != 0)
+        return;
+      ::usleep(10000);
+    }
+
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, &status, 0);
+  }
+}
+
+void PDBRelayLink::send(std::size_t rank, const std::string &data) {
+  auto message = relay::makeMessage(relay::Kind::Data,
+                                    static_cast<std::uint32_t>(rank), data);
+
+  std::lock_guard<std::mutex> lock(write_mutex);
+  boost::asio::write(connection->write_desc, boost::asio::buffer(message));
+}
+
+std::string PDBRelayLink::request(relay::Kind kind, const PDBProcSet &procs) {
+  std::lock_guard<std::mutex> request_lock(request_mutex);
+
+  {
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    connection->has_reply = false;
+    connection->reply.clear();
+  }
+
+  {
+    auto message = relay::makeMessage(kind, relay::no_rank, procs.toString());
+    std::lock_guard<std::mutex> lock(write_mutex);
+    boost::asio::write(connection->write_desc, boost::asio::buffer(message));
+  }
+
+  std::unique_lock<std::mutex> lock(connection->mutex);
+  connection->ready.wait(
+      lock, [&]() { return connection->has_reply || connection->closed; });
+  if (!connection->has_reply)
+    throw std::runtime_error("Relay tree has terminated");
+
+  return std::move(connection->reply);
+}
+
+/**
+ * Handlers are copied under the lock and called after releasing it, so they
+ * are free to issue requests of their own. The lock guards the reply and the
+ * set of members only.
+ */
+void PDBRelayLink::Connection::dispatch(const relay::Header &header,
+                                        const char *payload) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  switch (header.kind) {
+  case relay::Kind::Data:
+    if (header.rank < size) {
+      auto handler = on_data;
+      lock.unlock();
+      if (handler)
+        handler(header.rank, payload, header.length);
+    }
+    break;
+  case relay::Kind::Attached:
+    if (header.rank < size) {
+      members.insert(header.rank);
+      auto handler = on_attached;
+      auto owner = link.lock();
+      lock.unlock();
+      if (handler && owner)
+        handler(header.rank, owner);
+    }
+    break;
+  case relay::Kind::Closed:
+    if (header.rank < size) {
+      auto handler = on_closed;
+      lock.unlock();
+      if (handler)
+        handler(header.rank);
+    }
+    break;
+  case relay::Kind::StacksReply:
+  case relay::Kind::PositionsReply:
+    reply.assign(payload, header.length);
+    has_reply = true;
+    ready.notify_all();
+    break;
+  default:
+    break;
+  }
+}
+
+// The root relay is gone, every rank behind it is closed as well
+void PDBRelayLink::Connection::close() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (closed)
+    return;
+
+  closed = true;
+  ready.notify_all();
+
+  auto handler = on_closed;
+  auto ranks = members;
+  lock.unlock();
+
+  if (handler) {
+    for (auto rank : ranks)
+      handler(rank);
+  }
+}
+
+void PDBRelayLink::awaitInput(std::shared_ptr<Connection> connection) {
+  auto &desc = connection->read_desc;
+
+  desc.async_wait(
+      boost::asio::posix::stream_descriptor::wait_read,
+      [connection = std::move(connection)](boost::system::error_code ec) {
+        if (ec) {
+          connection->close();
+          return;
+        }
+
+        auto &buffer = PDBReactor::scratch();
+        std::size_t n =
+            connection->read_desc.read_some(boost::asio::buffer(buffer), ec);
+
+        if (ec == boost::asio::error::would_block) {
+          awaitInput(std::move(connection));
+          return;
+        }
+
+        if (ec || n == 0) {
+          connection->close();
+          return;
+        }
+
+        // Dispatch every complete message, a partial one waits for the rest
+        auto &input = connection->input;
+        input.append(buffer.data(), n);
+
+        std::size_t pos = 0;
+        relay::Header header;
+        while (input.size() - pos >= sizeof(header)) {
+          std::memcpy(&header, input.data() + pos, sizeof(header));
+          if (input.size() - pos - sizeof(header) < header.length)
+            break;
+
+          connection->dispatch(header, input.data() + pos + sizeof(header));
+          pos += sizeof(header) + header.length;
+        }
+        input.erase(0, pos);
+
+        awaitInput(std::move(connection));
+      });
+}
+} // namespace pdb
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <PDBProcSet.hpp>
+#include <PDBReactor.hpp>
+#include <PDBRelayProtocol.hpp>
+#include <boost/asio.hpp>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+namespace pdb {
+/**
+ * Connection of PDBDebug to the root of a relay tree of pdb_launch processes.
+ * The tree owns the debugger pipes of every rank, this side only exchanges
+ * framed messages with the root relay. Output of a rank is handed to a
+ * callback as it arrives, reduced queries are answered by the tree as a
+ * whole.
+ *
+ * A link may also be adopted from a node relay that connected by itself. Its
+ * ranks are not known up front, each is announced when it attaches.
+ */
+class PDBRelayLink {
+public:
+  using DataHandler =
+      std::function<void(std::size_t rank, const char *data, std::size_t n)>;
+  using ClosedHandler = std::function<void(std::size_t rank)>;
+  using AttachedHandler = std::function<void(
+      std::size_t rank, const std::shared_ptr<PDBRelayLink> &link)>;
+
+  /**
+   * Spawn the root relay and hand it the pipes of every rank
+   * @param fanout - maximal number of children of a relay
+   * @param pipes - read and write pipe names of every rank, in rank order
+   * @param on_data - receives output of a rank's debugger
+   * @param on_closed - called once a rank's debugger has closed its output
+   */
+  PDBRelayLink(std::size_t fanout,
+               const std::vector<std::pair<std::string, std::string>> &pipes,
+               DataHandler on_data, ClosedHandler on_closed);
+  /**
+   * Take over the connection of a node relay
+   * @param fd - connected socket, its hello already consumed
+   * @param size - number of ranks in the job
+   * @param on_attached - called once a rank has connected to the node relay,
+   * before any of its output
+   */
+  static std::shared_ptr<PDBRelayLink> adopt(int fd, std::size_t size,
+                                             DataHandler on_data,
+                                             ClosedHandler on_closed,
+                                             AttachedHandler on_attached);
+
+  PDBRelayLink(const PDBRelayLink &) = delete;
+  PDBRelayLink &operator=(const PDBRelayLink &) = delete;
+  ~PDBRelayLink();
+
+  // Write data to the debugger of rank
+  void send(std::size_t rank, const std::string &data);
+
+  /**
+   * Run a reduced query over a set of ranks and wait for the merged reply.
+   * @param kind - StacksRequest or PositionsRequest
+   * @return Payload of the reply. Throws std::runtime_error if the tree has
+   * terminated
+   */
+  std::string request(relay::Kind kind, const PDBProcSet &procs);
+
+private:
+  /**
+   * State shared with pending reactor handlers, same as PDBProcess::Channel.
+   * Handlers are cleared when the link goes away, so a late message is
+   * dropped instead of reaching a destroyed process.
+   */
+  struct Connection {
+    explicit Connection(const PDBReactor::strand_type &strand)
+        : read_desc(strand), write_desc(strand) {}
+
+    boost::asio::posix::stream_descriptor read_desc;
+    boost::asio::posix::stream_descriptor write_desc;
+    std::string input;
+    std::size_t size = 0;
+    PDBProcSet members; // Ranks reported closed with the connection
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    DataHandler on_data;
+    ClosedHandler on_closed;
+    AttachedHandler on_attached;
+    std::weak_ptr<PDBRelayLink> link;
+    bool closed = false;
+    bool has_reply = false;
+    std::string reply;
+
+    void dispatch(const relay::Header &header, const char *payload);
+    void close();
+  };
+
+  explicit PDBRelayLink(std::shared_ptr<Connection> connection);
+
+  static void awaitInput(std::shared_ptr<Connection> connection);
+
+  std::shared_ptr<Connection> connection;
+  std::mutex write_mutex;
+  std::mutex request_mutex;
+  pid_t pid = -1;
+};
+} // namespace pdb
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace pdb {
+namespace relay {
+/**
+ * Messages exchanged along the relay tree. Every message is a Header followed
+ * by length bytes of payload. Requests travel down, replies travel up already
+ * reduced by every relay on the way.
+ */
+enum class Kind : std::uint32_t {
+  Setup,            // Down: "total first count\n", then one pipe pair per line
+  Data,             // Down: input for rank's debugger. Up: its output
+  Closed,           // Up: rank's debugger has closed its output
+  StacksRequest,    // Down: rank list, payload of PDBProcSet::toString
+  StacksReply,      // Up: PDBStackTree::serialize of the subtree
+  PositionsRequest, // Down: rank list, payload of PDBProcSet::toString
+  PositionsReply,   // Up: PDBPositionClasses::serialize of the subtree
+  Attached          // Up: rank has connected to a node relay, see PDBRelay
+};
+
+struct Header {
+  std::uint32_t rank; // Rank a Data, Closed or Attached message belongs to
+  Kind kind;
+  std::uint64_t length;
+};
+
+constexpr std::uint32_t no_rank = ~std::uint32_t(0);
+
+// Header and payload laid out as they are sent
+inline std::string makeMessage(Kind kind, std::uint32_t rank, const char *data,
+                               std::size_t size) {
+  Header header{rank, kind, size};
+
+  std::string message(sizeof(Header) + size, '\0');
+  message.replace(0, sizeof(Header), reinterpret_cast<const char *>(&header),
+                  sizeof(Header));
+  message.replace(sizeof(Header), size, data, size);
+  return message;
+}
+
+inline std::string makeMessage(Kind kind, std::uint32_t rank,
+                               const std::string &payload) {
+  return makeMessage(kind, rank, payload.data(), payload.size());
+}
+} // namespace relay
+} // namespace pdb
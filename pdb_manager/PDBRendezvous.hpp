@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+namespace pdb {
+namespace rendezvous {
+/**
+ * Channels of all ranks live in one private directory created by PDBDebug.
+ * Each rank finds its own pipes by its rank alone, no lock or shared state
+ * is involved:
+ *   <dir>/<rank>.out - debugger output, read by pdb_man
+ *   <dir>/<rank>.in  - debugger input, written by pdb_man
+ */
+inline std::string outputPipe(const std::string &dir, std::size_t rank) {
+  return dir + "/" + std::to_string(rank) + ".out";
+}
+
+inline std::string inputPipe(const std::string &dir, std::size_t rank) {
+  return dir + "/" + std::to_string(rank) + ".in";
+}
+
+/**
+ * Listening socket of PDBDebug when ranks connect over AF_UNIX sockets. Its
+ * presence in the directory selects that transport. A connecting rank first
+ * sends its rank as a Hello, everything after it is debugger traffic.
+ */
+inline std::string socketPath(const std::string &dir) {
+  return dir + "/socket";
+}
+
+using Hello = std::uint32_t;
+
+/**
+ * With the multiplexed transport, PDBDebug listens here instead. Ranks of a
+ * node connect to the node relay at nodeSocketPath, elected by whoever binds
+ * it first, and only the relay connects here, introducing itself with
+ * node_hello.
+ */
+inline std::string muxSocketPath(const std::string &dir) {
+  return dir + "/mux";
+}
+
+inline std::string nodeSocketPath(const std::string &dir,
+                                  const std::string &node) {
+  return dir + "/node." + node;
+}
+
+constexpr Hello node_hello = ~Hello(0);
+
+/**
+ * Present if ranks are launched lazily: pdb_launch runs the application under
+ * a PDBStub and the debugger is only attached on demand
+ */
+inline std::string lazyMarker(const std::string &dir) {
+  return dir + "/lazy";
+}
+
+// Rank registry of the job, see PDBRegistry
+inline std::string registryFile(const std::string &dir) {
+  return dir + "/registry";
+}
+
+// MPI call trace of a rank, see PDBTraceRing
+inline std::string traceFile(const std::string &dir, std::size_t rank) {
+  return dir + "/" + std::to_string(rank) + ".trace";
+}
+
+// Marker claimed by a launcher that did not provide a rank, see claimRank
+inline std::string slotFile(const std::string &dir, std::size_t rank) {
+  return dir + "/" + std::to_string(rank) + ".slot";
+}
+
+/**
+ * @return Rank of the calling process in the job as assigned by the launcher,
+ * or -1 if no known launcher variable is set
+ */
+inline long launcherRank() {
+  static const char *const variables[] = {
+      "OMPI_COMM_WORLD_RANK", // Open MPI
+      "PMIX_RANK",            // PMIx based launchers
+      "PMI_RANK",             // MPICH, Intel MPI
+      "MV2_COMM_WORLD_RANK",  // MVAPICH2
+      "SLURM_PROCID",         // srun
+      "PALS_RANKID",          // Cray PALS
+      "ALPS_APP_PE",          // Cray ALPS
+  };
+
+  for (auto variable : variables) {
+    const char *value = std::getenv(variable);
+    if (value == nullptr || *value == '\0')
+      continue;
+
+    char *end;
+    long rank = std::strtol(value, &end, 10);
+    if (*end == '\0' && rank >= 0)
+      return rank;
+  }
+
+  return -1;
+}
+} // namespace rendezvous
+} // namespace pdb
@@ -0,0 +1,92 @@
+#include <PDBRendezvous.hpp>
+#include <PDBSocketListener.hpp>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace pdb {
+PDBSocketListener::PDBSocketListener(const std::string &path, std::size_t size,
+                                     ConnectHandler on_connect,
+                                     NodeHandler on_node)
+    : acceptor(
+          std::make_shared<Acceptor>(PDBReactor::instance().makeStrand())),
+      path(path) {
+  acceptor->size = size;
+  acceptor->on_connect = std::move(on_connect);
+  acceptor->on_node = std::move(on_node);
+
+  boost::system::error_code ec;
+  acceptor->acceptor.open(protocol(), ec);
+  if (!ec)
+    acceptor->acceptor.bind(protocol::endpoint(path), ec);
+  if (!ec)
+    acceptor->acceptor.listen(protocol::acceptor::max_listen_connections, ec);
+  if (ec)
+    throw std::runtime_error("Error listening on " + path + ": " +
+                             ec.message());
+
+  boost::asio::post(acceptor->acceptor.get_executor(),
+                    [acceptor = acceptor]() { awaitConnection(acceptor); });
+}
+
+PDBSocketListener::~PDBSocketListener() {
+  {
+    std::lock_guard<std::mutex> lock(acceptor->mutex);
+    acceptor->on_connect = nullptr;
+    acceptor->on_node = nullptr;
+  }
+
+  boost::asio::post(acceptor->acceptor.get_executor(), [acc = acceptor]() {
+    boost::system::error_code ec;
+    acc->acceptor.close(ec);
+  });
+
+  ::unlink(path.c_str());
+}
+
+void PDBSocketListener::awaitConnection(std::shared_ptr<Acceptor> acceptor) {
+  auto &desc = acceptor->acceptor;
+
+  desc.async_accept([acceptor = std::move(acceptor)](
+                        boost::system::error_code ec, protocol::socket peer) {
+    // Listener has been closed
+    if (ec == boost::asio::error::operation_aborted ||
+        !acceptor->acceptor.is_open())
+      return;
+
+    if (!ec) {
+      // Peer is read on its own until the hello is complete
+      struct Connection {
+        explicit Connection(protocol::socket socket)
+            : socket(std::move(socket)) {}
+
+        protocol::socket socket;
+        rendezvous::Hello rank = 0;
+      };
+
+      auto connection = std::make_shared<Connection>(std::move(peer));
+      boost::asio::async_read(
+          connection->socket,
+          boost::asio::buffer(&connection->rank, sizeof(connection->rank)),
+          [acceptor, connection](boost::system::error_code ec, std::size_t) {
+            // The process handler writes in blocking mode, undo what the
+            // asynchronous read has set
+            if (!ec)
+              connection->socket.native_non_blocking(false, ec);
+            if (ec)
+              return;
+
+            std::lock_guard<std::mutex> lock(acceptor->mutex);
+            if (acceptor->on_node &&
+                connection->rank == rendezvous::node_hello)
+              acceptor->on_node(connection->socket.release());
+            else if (acceptor->on_connect &&
+                     connection->rank < acceptor->size)
+              acceptor->on_connect(connection->rank,
+                                   connection->socket.release());
+          });
+    }
+
+    awaitConnection(std::move(acceptor));
+  });
+}
+} // namespace pdb
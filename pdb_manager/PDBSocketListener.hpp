@@ -0,0 +1,57 @@
+#pragma once
+
+#include <PDBReactor.hpp>
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace pdb {
+/**
+ * Listening AF_UNIX socket the ranks connect to. Connections are accepted on
+ * the reactor in whatever order ranks come up; each one is identified by the
+ * rank it sends first and handed over as a plain descriptor. A node relay
+ * introduces itself with rendezvous::node_hello instead.
+ */
+class PDBSocketListener {
+public:
+  using ConnectHandler = std::function<void(std::size_t rank, int fd)>;
+  using NodeHandler = std::function<void(int fd)>;
+
+  /**
+   * Bind and start accepting
+   * @param path - socket file, removed again by the destructor
+   * @param size - number of ranks, connections claiming a larger rank are
+   * dropped
+   * @param on_connect - receives the connected socket of a rank
+   * @param on_node - receives the connection of a node relay, if set
+   */
+  PDBSocketListener(const std::string &path, std::size_t size,
+                    ConnectHandler on_connect, NodeHandler on_node = nullptr);
+  PDBSocketListener(const PDBSocketListener &) = delete;
+  PDBSocketListener &operator=(const PDBSocketListener &) = delete;
+  ~PDBSocketListener();
+
+private:
+  using protocol = boost::asio::local::stream_protocol;
+
+  // State shared with pending reactor handlers, see PDBRelayLink::Connection
+  struct Acceptor {
+    explicit Acceptor(const PDBReactor::strand_type &strand)
+        : acceptor(strand) {}
+
+    protocol::acceptor acceptor;
+    std::size_t size = 0;
+
+    std::mutex mutex;
+    ConnectHandler on_connect;
+    NodeHandler on_node;
+  };
+
+  static void awaitConnection(std::shared_ptr<Acceptor> acceptor);
+
+  std::shared_ptr<Acceptor> acceptor;
+  std::string path;
+};
+} // namespace pdb
@@ -0,0 +1,180 @@
+#include <PDBStackTree.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace pdb {
+PDBStackTree::PDBStackTree(std::size_t size) : size(size) {
+  nodes.push_back(Node{0, 0, 0, 0, 0, PDBProcSet(size)});
+  labels.emplace_back();
+}
+
+// Frames are labelled "func at file:line", file without its directory
+std::uint32_t PDBStackTree::intern(const PDBFrame &frame) {
+  buffer.assign(frame.func.empty() ? "??" : frame.func);
+  if (!frame.file.empty()) {
+    auto slash = frame.file.rfind('/');
+    buffer += " at ";
+    buffer.append(frame.file, slash == std::string::npos ? 0 : slash + 1);
+    buffer += ':';
+    buffer += std::to_string(frame.line);
+  }
+
+  return intern();
+}
+
+std::uint32_t PDBStackTree::intern() {
+  auto iter = label_ids.find(buffer);
+  if (iter != label_ids.end())
+    return iter->second;
+
+  auto id = static_cast<std::uint32_t>(labels.size());
+  labels.push_back(buffer);
+  label_ids.emplace(buffer, id);
+  return id;
+}
+
+std::uint32_t PDBStackTree::child(std::uint32_t parent, std::uint32_t label) {
+  auto key = (static_cast<std::uint64_t>(parent) << 32) | label;
+  auto [iter, inserted] = children.try_emplace(key, 0);
+  if (!inserted)
+    return iter->second;
+
+  auto id = static_cast<std::uint32_t>(nodes.size());
+  nodes.push_back(Node{label, parent, 0, 0, 0, PDBProcSet(size)});
+
+  auto &p = nodes[parent];
+  if (p.child == 0)
+    p.child = id;
+  else
+    nodes[p.last].next = id;
+  p.last = id;
+
+  iter->second = id;
+  return id;
+}
+
+void PDBStackTree::insert(std::size_t rank,
+                          const std::vector<PDBFrame> &frames) {
+  nodes[0].procs.insert(rank);
+
+  // Outermost frame first, so stacks share the path from main down
+  std::size_t depth = 0;
+  while (depth < frames.size() && depth < previous.size()) {
+    auto &frame = frames[frames.size() - 1 - depth];
+    auto &last = previous[depth];
+    if (frame.line != last.line || frame.func != last.func ||
+        frame.file != last.file)
+      break;
+
+    nodes[previous_path[depth]].procs.insert(rank);
+    depth++;
+  }
+
+  previous.resize(frames.size());
+  previous_path.resize(frames.size());
+
+  std::uint32_t node = depth == 0 ? 0 : previous_path[depth - 1];
+  for (; depth < frames.size(); depth++) {
+    auto &frame = frames[frames.size() - 1 - depth];
+    node = child(node, intern(frame));
+    nodes[node].procs.insert(rank);
+
+    previous[depth] = frame;
+    previous_path[depth] = node;
+  }
+}
+
+std::string PDBStackTree::serialize() const {
+  std::string result;
+  for (std::size_t i = 1; i < nodes.size(); i++) {
+    auto &node = nodes[i];
+    result += std::to_string(node.parent);
+    result += '\t';
+    result += node.procs.toString();
+    result += '\t';
+    result += labels[node.label];
+    result += '\n';
+  }
+  return result;
+}
+
+void PDBStackTree::merge(std::string_view serialized) {
+  // Node ids of the serialized tree mapped to ids in this one
+  std::vector<std::uint32_t> ids(1, 0);
+
+  while (!serialized.empty()) {
+    auto end = serialized.find('\n');
+    auto line = serialized.substr(0, end);
+    serialized.remove_prefix(end == std::string_view::npos ? serialized.size()
+                                                           : end + 1);
+
+    auto first_tab = line.find('\t');
+    auto second_tab = line.find('\t', first_tab + 1);
+    if (first_tab == std::string_view::npos ||
+        second_tab == std::string_view::npos)
+      throw std::runtime_error("Malformed stack tree");
+
+    auto parent = std::stoul(std::string(line.substr(0, first_tab)));
+    if (parent >= ids.size())
+      throw std::runtime_error("Malformed stack tree");
+
+    auto procs = PDBProcSet::parse(
+        std::string(line.substr(first_tab + 1, second_tab - first_tab - 1)),
+        size);
+
+    buffer.assign(line.substr(second_tab + 1));
+    auto node = child(ids[parent], intern());
+    nodes[node].procs |= procs;
+    if (parent == 0)
+      nodes[0].procs |= procs;
+
+    ids.push_back(node);
+  }
+}
+
+void PDBStackTree::print(std::ostream &out) const {
+  // Depth-first walk without recursion, stacks can be deep
+  std::vector<std::pair<std::uint32_t, std::size_t>> pending;
+  for (auto i = nodes[0].child; i != 0; i = nodes[i].next)
+    pending.emplace_back(i, 0);
+  std::reverse(pending.begin(), pending.end());
+
+  while (!pending.empty()) {
+    auto [id, depth] = pending.back();
+    pending.pop_back();
+
+    auto &node = nodes[id];
+    out << std::string(depth * 2, ' ') << labels[node.label] << " ["
+        << node.procs.toString() << "]\n";
+
+    auto first = pending.size();
+    for (auto i = node.child; i != 0; i = nodes[i].next)
+      pending.emplace_back(i, depth + 1);
+    std::reverse(pending.begin() + first, pending.end());
+  }
+}
+
+void PDBStackTree::exportDot(std::ostream &out) const {
+  auto escape = [](const std::string &text) {
+    std::string result;
+    for (char c : text) {
+      if (c == '"' || c == '\\')
+        result.push_back('\\');
+      result.push_back(c);
+    }
+    return result;
+  };
+
+  out << "digraph stacks {\n";
+  out << "  node [shape=box];\n";
+  for (std::size_t i = 1; i < nodes.size(); i++) {
+    auto &node = nodes[i];
+    out << "  n" << i << " [label=\"" << escape(labels[node.label]) << "\\n["
+        << node.procs.toString() << "]\"];\n";
+    if (node.parent != 0)
+      out << "  n" << node.parent << " -> n" << i << ";\n";
+  }
+  out << "}\n";
+}
+} // namespace pdb
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <PDBProcSet.hpp>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace pdb {
+// Single stack frame as reported by a debugger
+struct PDBFrame {
+  std::string func;
+  std::string file; // Full path if the debugger knows it
+  std::size_t line = 0;
+};
+
+/**
+ * Call stacks of many ranks merged into a prefix tree. The root stands for
+ * the bottom of every stack, each path from it is a call chain shared by the
+ * ranks of its last node.
+ *
+ * Stacks are merged one at a time. Frame labels are interned and children are
+ * found through a hash table keyed by parent and label, so merging a stack
+ * only allocates for frames the tree has not seen yet.
+ */
+class PDBStackTree {
+public:
+  struct Node {
+    std::uint32_t label;  // Index into labels, root has none
+    std::uint32_t parent; // Root is its own parent
+    std::uint32_t child;  // First child, 0 if none
+    std::uint32_t last;   // Last child, new children are linked after it
+    std::uint32_t next;   // Next sibling, 0 if none
+    PDBProcSet procs;     // Ranks whose stack passes through this node
+  };
+
+  // @param size - number of ranks in the job
+  explicit PDBStackTree(std::size_t size);
+
+  /**
+   * @param rank - rank the stack belongs to
+   * @param frames - stack as reported by a debugger, innermost frame first
+   */
+  void insert(std::size_t rank, const std::vector<PDBFrame> &frames);
+
+  const std::vector<Node> &getNodes() const { return nodes; }
+  const std::string &getLabel(const Node &node) const {
+    return labels[node.label];
+  }
+
+  /**
+   * One node per line, "parent\tranks\tlabel", root omitted. Nodes are
+   * listed in creation order, a parent always precedes its children
+   */
+  std::string serialize() const;
+
+  // Merge a tree serialized by another instance over the same ranks
+  void merge(std::string_view serialized);
+
+  // Indented tree, one node per line with its rank set
+  void print(std::ostream &out) const;
+
+  // Graphviz representation of the tree
+  void exportDot(std::ostream &out) const;
+
+private:
+  std::size_t size;
+  std::vector<Node> nodes;
+  std::vector<std::string> labels;
+  std::unordered_map<std::string, std::uint32_t> label_ids;
+  std::unordered_map<std::uint64_t, std::uint32_t> children;
+
+  // Reused while building labels, so known frames do not allocate
+  std::string buffer;
+
+  /**
+   * Last merged stack, outermost frame first, and the nodes of its path.
+   * Neighbouring ranks tend to stop in the same place, the common part of
+   * their stacks is matched by comparing frames without building labels.
+   */
+  std::vector<PDBFrame> previous;
+  std::vector<std::uint32_t> previous_path;
+
+  std::uint32_t intern(const PDBFrame &frame);
+  std::uint32_t intern(); // Label held in buffer
+  std::uint32_t child(std::uint32_t parent, std::uint32_t label);
+};
+} // namespace pdb
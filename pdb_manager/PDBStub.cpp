@@ -0,0 +1,434 @@
+#include <PDBStub.hpp>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace pdb {
+namespace {
+[[noreturn]] void throwErrno(const std::string &what) {
+  throw std::system_error(std::error_code(errno, std::generic_category()),
+                          what);
+}
+
+std::string signalName(int sig) {
+  switch (sig) {
+  case SIGSEGV:
+    return "SIGSEGV";
+  case SIGBUS:
+    return "SIGBUS";
+  case SIGFPE:
+    return "SIGFPE";
+  case SIGILL:
+    return "SIGILL";
+  case SIGABRT:
+    return "SIGABRT";
+  case SIGKILL:
+    return "SIGKILL";
+  case SIGTERM:
+    return "SIGTERM";
+  case SIGINT:
+    return "SIGINT";
+  case SIGHUP:
+    return "SIGHUP";
+  default:
+    return "SIG" + std::to_string(sig);
+  }
+}
+
+// Signals the application cannot go on from, the debugger is attached then
+bool isFault(int sig) {
+  return sig == SIGSEGV || sig == SIGBUS || sig == SIGFPE || sig == SIGILL ||
+         sig == SIGABRT;
+}
+
+// Children start with the signal disposition the stub has changed
+void restoreSignals() {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  ::sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+  ::signal(SIGPIPE, SIG_DFL);
+}
+
+[[noreturn]] void execArgs(const std::vector<std::string> &args) {
+  std::vector<char *> argv;
+  for (auto &arg : args)
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  argv.push_back(nullptr);
+
+  ::execvp(argv[0], argv.data());
+  ::_exit(127);
+}
+} // namespace
+
+PDBStub::PDBStub(std::vector<std::string> debugger, std::string exec)
+    : debugger(std::move(debugger)), exec(std::move(exec)) {
+  // Children are noticed through a signalfd, polled next to the channel
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (::sigprocmask(SIG_BLOCK, &mask, nullptr) < 0)
+    throwErrno("Error blocking SIGCHLD: ");
+
+  signal_fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signal_fd < 0)
+    throwErrno("Error creating signalfd: ");
+
+  // pdb_man going away is noticed on read, not through a signal
+  ::signal(SIGPIPE, SIG_IGN);
+
+  start();
+}
+
+PDBStub::~PDBStub() {
+  if (app_pid > 0) {
+    ::kill(app_pid, SIGKILL);
+    ::waitpid(app_pid, nullptr, __WALL);
+  }
+  if (signal_fd >= 0)
+    ::close(signal_fd);
+  if (forward_fd >= 0)
+    ::close(forward_fd);
+}
+
+/**
+ * The application is seized before it execs, so no fault escapes the stub.
+ * It allows any process to attach to it, the debugger started later is not
+ * its ancestor, which Yama would otherwise refuse.
+ */
+void PDBStub::start() {
+  int sync[2];
+  if (::pipe2(sync, O_CLOEXEC) < 0)
+    throwErrno("Error creating pipe: ");
+
+  app_pid = ::fork();
+  if (app_pid < 0)
+    throwErrno("Error spawning application: ");
+
+  if (app_pid == 0) {
+    ::prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY, 0, 0, 0);
+    restoreSignals();
+
+    // Standard input carries commands of pdb_man, output is shared with it
+    int null = ::open("/dev/null", O_RDONLY);
+    ::dup2(null, STDIN_FILENO);
+
+    char go;
+    ::close(sync[1]);
+    if (::read(sync[0], &go, 1) != 1)
+      ::_exit(127);
+    execArgs({exec});
+  }
+
+  ::close(sync[0]);
+
+  // Without ptrace, ranks can still be attached on request but faults are
+  // not caught
+  tracing = ::ptrace(PTRACE_SEIZE, app_pid, nullptr,
+                     PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL) == 0;
+  if (tracing)
+    threads.insert(app_pid);
+
+  char go = 1;
+  if (::write(sync[1], &go, 1) != 1)
+    throwErrno("Error starting application: ");
+  ::close(sync[1]);
+}
+
+int PDBStub::run() {
+  send("=pdb-stub,pid=\"" + std::to_string(app_pid) + "\"\n(gdb) \n");
+
+  // Like gdb, the stub stays after the application until it is told to quit
+  while (app_pid > 0 || debugger_pid > 0 || !quit) {
+    pollfd fds[2] = {{signal_fd, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+
+    // The debugger reads the channel once it is spawned, unless commands for
+    // it have been read already. They wait in the channel during hand-over
+    bool reading = forward_fd >= 0 ||
+                   (!quit && state != State::HandingOver &&
+                    state != State::Debugged);
+    nfds_t count = reading ? 2 : 1;
+    if (::poll(fds, count, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      throwErrno("Error polling stub: ");
+    }
+
+    if (fds[0].revents & POLLIN) {
+      signalfd_siginfo info;
+      while (::read(signal_fd, &info, sizeof(info)) == sizeof(info))
+        ;
+      reap();
+    }
+
+    if (count > 1 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+      if (forward_fd >= 0)
+        forwardCommands();
+      else
+        readCommands();
+    }
+  }
+
+  if (WIFSIGNALED(app_status))
+    return 128 + WTERMSIG(app_status);
+  return WEXITSTATUS(app_status);
+}
+
+void PDBStub::readCommands() {
+  char buffer[4096];
+  auto n = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (n < 0 && errno == EINTR)
+    return;
+
+  // pdb_man has gone, so has the job
+  if (n <= 0) {
+    quit = true;
+    if (app_pid > 0)
+      ::kill(app_pid, SIGKILL);
+    return;
+  }
+
+  input.append(buffer, n);
+  for (auto end = input.find('\n'); end != std::string::npos;
+       end = input.find('\n')) {
+    std::string line = input.substr(0, end);
+    input.erase(0, end + 1);
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+      line.pop_back();
+
+    if (line == "quit") {
+      quit = true;
+      if (app_pid > 0)
+        ::kill(app_pid, SIGKILL);
+      return;
+    }
+
+    if (line != "attach") {
+      send("^error,msg=\"No debugger is attached to this rank\"\n(gdb) \n");
+      continue;
+    }
+
+    if (state == State::Exited) {
+      send("^error,msg=\"The application has exited\"\n(gdb) \n");
+      continue;
+    }
+
+    // Anything after it is meant for the debugger
+    requested = true;
+    if (state == State::Native)
+      handOver(-1, 0);
+    return;
+  }
+}
+
+// Pass the channel on to the debugger, see forward_fd
+void PDBStub::forwardCommands() {
+  char buffer[4096];
+  auto n = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (n < 0 && errno == EINTR)
+    return;
+
+  // The debugger sees the end of the channel as it would without the pipe
+  if (n <= 0) {
+    ::close(forward_fd);
+    forward_fd = -1;
+    return;
+  }
+
+  send(forward_fd, std::string(buffer, n));
+}
+
+void PDBStub::reap() {
+  int status;
+  pid_t pid;
+  while ((pid = ::waitpid(-1, &status, WNOHANG | __WALL)) > 0) {
+    if (pid == debugger_pid) {
+      // Like gdb quitting, the end of the debugger ends the application
+      debugger_pid = -1;
+      quit = true;
+      if (forward_fd >= 0) {
+        ::close(forward_fd);
+        forward_fd = -1;
+      }
+      if (app_pid > 0)
+        ::kill(app_pid, SIGKILL);
+      continue;
+    }
+
+    if (WIFSTOPPED(status)) {
+      handleStop(pid, status);
+      continue;
+    }
+
+    threads.erase(pid);
+    if (pid == app_pid) {
+      app_pid = -1;
+      app_status = status;
+      threads.clear();
+
+      // An attached debugger reports the exit by itself
+      if (state != State::Debugged) {
+        state = State::Exited;
+        reportExit();
+        if (requested) {
+          requested = false;
+          send("^error,msg=\"The application has exited\"\n(gdb) \n");
+        }
+      }
+      continue;
+    }
+
+    finishHandOver();
+  }
+}
+
+void PDBStub::handleStop(pid_t tid, int status) {
+  int sig = WSTOPSIG(status);
+  int event = status >> 16;
+  threads.insert(tid);
+
+  // A thread created now is traced already, it must be detached as well
+  if (event == PTRACE_EVENT_CLONE) {
+    unsigned long child;
+    if (::ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &child) == 0)
+      threads.insert(static_cast<pid_t>(child));
+  }
+
+  if (state == State::HandingOver) {
+    // A signal on its way is delivered once the thread is detached
+    detach(tid, event == 0 ? sig : 0);
+    finishHandOver();
+    return;
+  }
+
+  switch (event) {
+  case 0:
+    if (isFault(sig)) {
+      fault = signalName(sig);
+      handOver(tid, sig);
+      break;
+    }
+    ::ptrace(PTRACE_CONT, tid, nullptr, sig);
+    break;
+  case PTRACE_EVENT_STOP:
+    // Group-stop is kept, anything else is a new thread starting
+    if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU)
+      ::ptrace(PTRACE_LISTEN, tid, nullptr, 0);
+    else
+      ::ptrace(PTRACE_CONT, tid, nullptr, 0);
+    break;
+  default:
+    ::ptrace(PTRACE_CONT, tid, nullptr, 0);
+    break;
+  }
+}
+
+/**
+ * Only one tracer is allowed, every thread is detached before the debugger
+ * attaches. Threads are interrupted and detached at their next stop, the
+ * faulting one is detached right away and stops the application with SIGSTOP
+ */
+void PDBStub::handOver(pid_t fault_tid, int sig) {
+  state = State::HandingOver;
+
+  for (auto tid : threads) {
+    if (tid != fault_tid)
+      ::ptrace(PTRACE_INTERRUPT, tid, nullptr, 0);
+  }
+  if (sig != 0)
+    detach(fault_tid, SIGSTOP);
+
+  finishHandOver();
+}
+
+void PDBStub::detach(pid_t tid, int sig) {
+  ::ptrace(PTRACE_DETACH, tid, nullptr, sig);
+  threads.erase(tid);
+}
+
+void PDBStub::finishHandOver() {
+  if (state != State::HandingOver || !threads.empty() || quit)
+    return;
+
+  spawnDebugger();
+}
+
+void PDBStub::spawnDebugger() {
+  std::string greeting = "=pdb-attached,reason=";
+  if (fault.empty())
+    greeting += "\"request\"";
+  else
+    greeting += "\"signal-received\",signal-name=\"" + fault + "\"";
+  if (requested)
+    greeting += ",request=\"1\"";
+  send(greeting + "\n");
+  requested = false;
+
+  auto args = debugger;
+  args.push_back("-p");
+  args.push_back(std::to_string(app_pid));
+
+  int commands[2] = {-1, -1};
+  if (!input.empty() && ::pipe2(commands, O_CLOEXEC) < 0)
+    throwErrno("Error creating pipe: ");
+
+  debugger_pid = ::fork();
+  if (debugger_pid < 0)
+    throwErrno("Error spawning debugger: ");
+
+  if (debugger_pid == 0) {
+    restoreSignals();
+    if (commands[0] >= 0)
+      ::dup2(commands[0], STDIN_FILENO);
+    execArgs(args);
+  }
+
+  if (commands[0] >= 0) {
+    ::close(commands[0]);
+    forward_fd = commands[1];
+    send(forward_fd, input);
+    input.clear();
+  }
+
+  state = State::Debugged;
+}
+
+// Same records gdb prints once its inferior has exited
+void PDBStub::reportExit() {
+  std::string record = "*stopped,reason=";
+  if (WIFSIGNALED(app_status)) {
+    record += "\"exited-signalled\",signal-name=\"" +
+              signalName(WTERMSIG(app_status)) + "\"";
+  } else if (WEXITSTATUS(app_status) == 0) {
+    record += "\"exited-normally\"";
+  } else {
+    char code[8];
+    std::snprintf(code, sizeof(code), "%02o", WEXITSTATUS(app_status));
+    record += "\"exited\",exit-code=\"" + std::string(code) + "\"";
+  }
+
+  send(record + "\n(gdb) \n");
+}
+
+void PDBStub::send(const std::string &text) { send(STDOUT_FILENO, text); }
+
+void PDBStub::send(int fd, const std::string &text) {
+  std::size_t written = 0;
+  while (written < text.size()) {
+    auto n = ::write(fd, text.data() + written, text.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return;
+    written += n;
+  }
+}
+} // namespace pdb
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace pdb {
+/**
+ * Stand-in for the debugger of a rank in the lazy launch mode. pdb_launch
+ * runs the application natively under the stub and only starts the debugger,
+ * attached to the running application, once pdb_man asks for it or the
+ * application faults. A job costs one debugger per rank looked at instead of
+ * one per rank.
+ *
+ * Until then, the stub holds the channel of the rank and speaks just enough
+ * of GDB/MI for pdb_man: it greets with =pdb-stub, reports the exit of the
+ * application the way gdb would, and understands "attach" and "quit". Before
+ * the debugger takes the channel over, the stub announces it with
+ * =pdb-attached, with request="1" if that answers an "attach".
+ *
+ * Faults are caught by tracing the application with PTRACE_SEIZE. On a fault
+ * the thread is detached stopped, still at the faulting instruction, so the
+ * debugger sees the fault again once it continues the application.
+ */
+class PDBStub {
+public:
+  /**
+   * @param debugger - command line of the debugger, "-p <pid>" is appended
+   * @param exec - application, started right away
+   */
+  PDBStub(std::vector<std::string> debugger, std::string exec);
+  PDBStub(const PDBStub &) = delete;
+  ~PDBStub();
+
+  /**
+   * Serve the channel on standard input and output until the application and
+   * its debugger have exited
+   * @return Exit code of the application, 128 + signal if a signal killed it
+   */
+  int run();
+
+private:
+  enum class State {
+    Native,      // Traced by the stub, if tracing is possible
+    HandingOver, // Threads are being detached for the debugger
+    Debugged,    // The debugger owns the channel and the application
+    Exited
+  };
+
+  std::vector<std::string> debugger;
+  std::string exec;
+
+  State state = State::Native;
+  bool tracing = false;
+  bool requested = false; // An "attach" is waiting for its answer
+  bool quit = false;
+  std::string fault;      // Name of the signal that caused the hand-over
+
+  pid_t app_pid = -1;
+  pid_t debugger_pid = -1;
+  int app_status = 0;
+  std::set<pid_t> threads; // Traced threads of the application
+
+  int signal_fd = -1;
+  std::string input;
+
+  /**
+   * Commands read past "attach" belong to the debugger. It is then given a
+   * pipe instead of the channel, fed with them first and with whatever the
+   * channel carries afterwards
+   */
+  int forward_fd = -1;
+
+  void start();
+  void readCommands();
+  void forwardCommands();
+  void reap();
+  void handleStop(pid_t tid, int status);
+  void handOver(pid_t fault_tid, int sig);
+  void detach(pid_t tid, int sig);
+  void finishHandOver();
+  void spawnDebugger();
+  void reportExit();
+
+  static void send(const std::string &text); // To pdb_man
+  static void send(int fd, const std::string &text);
+};
+} // namespace pdb
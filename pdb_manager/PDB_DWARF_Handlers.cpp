@@ -1,99 +1,1173 @@
+#include <PDB_DWARF_Handlers.hpp>
+#include <algorithm>
+#include <atomic>
 #include <boost/leaf.hpp>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/DebugInfo/DWARF/DWARFContext.h>
 #include <llvm/DebugInfo/DWARF/DWARFDie.h>
 #include <llvm/DebugInfo/DWARF/DWARFUnit.h>
 #include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/Error.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/WithColor.h>
+#include <numeric>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_map>
 
-boost::leaf::result<std::vector<std::string>>
-dwarfGetSourceFiles(const std::string &exec_path) {
-  // Create and initialize in-memory representation of DWARF information
-  // containing in executable
-  auto expected_buffer = llvm::MemoryBuffer::getFile(exec_path);
-  if (!expected_buffer)
-    return boost::leaf::new_error<std::string>("Error reading executable");
+namespace pdb {
+namespace {
+/**
+ * Layout of the index image. The same image is queried whether it has just
+ * been built or mapped from the cache file, all offsets are relative to the
+ * beginning of the image. The image is only ever read on the machine that
+ * wrote it, so native byte order is used.
+ */
+constexpr char image_magic[8] = {'P', 'D', 'B', 'I', 'N', 'D', 'E', 'X'};
+constexpr std::uint32_t image_version = 3;
+constexpr std::size_t max_build_id = 64;
 
-  auto expected_obj_file = llvm::object::ObjectFile::createObjectFile(
-      expected_buffer->get()->getMemBufferRef());
-  if (!expected_obj_file)
-    return boost::leaf::new_error<std::string>(
-        "Error creating in-memory executable object");
+struct ImageString {
+  std::uint32_t offset;
+  std::uint32_t size;
+};
 
-  auto dwarf_context = llvm::DWARFContext::create(**expected_obj_file);
-  if (!dwarf_context)
-    return boost::leaf::new_error<std::string>(
-        "Error initializing DWARF information");
+struct ImageFunction {
+  std::uint64_t hash;
+  ImageString name;
+  std::uint32_t file;
+  std::uint32_t line;
+};
 
-  std::vector<std::string> files;
+/**
+ * Line table row. Rows of all units are sorted by address, a row covers
+ * addresses up to the next one. End of a sequence is marked by a row with
+ * file set to no_file, addresses past it belong to no line.
+ */
+struct ImageLine {
+  std::uint64_t address;
+  std::uint32_t file;
+  std::uint32_t line;
+};
+
+constexpr std::uint32_t no_file = ~std::uint32_t(0);
+
+struct ImageHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t build_id_size;
+  std::uint8_t build_id[max_build_id];
+
+  // Executable the image was built from
+  std::int64_t mtime_sec;
+  std::int64_t mtime_nsec;
+  std::uint64_t exec_size;
+
+  std::uint32_t file_count;
+  std::uint32_t function_count;
+  std::uint32_t bucket_count;
+  std::uint32_t reserved;
+  std::uint64_t line_count;
+  std::uint64_t statement_count;
+
+  std::uint64_t files_offset;     // ImageString[file_count]
+  std::uint64_t functions_offset; // ImageFunction[function_count]
+  std::uint64_t buckets_offset;   // uint32_t[bucket_count + 1]
+  std::uint64_t lines_offset;     // ImageLine[line_count], by address
+
+  // uint32_t[statement_count], rows that start a statement ordered by file,
+  // line and address
+  std::uint64_t statements_offset;
+  std::uint64_t strings_offset;
+  std::uint64_t strings_size;
+};
+
+// FNV-1a, stable between runs so hashes can be stored on disk
+std::uint64_t hashName(std::string_view name) {
+  std::uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : name) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Identity of the executable an image belongs to
+struct ExecIdentity {
+  std::string build_id;
+  std::int64_t mtime_sec;
+  std::int64_t mtime_nsec;
+  std::uint64_t size;
+};
 
-  for (const auto &CU : dwarf_context->compile_units()) {
-    if (!CU)
+// Contents of the NT_GNU_BUILD_ID note, empty if there is none
+std::string readBuildId(const llvm::object::ObjectFile &object) {
+  for (const auto &section : object.sections()) {
+    auto name = section.getName();
+    if (!name) {
+      llvm::consumeError(name.takeError());
       continue;
-    const auto *lt = dwarf_context->getLineTableForUnit(CU.get());
-    if (!lt)
+    }
+    if (*name != ".note.gnu.build-id")
       continue;
 
-    for (const auto &entry : lt->Prologue.FileNames) {
+    auto contents = section.getContents();
+    if (!contents) {
+      llvm::consumeError(contents.takeError());
+      return std::string();
+    }
+
+    // Note header: namesz, descsz, type, then name and desc padded to 4
+    llvm::StringRef data = *contents;
+    if (data.size() < 12)
+      return std::string();
+
+    std::uint32_t namesz, descsz, type;
+    std::memcpy(&namesz, data.data(), 4);
+    std::memcpy(&descsz, data.data() + 4, 4);
+    std::memcpy(&type, data.data() + 8, 4);
+
+    std::size_t desc = 12 + ((namesz + 3) & ~3u);
+    if (type != 3 || desc + descsz > data.size())
+      return std::string();
+    return std::string(data.data() + desc, descsz);
+  }
+
+  return std::string();
+}
+
+/**
+ * Directory holding index images: $PDB_CACHE_DIR, $XDG_CACHE_HOME/pdb or
+ * ~/.cache/pdb, whichever is set first. Empty if none of them is.
+ */
+std::string cacheDirectory() {
+  if (const char *dir = std::getenv("PDB_CACHE_DIR"))
+    return dir;
+  if (const char *dir = std::getenv("XDG_CACHE_HOME"))
+    return std::string(dir) + "/pdb";
+  if (const char *dir = std::getenv("HOME"))
+    return std::string(dir) + "/.cache/pdb";
+  return std::string();
+}
+
+/**
+ * Cache file name is derived from build-id and mtime, executables without
+ * build-id fall back to a hash of their path.
+ */
+std::string cachePath(const std::string &exec_path, const ExecIdentity &id) {
+  auto dir = cacheDirectory();
+  if (dir.empty())
+    return std::string();
+
+  static const char digits[] = "0123456789abcdef";
+  std::string key;
+  if (id.build_id.empty()) {
+    std::error_code ec;
+    auto absolute = std::filesystem::absolute(exec_path, ec).string();
+    auto hash = hashName(absolute);
+    for (int i = 60; i >= 0; i -= 4)
+      key.push_back(digits[(hash >> i) & 0xf]);
+  } else {
+    for (unsigned char c : id.build_id) {
+      key.push_back(digits[c >> 4]);
+      key.push_back(digits[c & 0xf]);
+    }
+  }
+
+  return dir + "/" + key + "-" + std::to_string(id.mtime_sec) + ".idx";
+}
+
+/**
+ * Tables collected while walking DWARF information, turned into an image
+ * once every unit has been visited. Each indexing thread fills a builder of
+ * its own, they are merged when all units are done.
+ */
+struct IndexBuilder {
+  struct Function {
+    std::size_t line;
+    std::uint32_t file;
+    std::size_t unit; // Position of the defining unit in the executable
+  };
+
+  std::vector<std::string> files;
+  std::unordered_map<std::string, std::uint32_t> file_ids;
+
+  // Function name to its declaration, definition in the first unit wins
+  std::unordered_map<std::string, Function> functions;
+
+  // Line table rows of every unit, statement rows are flagged separately
+  std::vector<ImageLine> lines;
+  std::vector<bool> statements;
+
+  std::uint32_t addFile(std::string path);
+  void indexUnit(llvm::DWARFContext &context, llvm::DWARFUnit &unit,
+                 std::size_t unit_pos);
+  void merge(IndexBuilder &&other);
+  void sortFiles();
+  std::vector<std::uint64_t> serialize(const ExecIdentity &id) const;
+};
+
+std::uint32_t IndexBuilder::addFile(std::string path) {
+  auto iter = file_ids.find(path);
+  if (iter != file_ids.end())
+    return iter->second;
+
+  auto id = static_cast<std::uint32_t>(files.size());
+  file_ids.emplace(path, id);
+  files.push_back(std::move(path));
+  return id;
+}
+
+void IndexBuilder::indexUnit(llvm::DWARFContext &context,
+                             llvm::DWARFUnit &unit, std::size_t unit_pos) {
+  auto kind = llvm::DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath;
+
+  if (const auto *lt = context.getLineTableForUnit(&unit)) {
+    const char *comp_dir = unit.getCompilationDir();
+
+    // File indices start from 1 before DWARF 5
+    std::size_t base = lt->Prologue.getVersion() >= 5 ? 0 : 1;
+    std::vector<std::uint32_t> unit_files(lt->Prologue.FileNames.size() + base,
+                                          no_file);
+    for (std::size_t i = 0; i < lt->Prologue.FileNames.size(); i++) {
       std::string path;
+      if (lt->getFileNameByIndex(i + base, comp_dir ? comp_dir : "", kind,
+                                 path) &&
+          !path.empty())
+        unit_files[i + base] = addFile(std::move(path));
+    }
+
+    // Sequences at address 0 belong to code discarded by the linker
+    for (const auto &seq : lt->Sequences) {
+      if (!seq.isValid() || seq.LowPC == 0)
+        continue;
 
-      if (entry.DirIdx > 0 &&
-          entry.DirIdx <= lt->Prologue.IncludeDirectories.size()) {
-        if (auto dir = lt->Prologue.IncludeDirectories[entry.DirIdx - 1]
-                           .getAsCString())
-          path = *dir;
-        path += "/";
+      for (auto i = seq.FirstRowIndex; i < seq.LastRowIndex; i++) {
+        const auto &row = lt->Rows[i];
+        std::uint32_t file =
+            row.File < unit_files.size() ? unit_files[row.File] : no_file;
+        if (row.EndSequence)
+          file = no_file;
+
+        lines.push_back(ImageLine{row.Address.Address, file, row.Line});
+        statements.push_back(row.IsStmt && !row.EndSequence &&
+                             file != no_file && row.Line != 0);
       }
+    }
+  }
+
+  for (const auto &entry : unit.dies()) {
+    llvm::DWARFDie die(&unit, &entry);
+    if (die.getTag() != llvm::dwarf::DW_TAG_subprogram)
+      continue;
+
+    const char *name = die.getName(llvm::DINameKind::ShortName);
+    if (name == nullptr || functions.count(name))
+      continue;
+
+    // Obtain function source file and line number, artificial functions
+    // such as _GLOBAL__sub_I_* have none
+    std::string file = die.getDeclFile(kind);
+    if (file.empty())
+      continue;
+    uint64_t line = die.getDeclLine();
+    functions.emplace(name,
+                      Function{line, addFile(std::move(file)), unit_pos});
+  }
+}
+
+void IndexBuilder::merge(IndexBuilder &&other) {
+  std::vector<std::uint32_t> remap(other.files.size());
+  for (std::size_t i = 0; i < other.files.size(); i++)
+    remap[i] = addFile(std::move(other.files[i]));
+
+  // Names are moved over with their nodes, nothing is copied
+  for (auto iter = other.functions.begin(); iter != other.functions.end();) {
+    auto node = other.functions.extract(iter++);
+    node.mapped().file = remap[node.mapped().file];
+
+    auto existing = functions.find(node.key());
+    if (existing == functions.end())
+      functions.insert(std::move(node));
+    else if (node.mapped().unit < existing->second.unit)
+      existing->second = node.mapped();
+  }
+
+  lines.reserve(lines.size() + other.lines.size());
+  for (auto line : other.lines) {
+    if (line.file != no_file)
+      line.file = remap[line.file];
+    lines.push_back(line);
+  }
+  statements.insert(statements.end(), other.statements.begin(),
+                    other.statements.end());
+}
+
+// Order of files depends on thread scheduling, make it stable
+void IndexBuilder::sortFiles() {
+  std::vector<std::uint32_t> order(files.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&](std::uint32_t a, std::uint32_t b) { return files[a] < files[b]; });
+
+  std::vector<std::uint32_t> remap(files.size());
+  std::vector<std::string> sorted(files.size());
+  for (std::size_t i = 0; i < order.size(); i++) {
+    remap[order[i]] = static_cast<std::uint32_t>(i);
+    sorted[i] = std::move(files[order[i]]);
+  }
+
+  files = std::move(sorted);
+  for (auto &[name, function] : functions)
+    function.file = remap[function.file];
+  for (auto &line : lines) {
+    if (line.file != no_file)
+      line.file = remap[line.file];
+  }
+  for (auto &[path, id] : file_ids)
+    id = remap[id];
+}
+
+/**
+ * DWARFContext can be shared between threads since LLVM 17. Older versions
+ * parse units without locking, there each indexing thread but the calling one
+ * creates a context of its own over the same object, see indexUnits
+ */
+std::unique_ptr<llvm::DWARFContext>
+createContext(const llvm::object::ObjectFile &object, std::size_t &threads) {
+  threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+#if LLVM_VERSION_MAJOR >= 17
+  return llvm::DWARFContext::create(
+      object, llvm::DWARFContext::ProcessDebugRelocations::Process, nullptr,
+      "", llvm::WithColor::defaultErrorHandler,
+      llvm::WithColor::defaultWarningHandler, threads > 1);
+#else
+  return llvm::DWARFContext::create(object);
+#endif
+}
+
+// Compile units of context in the order of the executable
+std::vector<llvm::DWARFUnit *> compileUnits(llvm::DWARFContext &context) {
+  std::vector<llvm::DWARFUnit *> units;
+  for (const auto &CU : context.compile_units()) {
+    if (CU)
+      units.push_back(CU.get());
+  }
+  return units;
+}
+
+/**
+ * Index units on a pool of threads. Units are handed out one at a time, so a
+ * few huge units do not leave the other threads idle.
+ */
+IndexBuilder
+indexUnits([[maybe_unused]] const llvm::object::ObjectFile &object,
+           llvm::DWARFContext &context, std::size_t threads) {
+  // Unit list is populated lazily, do it before any thread starts
+  std::vector<llvm::DWARFUnit *> units = compileUnits(context);
+
+  threads = std::min(threads, std::max<std::size_t>(1, units.size()));
+  std::vector<IndexBuilder> partial(threads);
+  std::atomic<std::size_t> next(0);
+
+  auto worker = [&](IndexBuilder &builder, llvm::DWARFContext &own,
+                    const std::vector<llvm::DWARFUnit *> &own_units) {
+    std::size_t i;
+    while ((i = next.fetch_add(1, std::memory_order_relaxed)) < units.size())
+      builder.indexUnit(own, *own_units[i], i);
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(threads - 1);
+  for (std::size_t t = 1; t < threads; t++) {
+    pool.emplace_back([&, t] {
+#if LLVM_VERSION_MAJOR >= 17
+      worker(partial[t], context, units);
+#else
+      // Units come in the same order, a position means the same unit
+      auto own = llvm::DWARFContext::create(object);
+      auto own_units = compileUnits(*own);
+      if (own_units.size() == units.size())
+        worker(partial[t], *own, own_units);
+#endif
+    });
+  }
+  worker(partial[0], context, units);
+
+  for (auto &thread : pool)
+    thread.join();
+
+  for (std::size_t t = 1; t < threads; t++)
+    partial[0].merge(std::move(partial[t]));
+  partial[0].sortFiles();
+  return std::move(partial[0]);
+}
+
+std::vector<std::uint64_t>
+IndexBuilder::serialize(const ExecIdentity &id) const {
+  auto align = [](std::uint64_t n) { return (n + 7) & ~std::uint64_t(7); };
+
+  std::string strings;
+  auto addString = [&](std::string_view str) {
+    ImageString result{static_cast<std::uint32_t>(strings.size()),
+                       static_cast<std::uint32_t>(str.size())};
+    strings.append(str.data(), str.size());
+    return result;
+  };
+
+  std::vector<ImageString> file_table;
+  file_table.reserve(files.size());
+  for (auto &file : files)
+    file_table.push_back(addString(file));
+
+  // Functions are grouped by bucket, bucket i spans
+  // [buckets[i], buckets[i + 1]) of the function table
+  auto bucket_count =
+      static_cast<std::uint32_t>(std::max<std::size_t>(1, functions.size()));
+  std::vector<ImageFunction> function_table;
+  function_table.reserve(functions.size());
+  for (auto &[name, function] : functions) {
+    function_table.push_back(ImageFunction{
+        hashName(name), addString(name), function.file,
+        static_cast<std::uint32_t>(function.line)});
+  }
+
+  std::sort(function_table.begin(), function_table.end(),
+            [&](const ImageFunction &a, const ImageFunction &b) {
+              return a.hash % bucket_count < b.hash % bucket_count;
+            });
+
+  std::vector<std::uint32_t> buckets(bucket_count + 1, 0);
+  for (auto &function : function_table)
+    buckets[function.hash % bucket_count + 1]++;
+  for (std::size_t i = 1; i < buckets.size(); i++)
+    buckets[i] += buckets[i - 1];
+
+  /**
+   * Rows are sorted by address, an end of sequence goes first when another
+   * sequence starts at the same address. Rows at the same address otherwise
+   * keep their order within the sequence.
+   */
+  std::vector<std::uint32_t> order(lines.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](std::uint32_t a, std::uint32_t b) {
+                     if (lines[a].address != lines[b].address)
+                       return lines[a].address < lines[b].address;
+                     return lines[a].file == no_file &&
+                            lines[b].file != no_file;
+                   });
+
+  std::vector<ImageLine> line_table;
+  std::vector<std::uint32_t> statement_table;
+  line_table.reserve(lines.size());
+  for (auto i : order) {
+    if (statements[i])
+      statement_table.push_back(static_cast<std::uint32_t>(line_table.size()));
+    line_table.push_back(lines[i]);
+  }
+
+  std::sort(statement_table.begin(), statement_table.end(),
+            [&](std::uint32_t a, std::uint32_t b) {
+              const auto &x = line_table[a];
+              const auto &y = line_table[b];
+              return std::tie(x.file, x.line, x.address) <
+                     std::tie(y.file, y.line, y.address);
+            });
+
+  ImageHeader header{};
+  std::memcpy(header.magic, image_magic, sizeof(image_magic));
+  header.version = image_version;
+  header.build_id_size = static_cast<std::uint32_t>(
+      std::min(id.build_id.size(), max_build_id));
+  std::memcpy(header.build_id, id.build_id.data(), header.build_id_size);
+  header.mtime_sec = id.mtime_sec;
+  header.mtime_nsec = id.mtime_nsec;
+  header.exec_size = id.size;
+  header.file_count = static_cast<std::uint32_t>(file_table.size());
+  header.function_count = static_cast<std::uint32_t>(function_table.size());
+  header.bucket_count = bucket_count;
+  header.line_count = line_table.size();
+  header.statement_count = statement_table.size();
+
+  header.files_offset = align(sizeof(ImageHeader));
+  header.functions_offset =
+      align(header.files_offset + file_table.size() * sizeof(ImageString));
+  header.buckets_offset = align(header.functions_offset +
+                                function_table.size() * sizeof(ImageFunction));
+  header.lines_offset = align(header.buckets_offset +
+                              buckets.size() * sizeof(std::uint32_t));
+  header.statements_offset =
+      align(header.lines_offset + line_table.size() * sizeof(ImageLine));
+  header.strings_offset =
+      align(header.statements_offset +
+            statement_table.size() * sizeof(std::uint32_t));
+  header.strings_size = strings.size();
+
+  std::uint64_t total = header.strings_offset + strings.size();
+  std::vector<std::uint64_t> image(align(total) / 8, 0);
+  char *base = reinterpret_cast<char *>(image.data());
+
+  std::memcpy(base, &header, sizeof(header));
+  std::memcpy(base + header.files_offset, file_table.data(),
+              file_table.size() * sizeof(ImageString));
+  std::memcpy(base + header.functions_offset, function_table.data(),
+              function_table.size() * sizeof(ImageFunction));
+  std::memcpy(base + header.buckets_offset, buckets.data(),
+              buckets.size() * sizeof(std::uint32_t));
+  std::memcpy(base + header.lines_offset, line_table.data(),
+              line_table.size() * sizeof(ImageLine));
+  std::memcpy(base + header.statements_offset, statement_table.data(),
+              statement_table.size() * sizeof(std::uint32_t));
+  std::memcpy(base + header.strings_offset, strings.data(), strings.size());
+  return image;
+}
+
+using FunctionLocation = std::pair<std::size_t, std::string>;
+
+// Outcome of a lookup through an accelerator table
+enum class AccelLookup { Found, Missing, Unavailable };
+
+// Declaration of a subprogram DIE, false if die is not a subprogram or has no
+// declaration file, which IndexBuilder skips as well
+bool declarationOf(const llvm::DWARFDie &die, FunctionLocation &location) {
+  if (!die || die.getTag() != llvm::dwarf::DW_TAG_subprogram)
+    return false;
+
+  auto kind = llvm::DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath;
+  std::string file = die.getDeclFile(kind);
+  if (file.empty())
+    return false;
+
+  location.first = die.getDeclLine();
+  location.second = std::move(file);
+  return true;
+}
+
+/**
+ * .debug_names lookup, only the units holding a match are parsed. The table
+ * is used only if it lists every unit, otherwise a miss proves nothing.
+ */
+AccelLookup lookupDebugNames(llvm::DWARFContext &context,
+                             const std::string &name,
+                             FunctionLocation &location) {
+  if (context.getDWARFObj().getNamesSection().Data.empty())
+    return AccelLookup::Unavailable;
+
+  const auto &names = context.getDebugNames();
+  std::size_t covered = 0;
+  for (const auto &index : names)
+    covered += index.getCUCount();
+  if (covered < context.getNumCompileUnits())
+    return AccelLookup::Unavailable;
+
+  for (const auto &entry : names.equal_range(name)) {
+    if (entry.tag() != llvm::dwarf::DW_TAG_subprogram)
+      continue;
+
+    auto cu_offset = entry.getCUOffset();
+    auto die_offset = entry.getDIEUnitOffset();
+    if (!cu_offset || !die_offset)
+      continue;
+
+    auto *unit = context.getCompileUnitForOffset(*cu_offset);
+    if (unit == nullptr)
+      continue;
+
+    if (declarationOf(unit->getDIEForOffset(*cu_offset + *die_offset),
+                      location))
+      return AccelLookup::Found;
+  }
+
+  return AccelLookup::Missing;
+}
+
+// Symbol hash of the .gdb_index format, see mapped_index_string_hash in gdb
+std::uint32_t gdbIndexHash(std::uint32_t version, std::string_view name) {
+  std::uint32_t hash = 0;
+  for (unsigned char c : name) {
+    if (version >= 5)
+      c = static_cast<unsigned char>(std::tolower(c));
+    hash = hash * 67 + c - 113;
+  }
+  return hash;
+}
+
+/**
+ * .gdb_index lookup. Symbols are hashed by their qualified name without
+ * parameters, the matching unit is then searched for the subprogram itself.
+ */
+AccelLookup lookupGdbIndex(llvm::DWARFContext &context, const std::string &name,
+                           FunctionLocation &location) {
+  llvm::StringRef data = context.getDWARFObj().getGdbIndexSection();
+  if (data.size() < 28)
+    return AccelLookup::Unavailable;
+
+  auto read32 = [&](std::uint64_t offset) {
+    std::uint32_t value = 0;
+    if (offset + 4 <= data.size())
+      std::memcpy(&value, data.data() + offset, 4);
+    return value;
+  };
+
+  // Version 9 has added the shortcut table in front of the constant pool
+  std::uint32_t version = read32(0);
+  if (version < 7 || version > 9)
+    return AccelLookup::Unavailable;
 
-      if (auto name = entry.Name.getAsCString())
-        path += *name;
+  std::uint64_t cu_list = read32(4);
+  std::uint64_t cu_count = (read32(8) - cu_list) / 16;
+  std::uint64_t symbols = read32(16);
+  std::uint64_t symbols_end = read32(20);
+  std::uint64_t pool = version >= 9 ? read32(24) : symbols_end;
 
-      if (!path.empty())
-        files.push_back(path);
+  std::uint64_t slots = (symbols_end - symbols) / 8;
+  if (symbols_end < symbols || pool > data.size() || slots == 0 ||
+      (slots & (slots - 1)) != 0)
+    return AccelLookup::Unavailable;
+
+  // Qualified names are stored without the scope the user may have omitted
+  std::string_view short_name = name;
+  auto scope = short_name.rfind("::");
+  if (scope != std::string_view::npos)
+    short_name.remove_prefix(scope + 2);
+
+  std::uint32_t hash = gdbIndexHash(version, name);
+  std::uint64_t slot = hash & (slots - 1);
+  std::uint64_t step = ((hash * 17) & (slots - 1)) | 1;
+
+  for (std::uint64_t probe = 0; probe < slots; probe++) {
+    std::uint32_t name_offset = read32(symbols + slot * 8);
+    std::uint32_t vector_offset = read32(symbols + slot * 8 + 4);
+    if (name_offset == 0 && vector_offset == 0)
+      return AccelLookup::Missing;
+
+    const char *symbol = data.data() + pool + name_offset;
+    std::size_t room = pool + name_offset < data.size()
+                           ? data.size() - pool - name_offset
+                           : 0;
+    if (std::string_view(symbol, strnlen(symbol, room)) != name) {
+      slot = (slot + step) & (slots - 1);
+      continue;
+    }
+
+    // CU vector: count, then unit index in bits 0-23 and symbol kind in
+    // bits 28-30, kind 3 stands for a function
+    std::uint32_t count = read32(pool + vector_offset);
+    for (std::uint32_t i = 0; i < count; i++) {
+      std::uint32_t cu = read32(pool + vector_offset + 4 + i * 4);
+      if (((cu >> 28) & 7) != 3 || (cu & 0xffffff) >= cu_count)
+        continue;
+
+      std::uint64_t cu_offset = 0;
+      std::uint64_t entry = cu_list + (cu & 0xffffff) * 16;
+      if (entry + 8 <= data.size())
+        std::memcpy(&cu_offset, data.data() + entry, 8);
+
+      auto *unit = context.getCompileUnitForOffset(cu_offset);
+      if (unit == nullptr)
+        continue;
+
+      for (const auto &die_entry : unit->dies()) {
+        llvm::DWARFDie die(unit, &die_entry);
+        if (die.getTag() != llvm::dwarf::DW_TAG_subprogram)
+          continue;
+
+        const char *die_name = die.getName(llvm::DINameKind::ShortName);
+        if (die_name != nullptr && short_name == die_name &&
+            declarationOf(die, location))
+          return AccelLookup::Found;
+      }
     }
+
+    return AccelLookup::Missing;
+  }
+
+  return AccelLookup::Missing;
+}
+
+/**
+ * Check that every table of the image lies within its size and that indices
+ * between tables stay within them, so lookups can trust the image
+ */
+bool validImage(const char *image, std::size_t size, const ExecIdentity &id) {
+  if (size < sizeof(ImageHeader))
+    return false;
+
+  ImageHeader header;
+  std::memcpy(&header, image, sizeof(header));
+  if (std::memcmp(header.magic, image_magic, sizeof(image_magic)) != 0 ||
+      header.version != image_version)
+    return false;
+
+  if (header.build_id_size != std::min(id.build_id.size(), max_build_id) ||
+      std::memcmp(header.build_id, id.build_id.data(),
+                  header.build_id_size) != 0 ||
+      header.mtime_sec != id.mtime_sec || header.mtime_nsec != id.mtime_nsec ||
+      header.exec_size != id.size)
+    return false;
+
+  // Tables are read in place, offsets must keep them aligned
+  auto fits = [&](std::uint64_t offset, std::uint64_t length) {
+    return offset % 8 == 0 && offset <= size && length <= size - offset;
+  };
+
+  if (!fits(header.files_offset,
+            std::uint64_t(header.file_count) * sizeof(ImageString)) ||
+      !fits(header.functions_offset,
+            std::uint64_t(header.function_count) * sizeof(ImageFunction)) ||
+      !fits(header.buckets_offset,
+            (std::uint64_t(header.bucket_count) + 1) * sizeof(std::uint32_t)) ||
+      header.line_count > size / sizeof(ImageLine) ||
+      !fits(header.lines_offset, header.line_count * sizeof(ImageLine)) ||
+      header.statement_count > size / sizeof(std::uint32_t) ||
+      !fits(header.statements_offset,
+            header.statement_count * sizeof(std::uint32_t)) ||
+      !fits(header.strings_offset, header.strings_size) ||
+      header.bucket_count == 0)
+    return false;
+
+  auto valid_string = [&](const ImageString &str) {
+    return str.offset <= header.strings_size &&
+           str.size <= header.strings_size - str.offset;
+  };
+
+  auto *files =
+      reinterpret_cast<const ImageString *>(image + header.files_offset);
+  if (!std::all_of(files, files + header.file_count, valid_string))
+    return false;
+
+  auto *functions =
+      reinterpret_cast<const ImageFunction *>(image + header.functions_offset);
+  if (!std::all_of(functions, functions + header.function_count,
+                   [&](const ImageFunction &function) {
+                     return valid_string(function.name) &&
+                            function.file < header.file_count;
+                   }))
+    return false;
+
+  auto *buckets =
+      reinterpret_cast<const std::uint32_t *>(image + header.buckets_offset);
+  if (!std::all_of(buckets, buckets + header.bucket_count + 1,
+                   [&](std::uint32_t bucket) {
+                     return bucket <= header.function_count;
+                   }))
+    return false;
+
+  auto *lines = reinterpret_cast<const ImageLine *>(image + header.lines_offset);
+  if (!std::all_of(lines, lines + header.line_count, [&](const ImageLine &line) {
+        return line.file < header.file_count || line.file == no_file;
+      }))
+    return false;
+
+  auto *statements =
+      reinterpret_cast<const std::uint32_t *>(image + header.statements_offset);
+  return std::all_of(statements, statements + header.statement_count,
+                     [&](std::uint32_t row) { return row < header.line_count; });
+}
+
+// Write the image next to its final name and move it in place atomically
+void writeImage(const std::string &path,
+                const std::vector<std::uint64_t> &image) {
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), ec);
+  if (ec)
+    return;
+
+  std::string temp = path + ".XXXXXX";
+  int fd = ::mkstemp(temp.data());
+  if (fd < 0)
+    return;
+
+  const char *data = reinterpret_cast<const char *>(image.data());
+  std::size_t left = image.size() * sizeof(std::uint64_t);
+  while (left > 0) {
+    ssize_t n = ::write(fd, data, left);
+    if (n <= 0)
+      break;
+    data += n;
+    left -= n;
   }
 
-  return files;
+  ::close(fd);
+  if (left != 0 || ::rename(temp.c_str(), path.c_str()) < 0)
+    ::unlink(temp.c_str());
 }
+} // namespace
+
+struct DwarfIndex::Impl {
+  // In-memory representation of executable
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  std::unique_ptr<llvm::object::ObjectFile> object;
+  ExecIdentity identity;
+  std::string cache;
+
+  /**
+   * DWARF context, only created if the executable has no cached image. Full
+   * index is built from it on first query the accelerator tables cannot
+   * answer.
+   */
+  std::unique_ptr<llvm::DWARFContext> context;
+  std::size_t threads = 1;
+
+  // Index image, either owned or mapped from the cache file
+  std::vector<std::uint64_t> storage;
+  void *mapping = nullptr;
+  std::size_t mapping_size = 0;
+  const char *image = nullptr;
+
+  // Source file table unpacked from the image
+  std::vector<std::string> files;
+  std::unordered_map<std::string, std::uint32_t> file_ids;
+
+  ~Impl() {
+    if (mapping != nullptr)
+      ::munmap(mapping, mapping_size);
+  }
+
+  const ImageHeader &header() const {
+    return *reinterpret_cast<const ImageHeader *>(image);
+  }
+
+  template <typename T> const T *table(std::uint64_t offset) const {
+    return reinterpret_cast<const T *>(image + offset);
+  }
+
+  std::string_view string(ImageString str) const {
+    return std::string_view(image + header().strings_offset + str.offset,
+                            str.size);
+  }
+
+  bool mapCache();
+  void unpackFiles();
+  void build();
+  bool findFunction(const std::string &name, FunctionLocation &location) const;
+  bool findAddress(std::uint64_t address, FunctionLocation &location) const;
+  std::vector<DwarfIndex::AddressRange> findLine(std::uint32_t file,
+                                                 std::uint32_t line) const;
+  std::uint32_t findStatement(std::uint32_t file, std::uint32_t line) const;
+};
+
+bool DwarfIndex::Impl::mapCache() {
+  int fd = ::open(cache.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (::fstat(fd, &st) < 0 || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+
+  if (!validImage(static_cast<const char *>(addr), st.st_size, identity)) {
+    ::munmap(addr, st.st_size);
+    return false;
+  }
+
+  mapping = addr;
+  mapping_size = st.st_size;
+  image = static_cast<const char *>(addr);
+  return true;
+}
+
+void DwarfIndex::Impl::unpackFiles() {
+  auto *file_table = table<ImageString>(header().files_offset);
+
+  files.reserve(header().file_count);
+  for (std::uint32_t i = 0; i < header().file_count; i++) {
+    files.emplace_back(string(file_table[i]));
+    file_ids.emplace(files.back(), i);
+  }
+}
+
+// Walk every unit once, queries never go back to the DIEs afterwards
+void DwarfIndex::Impl::build() {
+  if (image != nullptr)
+    return;
+
+  IndexBuilder builder = indexUnits(*object, *context, threads);
+
+  storage = builder.serialize(identity);
+  image = reinterpret_cast<const char *>(storage.data());
+  files = std::move(builder.files);
+  file_ids = std::move(builder.file_ids);
+
+  if (!cache.empty())
+    writeImage(cache, storage);
+}
+
+bool DwarfIndex::Impl::findFunction(const std::string &name,
+                                    FunctionLocation &location) const {
+  auto *functions = table<ImageFunction>(header().functions_offset);
+  auto *buckets = table<std::uint32_t>(header().buckets_offset);
 
-boost::leaf::result<std::pair<uint64_t, std::string>>
-dwarfGetFunctionLocation(const std::string &exec_path,
-                         const std::string &func_name) {
-  // Create and initialize in-memory representation of DWARF information
-  // containing in executable
+  auto hash = hashName(name);
+  auto bucket = hash % header().bucket_count;
+
+  for (auto i = buckets[bucket]; i < buckets[bucket + 1]; i++) {
+    const auto &function = functions[i];
+    if (function.hash != hash || string(function.name) != name ||
+        function.file >= files.size())
+      continue;
+
+    location.first = function.line;
+    location.second = files[function.file];
+    return true;
+  }
+
+  return false;
+}
+
+// Last row at or below the address, the row covers it unless it ends a sequence
+bool DwarfIndex::Impl::findAddress(std::uint64_t address,
+                                   FunctionLocation &location) const {
+  auto *lines = table<ImageLine>(header().lines_offset);
+  auto *end = lines + header().line_count;
+
+  auto row = std::upper_bound(
+      lines, end, address,
+      [](std::uint64_t addr, const ImageLine &line) {
+        return addr < line.address;
+      });
+  if (row == lines)
+    return false;
+
+  --row;
+  if (row->file == no_file || row->file >= files.size())
+    return false;
+
+  location.first = row->line;
+  location.second = files[row->file];
+  return true;
+}
+
+/**
+ * Statement rows of a line are adjacent in the statement table. Each one opens
+ * a range up to the next row by address, ranges that touch are merged.
+ */
+std::vector<DwarfIndex::AddressRange>
+DwarfIndex::Impl::findLine(std::uint32_t file, std::uint32_t line) const {
+  auto *lines = table<ImageLine>(header().lines_offset);
+  auto *statements = table<std::uint32_t>(header().statements_offset);
+  auto *statements_end = statements + header().statement_count;
+
+  auto first = std::lower_bound(
+      statements, statements_end, std::make_pair(file, line),
+      [&](std::uint32_t row, const std::pair<std::uint32_t, std::uint32_t> &key) {
+        return std::make_pair(lines[row].file, lines[row].line) < key;
+      });
+
+  std::vector<DwarfIndex::AddressRange> ranges;
+  for (auto it = first; it != statements_end; ++it) {
+    const auto &row = lines[*it];
+    if (row.file != file || row.line != line)
+      break;
+
+    // Extend over following rows of the same line that are not statements
+    auto next = *it + 1;
+    while (next < header().line_count && lines[next].file == file &&
+           lines[next].line == line)
+      next++;
+
+    std::uint64_t end =
+        next < header().line_count ? lines[next].address : row.address;
+    if (end <= row.address)
+      continue;
+
+    if (!ranges.empty() && ranges.back().second >= row.address)
+      ranges.back().second = std::max(ranges.back().second, end);
+    else
+      ranges.emplace_back(row.address, end);
+  }
+
+  return ranges;
+}
+
+// First statement line at or after the given one, 0 if there is none
+std::uint32_t DwarfIndex::Impl::findStatement(std::uint32_t file,
+                                              std::uint32_t line) const {
+  auto *lines = table<ImageLine>(header().lines_offset);
+  auto *statements = table<std::uint32_t>(header().statements_offset);
+  auto *statements_end = statements + header().statement_count;
+
+  auto it = std::lower_bound(
+      statements, statements_end, std::make_pair(file, line),
+      [&](std::uint32_t row, const std::pair<std::uint32_t, std::uint32_t> &key) {
+        return std::make_pair(lines[row].file, lines[row].line) < key;
+      });
+  if (it == statements_end || lines[*it].file != file)
+    return 0;
+
+  return lines[*it].line;
+}
+
+DwarfIndex::DwarfIndex(std::unique_ptr<Impl> impl) : impl(std::move(impl)) {}
+
+DwarfIndex::~DwarfIndex() = default;
+
+boost::leaf::result<std::unique_ptr<DwarfIndex>>
+DwarfIndex::create(const std::string &exec_path) {
+  auto impl = std::make_unique<Impl>();
+
+  struct stat st;
+  if (::stat(exec_path.c_str(), &st) < 0)
+    return boost::leaf::new_error<std::string>("Error reading executable");
+
+  // Object file is mapped lazily, reading its headers and build-id note does
+  // not touch the debug sections
   auto expected_buffer = llvm::MemoryBuffer::getFile(exec_path);
   if (!expected_buffer)
     return boost::leaf::new_error<std::string>("Error reading executable");
+  impl->buffer = std::move(*expected_buffer);
 
-  auto expected_obj_file = llvm::object::ObjectFile::createObjectFile(
-      expected_buffer->get()->getMemBufferRef());
-  if (!expected_obj_file)
+  auto expected_obj_file =
+      llvm::object::ObjectFile::createObjectFile(impl->buffer->getMemBufferRef());
+  if (!expected_obj_file) {
+    llvm::consumeError(expected_obj_file.takeError());
     return boost::leaf::new_error<std::string>(
         "Error creating in-memory executable object");
+  }
+  impl->object = std::move(*expected_obj_file);
+
+  impl->identity =
+      ExecIdentity{readBuildId(*impl->object), st.st_mtim.tv_sec,
+                   st.st_mtim.tv_nsec, static_cast<std::uint64_t>(st.st_size)};
+  impl->cache = cachePath(exec_path, impl->identity);
+
+  // Warm start, a previous session has already indexed this executable
+  if (!impl->cache.empty() && impl->mapCache()) {
+    impl->unpackFiles();
+    return std::unique_ptr<DwarfIndex>(new DwarfIndex(std::move(impl)));
+  }
 
-  auto dwarf_context = llvm::DWARFContext::create(**expected_obj_file);
-  if (!dwarf_context)
+  impl->context = createContext(*impl->object, impl->threads);
+  if (!impl->context)
     return boost::leaf::new_error<std::string>(
         "Error initializing DWARF information");
 
-  for (const auto &CU : dwarf_context->compile_units()) {
-    for (const auto &entry : CU->dies()) {
-      llvm::DWARFDie die(CU.get(), &entry);
-
-      if (die.getTag() == llvm::dwarf::DW_TAG_subprogram) {
-        if (const char *name = die.getName(llvm::DINameKind::ShortName)) {
-          if (func_name == name) {
-            // Obtain function source file
-            std::string file_idx = die.getDeclFile(
-                llvm::DILineInfoSpecifier::FileLineInfoKind::RawValue);
-            // Obtain function line number
-            uint64_t file_line = die.getDeclLine();
-            return std::make_pair(file_line, file_idx);
-          }
-        }
-      }
+  return std::unique_ptr<DwarfIndex>(new DwarfIndex(std::move(impl)));
+}
+
+const std::vector<std::string> &DwarfIndex::getSourceFiles() const {
+  impl->build();
+  return impl->files;
+}
+
+boost::leaf::result<std::pair<std::size_t, std::string>>
+DwarfIndex::getFunctionLocation(const std::string &func_name) const {
+  FunctionLocation location;
+
+  /**
+   * Until the full index is needed, a single function is looked up through
+   * .debug_names or .gdb_index if the executable has one. Only the matching
+   * unit is parsed then. .gdb_index keys C++ functions by qualified name, so
+   * a miss there may still be found by the short name in the full index.
+   */
+  if (impl->image == nullptr) {
+    auto found = lookupDebugNames(*impl->context, func_name, location);
+    if (found == AccelLookup::Unavailable &&
+        lookupGdbIndex(*impl->context, func_name, location) ==
+            AccelLookup::Found)
+      found = AccelLookup::Found;
+
+    if (found == AccelLookup::Found)
+      return location;
+    if (found == AccelLookup::Missing)
+      return boost::leaf::new_error<std::string>("Unknown function: " +
+                                                 func_name);
+  }
+
+  impl->build();
+  if (impl->findFunction(func_name, location))
+    return location;
+
+  return boost::leaf::new_error<std::string>("Unknown function: " +
+                                             func_name);
+}
+
+boost::leaf::result<std::pair<std::size_t, std::string>>
+DwarfIndex::getAddressLocation(std::uint64_t address) const {
+  impl->build();
+
+  FunctionLocation location;
+  if (impl->findAddress(address, location))
+    return location;
+
+  return boost::leaf::new_error<std::string>("No line information for address");
+}
+
+boost::leaf::result<std::vector<DwarfIndex::AddressRange>>
+DwarfIndex::getLineAddresses(const std::string &file, std::size_t line) const {
+  impl->build();
+
+  auto id = impl->file_ids.find(file);
+  if (id == impl->file_ids.end())
+    return boost::leaf::new_error<std::string>("Unknown source file: " + file);
+
+  auto ranges =
+      impl->findLine(id->second, static_cast<std::uint32_t>(line));
+  if (ranges.empty())
+    return boost::leaf::new_error<std::string>(
+        "No code at " + file + ":" + std::to_string(line));
+
+  return ranges;
+}
+
+boost::leaf::result<std::pair<std::size_t, std::string>>
+DwarfIndex::getBreakpointLocation(const std::string &file,
+                                  std::size_t line) const {
+  impl->build();
+
+  /**
+   * A file given by its full path is looked up directly. Otherwise it has to
+   * match the trailing path components of exactly one source file, the way
+   * gdb resolves "b file:line".
+   */
+  std::uint32_t id = 0;
+  auto exact = impl->file_ids.find(file);
+  if (exact != impl->file_ids.end()) {
+    id = exact->second;
+  } else {
+    std::size_t matches = 0;
+    for (std::uint32_t i = 0; i < impl->files.size(); i++) {
+      const auto &path = impl->files[i];
+      if (path.size() <= file.size() ||
+          path.compare(path.size() - file.size(), file.size(), file) != 0 ||
+          path[path.size() - file.size() - 1] != '/')
+        continue;
+
+      id = i;
+      matches++;
     }
+
+    if (matches == 0)
+      return boost::leaf::new_error<std::string>("No source file named " +
+                                                 file);
+    if (matches > 1)
+      return boost::leaf::new_error<std::string>("Ambiguous source file: " +
+                                                 file);
   }
 
-  return boost::leaf::new_error<std::string>("Unknown function: " + func_name);
+  auto actual = impl->findStatement(id, static_cast<std::uint32_t>(line));
+  if (actual == 0)
+    return boost::leaf::new_error<std::string>(
+        "No code at or after " + file + ":" + std::to_string(line));
+
+  return std::make_pair(static_cast<std::size_t>(actual), impl->files[id]);
 }
+} // namespace pdb
@@ -1,12 +1,81 @@
 #pragma once
 
 #include <boost/leaf.hpp>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
-boost::leaf::result<std::vector<std::string>>
-dwarfGetSourceFiles(const std::string &exec_path);
+namespace pdb {
+/**
+ * Symbol index of a single executable. DWARF information is read and walked
+ * once, when the index is created. Subsequent queries are answered from the
+ * prebuilt tables without touching the executable again.
+ */
+class DwarfIndex {
+public:
+  // Half-open range of instruction addresses [first, second)
+  using AddressRange = std::pair<std::uint64_t, std::uint64_t>;
 
-boost::leaf::result<std::pair<std::size_t, std::string>>
-dwarfGetFunctionLocation(const std::string &exec_path,
-                         const std::string &func_name);
\ No newline at end of file
+  DwarfIndex(const DwarfIndex &) = delete;
+  DwarfIndex &operator=(const DwarfIndex &) = delete;
+  ~DwarfIndex();
+
+  /**
+   * @param exec_path - executable to be indexed
+   * @return On success, index ready to be queried
+   */
+  static boost::leaf::result<std::unique_ptr<DwarfIndex>>
+  create(const std::string &exec_path);
+
+  /**
+   *  @return Full path to every source file recorded in executable, each file
+   *  listed once
+   */
+  const std::vector<std::string> &getSourceFiles() const;
+
+  /**
+   *  @param func_name - name of the function in question
+   *  @return On success, return pair describing function information
+   *  first - location of a function in a source file (line)
+   *  second - full path of a source file of a function in question
+   */
+  boost::leaf::result<std::pair<std::size_t, std::string>>
+  getFunctionLocation(const std::string &func_name) const;
+
+  /**
+   *  @param address - instruction address, as linked in the executable
+   *  @return On success, source position the address belongs to
+   *  first - line in a source file
+   *  second - full path of a source file
+   */
+  boost::leaf::result<std::pair<std::size_t, std::string>>
+  getAddressLocation(std::uint64_t address) const;
+
+  /**
+   *  @param file - full path of a source file, as listed by getSourceFiles
+   *  @param line - line in a source file
+   *  @return On success, address ranges of the statements on the line, sorted
+   *  and not overlapping
+   */
+  boost::leaf::result<std::vector<AddressRange>>
+  getLineAddresses(const std::string &file, std::size_t line) const;
+
+  /**
+   *  @param file - full path of a source file, or its trailing path
+   *  components if they identify a single file
+   *  @param line - requested line in a source file
+   *  @return On success, where a breakpoint would actually be placed
+   *  first - first line at or after the requested one that has code
+   *  second - full path of a source file
+   */
+  boost::leaf::result<std::pair<std::size_t, std::string>>
+  getBreakpointLocation(const std::string &file, std::size_t line) const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+
+  explicit DwarfIndex(std::unique_ptr<Impl> impl);
+};
+} // namespace pdb
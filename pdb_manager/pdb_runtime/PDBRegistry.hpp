@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utility>
+
+namespace pdb {
+// A rank of the job as it has published itself
+struct PDBRankInfo {
+  std::size_t channel; // Index of the rank's debugger in PDBDebug
+  int mpi_rank;        // Rank in MPI_COMM_WORLD
+  pid_t pid;           // Process of the rank, not of its debugger
+  std::string host;
+};
+
+/**
+ * Registry of the ranks of a job, a file created by PDBDebug and mapped by
+ * every rank. PDB launch tells the application where it is and which channel
+ * it was given through PDB_REGISTRY and PDB_CHANNEL, the MPI_Init and
+ * MPI_Init_thread hooks of the PDB runtime then publish the rank into the slot
+ * of its channel and link its MPI rank to that slot.
+ *
+ * Every slot has a single writer and is published with a release store, so
+ * lookups either way are O(1), take no lock and never contact a debugger.
+ *
+ * Layout: Header, a Slot per channel, a channel + 1 per MPI rank (0 if the
+ * rank has not been published)
+ */
+class PDBRegistry {
+public:
+  static constexpr const char *path_variable = "PDB_REGISTRY";
+  static constexpr const char *channel_variable = "PDB_CHANNEL";
+
+  /**
+   * Create the registry of a job with size ranks. Throws std::runtime_error
+   * if the file exists or cannot be mapped
+   */
+  static std::unique_ptr<PDBRegistry> create(const std::string &path,
+                                             std::size_t size) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR);
+    if (fd < 0)
+      throw std::runtime_error("Error creating rank registry " + path);
+
+    // A fresh file reads as zeros, every slot starts out empty
+    std::size_t length = layoutSize(size);
+    if (::ftruncate(fd, static_cast<off_t>(length)) < 0) {
+      ::close(fd);
+      throw std::runtime_error("Error sizing rank registry " + path);
+    }
+
+    std::unique_ptr<PDBRegistry> registry(new PDBRegistry(map(fd, length)));
+    registry->header->size = static_cast<std::uint32_t>(size);
+    registry->header->magic.store(magic, std::memory_order_release);
+    return registry;
+  }
+
+  // Map the registry of a running job, throws std::runtime_error
+  static std::unique_ptr<PDBRegistry> open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error("Error opening rank registry " + path);
+
+    struct stat info;
+    if (::fstat(fd, &info) < 0 ||
+        static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+      ::close(fd);
+      throw std::runtime_error("Invalid rank registry " + path);
+    }
+
+    std::unique_ptr<PDBRegistry> registry(
+        new PDBRegistry(map(fd, static_cast<std::size_t>(info.st_size))));
+    if (registry->header->magic.load(std::memory_order_acquire) != magic ||
+        layoutSize(registry->header->size) > registry->length)
+      throw std::runtime_error("Invalid rank registry " + path);
+    return registry;
+  }
+
+  PDBRegistry(const PDBRegistry &) = delete;
+  PDBRegistry &operator=(const PDBRegistry &) = delete;
+  ~PDBRegistry() { ::munmap(base, length); }
+
+  std::size_t size() const { return header->size; }
+
+  /**
+   * Publish the calling rank, once per channel
+   * @return false if channel or mpi_rank is out of range, or either one is
+   * already taken
+   */
+  bool publish(std::size_t channel, int mpi_rank, pid_t pid,
+               const std::string &host) {
+    if (channel >= size() || mpi_rank < 0 ||
+        static_cast<std::size_t>(mpi_rank) >= size())
+      return false;
+
+    Slot &slot = slots[channel];
+    std::uint32_t empty = 0;
+    if (!slot.state.compare_exchange_strong(empty, writing,
+                                            std::memory_order_acquire))
+      return false;
+
+    slot.mpi_rank = mpi_rank;
+    slot.pid = pid;
+    std::size_t n = std::min(host.size(), sizeof(slot.host) - 1);
+    std::memcpy(slot.host, host.data(), n);
+    slot.host[n] = '\0';
+    slot.state.store(published, std::memory_order_release);
+
+    std::uint32_t unlinked = 0;
+    return ranks()[mpi_rank].compare_exchange_strong(
+        unlinked, static_cast<std::uint32_t>(channel + 1),
+        std::memory_order_release);
+  }
+
+  // @return Rank on the channel, nothing until it has published itself
+  std::optional<PDBRankInfo> byChannel(std::size_t channel) const {
+    if (channel >= size())
+      return std::nullopt;
+
+    const Slot &slot = slots[channel];
+    if (slot.state.load(std::memory_order_acquire) != published)
+      return std::nullopt;
+
+    return PDBRankInfo{channel, slot.mpi_rank, slot.pid,
+                       std::string(slot.host)};
+  }
+
+  // @return Rank with the MPI rank, nothing until it has published itself
+  std::optional<PDBRankInfo> byRank(int mpi_rank) const {
+    if (mpi_rank < 0 || static_cast<std::size_t>(mpi_rank) >= size())
+      return std::nullopt;
+
+    std::uint32_t link = ranks()[mpi_rank].load(std::memory_order_acquire);
+    if (link == 0)
+      return std::nullopt;
+    return byChannel(link - 1);
+  }
+
+private:
+  static constexpr std::uint32_t magic = 0x50444252; // "PDBR"
+  static constexpr std::uint32_t writing = 1;
+  static constexpr std::uint32_t published = 2;
+
+  struct Header {
+    std::atomic<std::uint32_t> magic;
+    std::uint32_t size;
+  };
+
+  struct Slot {
+    std::atomic<std::uint32_t> state;
+    std::int32_t mpi_rank;
+    std::int32_t pid;
+    char host[52];
+  };
+
+  // Shared between processes, the atomics must not fall back to a lock
+  static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+  static std::size_t layoutSize(std::size_t size) {
+    return sizeof(Header) + size * sizeof(Slot) +
+           size * sizeof(std::atomic<std::uint32_t>);
+  }
+
+  static std::pair<void *, std::size_t> map(int fd, std::size_t length) {
+    void *base =
+        ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+      throw std::runtime_error("Error mapping rank registry");
+    return {base, length};
+  }
+
+  explicit PDBRegistry(std::pair<void *, std::size_t> mapping)
+      : base(mapping.first), length(mapping.second),
+        header(static_cast<Header *>(base)),
+        slots(reinterpret_cast<Slot *>(header + 1)) {}
+
+  // Links follow the slots, their place is only known once the size is
+  std::atomic<std::uint32_t> *ranks() const {
+    return reinterpret_cast<std::atomic<std::uint32_t> *>(slots +
+                                                          header->size);
+  }
+
+  void *base;
+  std::size_t length;
+  Header *header;
+  Slot *slots;
+};
+} // namespace pdb
@@ -1,5 +1,6 @@
 /**
  *  Additional hooks for obtaining valuable information about Open MPI runtime.
+ *  Point-to-point and collective calls are traced through their PMPI entries.
  *  Build into shared which is specified in LD_PRELOAD.
  */
 
@@ -7,16 +8,84 @@
 #define _GNU_SOURCE
 #endif
 
+#include <PDBRegistry.hpp>
+#include <PDBTrace.hpp>
 #include <dlfcn.h>
+#include <exception>
 #include <iostream>
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
-// Function pointer for the original MPI_Init function
+// Function pointers for the original MPI_Init and MPI_Init_thread functions
 typedef int (*MPI_Init_t)(int *, char ***);
 MPI_Init_t original_MPI_Init = nullptr;
+typedef int (*MPI_Init_thread_t)(int *, char ***, int, int *);
+MPI_Init_thread_t original_MPI_Init_thread = nullptr;
+
+/**
+ *  Publish the rank into the registry of PDBDebug, so it is found by its MPI
+ *  rank without asking the debugger. Nothing is done for a process not started
+ *  by PDB launch, a failure is reported but never fails MPI_Init
+ */
+static void publishRank(int mpi_rank) {
+  const char *path = getenv(pdb::PDBRegistry::path_variable);
+  const char *channel = getenv(pdb::PDBRegistry::channel_variable);
+  if (path == nullptr || channel == nullptr)
+    return;
+
+  try {
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+
+    auto registry = pdb::PDBRegistry::open(path);
+    if (!registry->publish(strtoul(channel, nullptr, 10), mpi_rank, getpid(),
+                           host))
+      fprintf(stderr, "PDB runtime: cannot publish rank %d on channel %s\n",
+              mpi_rank, channel);
+  } catch (std::exception &e) {
+    fprintf(stderr, "PDB runtime: %s\n", e.what());
+  }
+}
+
+// MPI call trace of this rank, never unmapped so calls made during exit
+// are still safe to log
+static pdb::PDBTraceRing *trace = nullptr;
+
+/**
+ *  Map the MPI call trace PDBDebug reads this rank's last calls from. Its size
+ *  in records may be set with PDB_TRACE_RECORDS, 0 turns tracing off
+ */
+static void startTrace() {
+  const char *path = getenv(pdb::PDBTraceRing::path_variable);
+  if (path == nullptr)
+    return;
+
+  std::size_t capacity = pdb::PDBTraceRing::default_capacity;
+  if (const char *records = getenv(pdb::PDBTraceRing::capacity_variable))
+    capacity = strtoul(records, nullptr, 10);
+  if (capacity == 0)
+    return;
+
+  try {
+    trace = pdb::PDBTraceRing::create(path, capacity).release();
+  } catch (std::exception &e) {
+    fprintf(stderr, "PDB runtime: %s\n", e.what());
+  }
+}
+
+// Start tracing and publish the rank once MPI is initialized
+static void initialized() {
+  // The library is built against the same MPI as the application, the
+  // handle of the world communicator comes from its mpi.h
+  int mpi_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+
+  startTrace();
+  publishRank(mpi_rank);
+}
 
 // Wrapper for MPI_Init
 int MPI_Init(int *argc, char ***argv) {
@@ -30,17 +99,194 @@ int MPI_Init(int *argc, char ***argv) {
   }
 
   int result = original_MPI_Init(argc, argv);
+  if (result == MPI_SUCCESS)
+    initialized();
 
-  /**
-   *  Get the process-related handler to MPI_COMM_WORLD
-   *  The following code is highly unportable and should work only for OpenMPI
-   */
-  MPI_Comm comm_world = (MPI_Comm)dlsym(RTLD_DEFAULT, "MPI_COMM_WORLD");
+  return result;
+}
 
-  int mpi_rank;
-  MPI_Comm_rank(comm_world, &mpi_rank);
+// Wrapper for MPI_Init_thread, used instead of MPI_Init by threaded ranks
+int MPI_Init_thread(int *argc, char ***argv, int required, int *provided) {
+  if (!original_MPI_Init_thread) {
+    original_MPI_Init_thread =
+        (MPI_Init_thread_t)dlsym(RTLD_NEXT, "MPI_Init_thread");
+    if (!original_MPI_Init_thread) {
+      fprintf(stderr, "Error loading original MPI_Init_thread: %s\n",
+              dlerror());
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  // Do some preparation
+  int result = original_MPI_Init_thread(argc, argv, required, provided);
+  if (result == MPI_SUCCESS)
+    initialized();
 
   return result;
+}
+
+/**
+ *  Traces one MPI call for as long as it runs. Without a trace this costs a
+ *  branch, with one a slot write on entry and on return
+ */
+class TracedCall {
+public:
+  TracedCall(pdb::PDBMPICall call, int peer, int tag, MPI_Comm comm,
+             int count, MPI_Datatype type, int source = -1,
+             int source_tag = -1) {
+    if (trace == nullptr)
+      return;
+
+    int size = 0;
+    if (count > 0)
+      PMPI_Type_size(type, &size);
+    index = trace->begin(call, peer, tag, commId(comm),
+                         static_cast<std::uint64_t>(count) * size, source,
+                         source_tag);
+  }
+
+  // Calls that complete requests have no peer of their own
+  explicit TracedCall(pdb::PDBMPICall call) {
+    if (trace != nullptr)
+      index = trace->begin(call, -1, -1, -1, 0);
+  }
+
+  ~TracedCall() {
+    if (trace != nullptr)
+      trace->end(index);
+  }
+
+private:
+  std::uint64_t index = 0;
+
+  // Fortran handle of the communicator, but 0 for MPI_COMM_WORLD with any MPI
+  static int commId(MPI_Comm comm) {
+    return comm == MPI_COMM_WORLD ? 0 : static_cast<int>(MPI_Comm_c2f(comm));
+  }
+};
+
+using pdb::PDBMPICall;
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest,
+             int tag, MPI_Comm comm) {
+  TracedCall traced(PDBMPICall::Send, dest, tag, comm, count, datatype);
+  return PMPI_Send(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Ssend(const void *buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm) {
+  TracedCall traced(PDBMPICall::Ssend, dest, tag, comm, count, datatype);
+  return PMPI_Ssend(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag,
+             MPI_Comm comm, MPI_Status *status) {
+  TracedCall traced(PDBMPICall::Recv, source, tag, comm, count, datatype);
+  return PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm, MPI_Request *request) {
+  TracedCall traced(PDBMPICall::Isend, dest, tag, comm, count, datatype);
+  return PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Request *request) {
+  TracedCall traced(PDBMPICall::Irecv, source, tag, comm, count, datatype);
+  return PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+}
+
+// Logged with its send side
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 int dest, int sendtag, void *recvbuf, int recvcount,
+                 MPI_Datatype recvtype, int source, int recvtag,
+                 MPI_Comm comm, MPI_Status *status) {
+  TracedCall traced(PDBMPICall::Sendrecv, dest, sendtag, comm, sendcount,
+                    sendtype, source, recvtag);
+  return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf,
+                       recvcount, recvtype, source, recvtag, comm, status);
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status) {
+  TracedCall traced(PDBMPICall::Wait);
+  return PMPI_Wait(request, status);
+}
+
+int MPI_Waitall(int count, MPI_Request array_of_requests[],
+                MPI_Status *array_of_statuses) {
+  TracedCall traced(PDBMPICall::Waitall);
+  return PMPI_Waitall(count, array_of_requests, array_of_statuses);
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+  TracedCall traced(PDBMPICall::Barrier, -1, -1, comm, 0, MPI_BYTE);
+  return PMPI_Barrier(comm);
+}
+
+int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root,
+              MPI_Comm comm) {
+  TracedCall traced(PDBMPICall::Bcast, root, -1, comm, count, datatype);
+  return PMPI_Bcast(buffer, count, datatype, root, comm);
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count,
+               MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm) {
+  TracedCall traced(PDBMPICall::Reduce, root, -1, comm, count, datatype);
+  return PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+}
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count,
+                  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+  TracedCall traced(PDBMPICall::Allreduce, -1, -1, comm, count, datatype);
+  return PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+/**
+ *  Collectives with a send and a receive side are logged with the side every
+ *  rank takes part in, the send side but for MPI_Scatter. With MPI_IN_PLACE
+ *  the count and type of that side are ignored by MPI and may be anything,
+ *  the other side is logged then
+ */
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+               void *recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+               MPI_Comm comm) {
+  bool in_place = sendbuf == MPI_IN_PLACE;
+  TracedCall traced(PDBMPICall::Gather, root, -1, comm,
+                    in_place ? recvcount : sendcount,
+                    in_place ? recvtype : sendtype);
+  return PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                     recvtype, root, comm);
+}
+
+int MPI_Scatter(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                void *recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+                MPI_Comm comm) {
+  bool in_place = recvbuf == MPI_IN_PLACE;
+  TracedCall traced(PDBMPICall::Scatter, root, -1, comm,
+                    in_place ? sendcount : recvcount,
+                    in_place ? sendtype : recvtype);
+  return PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                      recvtype, root, comm);
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm) {
+  bool in_place = sendbuf == MPI_IN_PLACE;
+  TracedCall traced(PDBMPICall::Allgather, -1, -1, comm,
+                    in_place ? recvcount : sendcount,
+                    in_place ? recvtype : sendtype);
+  return PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                        recvtype, comm);
+}
+
+int MPI_Alltoall(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 MPI_Comm comm) {
+  bool in_place = sendbuf == MPI_IN_PLACE;
+  TracedCall traced(PDBMPICall::Alltoall, -1, -1, comm,
+                    in_place ? recvcount : sendcount,
+                    in_place ? recvtype : sendtype);
+  return PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                       recvtype, comm);
 }
\ No newline at end of file
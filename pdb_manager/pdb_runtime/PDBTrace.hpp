@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace pdb {
+// MPI calls traced by the PDB runtime
+enum class PDBMPICall : std::uint16_t {
+  Send,
+  Ssend,
+  Recv,
+  Isend,
+  Irecv,
+  Sendrecv,
+  Wait,
+  Waitall,
+  Barrier,
+  Bcast,
+  Reduce,
+  Allreduce,
+  Gather,
+  Scatter,
+  Allgather,
+  Alltoall,
+};
+
+inline const char *callName(PDBMPICall call) {
+  static const char *const names[] = {
+      "MPI_Send",      "MPI_Ssend",    "MPI_Recv",    "MPI_Isend",
+      "MPI_Irecv",     "MPI_Sendrecv", "MPI_Wait",    "MPI_Waitall",
+      "MPI_Barrier",   "MPI_Bcast",    "MPI_Reduce",  "MPI_Allreduce",
+      "MPI_Gather",    "MPI_Scatter",  "MPI_Allgather", "MPI_Alltoall",
+  };
+  auto index = static_cast<std::size_t>(call);
+  return index < sizeof(names) / sizeof(names[0]) ? names[index] : "MPI_?";
+}
+
+/**
+ * One traced call. Peer is the destination, source or root of the call as
+ * given to it, negative if it has none or is a wildcard, and the same goes
+ * for tag. MPI_Sendrecv has its destination in peer and its source in source,
+ * other calls have no source. Communicators are identified by their Fortran
+ * handle, except that MPI_COMM_WORLD is always 0. Times are in ticks, see
+ * PDBTraceRing::ticks
+ */
+struct PDBTraceRecord {
+  std::uint64_t begin;
+  std::uint64_t end; // 0 while the call is in progress
+  std::uint64_t bytes;
+  std::int32_t peer;
+  std::int32_t tag;
+  std::int32_t comm;
+  PDBMPICall call;
+  std::int32_t source;
+  std::int32_t source_tag;
+};
+
+/**
+ * Trace of the last MPI calls of a rank, a ring of fixed-size records in a
+ * file mapped by the rank and by PDBDebug. The rank writes every call at its
+ * start and stamps its end on return, PDBDebug reads the ring while the rank
+ * runs, without stopping it or taking a lock.
+ *
+ * Each slot is a seqlock: its sequence is 0 while the record is written and
+ * the record index + 1 once it is complete. A reader keeps a copy only if the
+ * sequence is the one it expects before and after copying, so a record being
+ * overwritten is dropped instead of read torn. Indices are claimed with one
+ * atomic add, calls of several threads each get a slot of their own.
+ */
+class PDBTraceRing {
+public:
+  static constexpr const char *path_variable = "PDB_TRACE";
+  static constexpr const char *capacity_variable = "PDB_TRACE_RECORDS";
+  static constexpr std::size_t default_capacity = 4096;
+
+  /**
+   * Create the ring of the calling rank with capacity records, rounded up to
+   * a power of 2. The file only appears at path once it is initialised.
+   * Throws std::runtime_error
+   */
+  static std::unique_ptr<PDBTraceRing> create(const std::string &path,
+                                              std::size_t capacity) {
+    std::size_t slots = 1;
+    while (slots < capacity)
+      slots <<= 1;
+
+    std::string temp = path + "." + std::to_string(::getpid());
+    int fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR);
+    if (fd < 0)
+      throw std::runtime_error("Error creating MPI trace " + path);
+
+    std::size_t length = sizeof(Header) + slots * sizeof(Slot);
+    if (::ftruncate(fd, static_cast<off_t>(length)) < 0) {
+      ::close(fd);
+      ::unlink(temp.c_str());
+      throw std::runtime_error("Error sizing MPI trace " + path);
+    }
+
+    std::unique_ptr<PDBTraceRing> ring(
+        new PDBTraceRing(map(fd, length, PROT_READ | PROT_WRITE)));
+    ring->header->capacity = slots;
+    ring->header->magic = magic;
+
+    if (::rename(temp.c_str(), path.c_str()) < 0) {
+      ::unlink(temp.c_str());
+      throw std::runtime_error("Error publishing MPI trace " + path);
+    }
+    return ring;
+  }
+
+  /**
+   * Map the ring of a rank read-only. Throws std::runtime_error, also if the
+   * rank has not created it yet
+   */
+  static std::unique_ptr<PDBTraceRing> open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error("No MPI trace at " + path);
+
+    struct stat info;
+    if (::fstat(fd, &info) < 0 ||
+        static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+      ::close(fd);
+      throw std::runtime_error("Invalid MPI trace " + path);
+    }
+
+    std::unique_ptr<PDBTraceRing> ring(new PDBTraceRing(
+        map(fd, static_cast<std::size_t>(info.st_size), PROT_READ)));
+    auto capacity = ring->header->capacity;
+    if (ring->header->magic != magic || capacity == 0 ||
+        (capacity & (capacity - 1)) != 0 ||
+        sizeof(Header) + capacity * sizeof(Slot) > ring->length)
+      throw std::runtime_error("Invalid MPI trace " + path);
+    return ring;
+  }
+
+  PDBTraceRing(const PDBTraceRing &) = delete;
+  PDBTraceRing &operator=(const PDBTraceRing &) = delete;
+  ~PDBTraceRing() { ::munmap(base, length); }
+
+  /**
+   * Log the start of a call
+   * @return Index to stamp its end with
+   */
+  std::uint64_t begin(PDBMPICall call, int peer, int tag, int comm,
+                      std::uint64_t bytes, int source = -1,
+                      int source_tag = -1) {
+    std::uint64_t index = header->head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = slotOf(index);
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.record = PDBTraceRecord{ticks(), 0, bytes, peer, tag, comm, call,
+                                 source, source_tag};
+    slot.sequence.store(index + 1, std::memory_order_release);
+    return index;
+  }
+
+  // Log the end of a call, unless the ring has wrapped over it meanwhile
+  void end(std::uint64_t index) {
+    Slot &slot = slotOf(index);
+    if (slot.sequence.load(std::memory_order_relaxed) != index + 1)
+      return;
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.record.end = ticks();
+    slot.sequence.store(index + 1, std::memory_order_release);
+  }
+
+  /**
+   * @return Up to last most recent calls, oldest first. A record rewritten
+   * all the time it is read is left out
+   */
+  std::vector<PDBTraceRecord> read(std::size_t last) const {
+    std::uint64_t head = header->head.load(std::memory_order_acquire);
+    std::uint64_t span = std::min<std::uint64_t>(
+        {last, head, header->capacity});
+
+    std::vector<PDBTraceRecord> records;
+    records.reserve(span);
+    for (std::uint64_t index = head - span; index < head; index++) {
+      const Slot &slot = slotOf(index);
+
+      // A call ending just now is briefly being written, it is worth a retry
+      for (int attempt = 0; attempt < 64; attempt++) {
+        std::uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before == 0)
+          continue;
+        if (before != index + 1)
+          break;
+
+        PDBTraceRecord record;
+        std::memcpy(&record, &slot.record, sizeof(record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before) {
+          records.push_back(record);
+          break;
+        }
+      }
+    }
+    return records;
+  }
+
+  /**
+   * Time stamp counter on x86, monotonic nanoseconds elsewhere. Ranks and
+   * PDBDebug of one node read the same counter, so a record's age is now
+   * minus its begin
+   */
+  static std::uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<std::uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+  }
+
+  // Measured once, on first use, this takes 10 ms on x86
+  static double ticksPerMicrosecond() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const double rate = []() {
+      auto start = std::chrono::steady_clock::now();
+      std::uint64_t first = ticks();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      std::uint64_t last = ticks();
+      std::chrono::duration<double, std::micro> elapsed =
+          std::chrono::steady_clock::now() - start;
+      return static_cast<double>(last - first) / elapsed.count();
+    }();
+    return rate;
+#else
+    return 1000.0;
+#endif
+  }
+
+private:
+  static constexpr std::uint32_t magic = 0x50444254; // "PDBT"
+
+  // Head is on a cache line of its own, readers never write to it
+  struct Header {
+    std::uint32_t magic;
+    std::uint32_t reserved;
+    std::uint64_t capacity;
+    alignas(64) std::atomic<std::uint64_t> head;
+  };
+
+  struct alignas(64) Slot {
+    std::atomic<std::uint64_t> sequence;
+    PDBTraceRecord record;
+  };
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+  static_assert(sizeof(Slot) == 64, "A slot takes one cache line");
+
+  static std::pair<void *, std::size_t> map(int fd, std::size_t length,
+                                            int protection) {
+    void *base = ::mmap(nullptr, length, protection, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+      throw std::runtime_error("Error mapping MPI trace");
+    return {base, length};
+  }
+
+  explicit PDBTraceRing(std::pair<void *, std::size_t> mapping)
+      : base(mapping.first), length(mapping.second),
+        header(static_cast<Header *>(base)),
+        slots(reinterpret_cast<Slot *>(header + 1)) {}
+
+  Slot &slotOf(std::uint64_t index) const {
+    return slots[index & (header->capacity - 1)];
+  }
+
+  void *base;
+  std::size_t length;
+  Header *header;
+  Slot *slots;
+};
+} // namespace pdb